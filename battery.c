@@ -10,6 +10,7 @@
 #include <linux/types.h>
 #include <linux/version.h>
 
+#include "codec.h"
 #include "ec.h"
 #include "features.h"
 
@@ -33,32 +34,26 @@ static ssize_t charge_control_end_threshold_show(struct device *dev,
 	if (status < 0)
 		return status;
 
-	status &= BATT_CHARGE_CTRL_VALUE_MASK;
-
-	if (status == 0)
-		status = 100;
-
-	return sprintf(buf, "%d\n", status);
+	return sprintf(buf, "%d\n", qc71_charge_limit_from_ec(status));
 }
 
 static ssize_t charge_control_end_threshold_store(struct device *dev, struct device_attribute *attr,
 						  const char *buf, size_t count)
 {
+	struct qc71_ec_txn_op op;
 	int status, value;
 
-	if (kstrtoint(buf, 10, &value) || !(1 <= value && value <= 100))
+	if (kstrtoint(buf, 10, &value))
 		return -EINVAL;
 
-	status = ec_read_byte(BATT_CHARGE_CTRL_ADDR);
-	if (status < 0)
-		return status;
-
-	if (value == 100)
-		value = 0;
+	value = qc71_charge_limit_to_ec(value);
+	if (value < 0)
+		return value;
 
-	status = (status & ~BATT_CHARGE_CTRL_VALUE_MASK) | value;
+	op = QC71_EC_TXN_UPDATE_OP(BATT_CHARGE_CTRL_ADDR, BATT_CHARGE_CTRL_VALUE_MASK, value);
 
-	status = ec_write_byte(BATT_CHARGE_CTRL_ADDR, status);
+	/* a failure is reported by 'ec_write_flush', reads see the queued value */
+	status = qc71_ec_txn_queue(&op, 1, NULL);
 
 	if (status < 0)
 		return status;
@@ -0,0 +1,476 @@
+// SPDX-License-Identifier: GPL-2.0
+#include "pr.h"
+
+#include <linux/acpi.h>
+#include <linux/atomic.h>
+#include <linux/completion.h>
+#include <linux/debugfs.h>
+#include <linux/init.h>
+#include <linux/kthread.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/mm.h>
+#include <linux/mutex.h>
+#include <linux/sched/signal.h>
+#include <linux/sched/task.h>
+#include <linux/slab.h>
+#include <linux/sort.h>
+#include <linux/string.h>
+#include <linux/types.h>
+#include <linux/uaccess.h>
+
+#include "bench.h"
+#include "ec.h"
+#include "events.h"
+#include "fan.h"
+#include "led_lightbar.h"
+
+#if IS_ENABLED(CONFIG_DEBUG_FS)
+
+/* ========================================================================== */
+
+#define BENCH_MAX_LOOPS   1000000
+#define BENCH_MAX_THREADS 64
+#define BENCH_MAX_SAMPLES (16 * 1024 * 1024)
+
+/* ========================================================================== */
+
+struct qc71_bench_op {
+	const char *name;
+	uint16_t default_addr;
+	int (*run)(uint16_t addr, uint8_t value, enum qc71_ec_prio prio);
+};
+
+struct qc71_bench_config {
+	const struct qc71_bench_op *op;
+	uint16_t addr;
+	uint8_t value; /* the value the 'write' operation writes back */
+	enum qc71_ec_prio prio; /* used by the operations accessing the EC directly */
+	unsigned int loops;
+	unsigned int threads; /* 0 means the calling process */
+};
+
+struct qc71_bench_thread {
+	const struct qc71_bench_config *config;
+	u32 *samples;
+	unsigned int errors;
+	struct task_struct *task;
+};
+
+/* ========================================================================== */
+
+static DEFINE_MUTEX(bench_lock);
+static char bench_result[1024];
+static size_t bench_result_len;
+
+static atomic_t bench_running_threads;
+static DECLARE_COMPLETION(bench_done);
+static bool bench_abort;
+
+/* ========================================================================== */
+
+static int bench_ec_read(uint16_t addr, uint8_t value, enum qc71_ec_prio prio)
+{
+	union qc71_ec_result result;
+
+	return qc71_ec_read_prio(addr, &result, prio);
+}
+
+static int bench_read_byte(uint16_t addr, uint8_t value, enum qc71_ec_prio prio)
+{
+	int err = ec_read_byte_prio(addr, prio);
+
+	return err < 0 ? err : 0;
+}
+
+/* writes back the value the register had when the benchmark started */
+static int bench_write(uint16_t addr, uint8_t value, enum qc71_ec_prio prio)
+{
+	return ec_write_byte_prio(addr, value, prio);
+}
+
+/* decodes an 8 byte buffer event, like the ones the keyboard backlight key generates */
+static int bench_event(uint16_t addr, uint8_t value, enum qc71_ec_prio prio)
+{
+	static const u8 data[8] = { 0xd2, 0xf0 };
+	union acpi_object obj = {
+		.buffer = {
+			.type    = ACPI_TYPE_BUFFER,
+			.length  = sizeof(data),
+			.pointer = (u8 *) data,
+		},
+	};
+
+	return qc71_wmi_events_bench_decode(0xd2, &obj);
+}
+
+#if IS_ENABLED(CONFIG_HWMON)
+static int bench_fan_rpm(uint16_t addr, uint8_t value, enum qc71_ec_prio prio)
+{
+	int err = qc71_fan_get_rpm(0);
+
+	return err < 0 ? err : 0;
+}
+
+static int bench_fan_pwm(uint16_t addr, uint8_t value, enum qc71_ec_prio prio)
+{
+	int err = qc71_fan_get_pwm(0);
+
+	return err < 0 ? err : 0;
+}
+
+static int bench_fan_temp(uint16_t addr, uint8_t value, enum qc71_ec_prio prio)
+{
+	int err = qc71_fan_get_temp(0);
+
+	return err < 0 ? err : 0;
+}
+
+static int bench_fan_mode(uint16_t addr, uint8_t value, enum qc71_ec_prio prio)
+{
+	int err = qc71_fan_get_mode();
+
+	return err < 0 ? err : 0;
+}
+#endif
+
+#if IS_ENABLED(CONFIG_LEDS_CLASS)
+static int bench_lightbar_color(uint16_t addr, uint8_t value, enum qc71_ec_prio prio)
+{
+	int err = qc71_lightbar_get_color();
+
+	return err < 0 ? err : 0;
+}
+#endif
+
+static const struct qc71_bench_op qc71_bench_ops[] = {
+	{ "ec_read",        PROJ_ID_ADDR,      bench_ec_read },
+	{ "read_byte",      PROJ_ID_ADDR,      bench_read_byte },
+	{ "write",          LIGHTBAR_RED_ADDR, bench_write },
+	{ "event",          0,                 bench_event },
+#if IS_ENABLED(CONFIG_HWMON)
+	{ "fan_rpm",        FAN_RPM_1_ADDR,    bench_fan_rpm },
+	{ "fan_pwm",        FAN_PWM_1_ADDR,    bench_fan_pwm },
+	{ "fan_temp",       FAN_TEMP_1_ADDR,   bench_fan_temp },
+	{ "fan_mode",       FAN_CTRL_ADDR,     bench_fan_mode },
+#endif
+#if IS_ENABLED(CONFIG_LEDS_CLASS)
+	{ "lightbar_color", LIGHTBAR_RED_ADDR, bench_lightbar_color },
+#endif
+};
+
+/* ========================================================================== */
+
+static void bench_loop(struct qc71_bench_thread *t)
+{
+	const struct qc71_bench_config *config = t->config;
+	unsigned int i;
+
+	for (i = 0; i < config->loops && !READ_ONCE(bench_abort); i++) {
+		ktime_t start;
+
+		/* running in the context of the writer */
+		if (!config->threads && fatal_signal_pending(current)) {
+			WRITE_ONCE(bench_abort, true);
+			break;
+		}
+
+		start = ktime_get();
+
+		if (config->op->run(config->addr, config->value, config->prio))
+			t->errors += 1;
+
+		t->samples[i] = min_t(s64, U32_MAX, ktime_to_ns(ktime_sub(ktime_get(), start)));
+	}
+}
+
+static int bench_thread_fn(void *arg)
+{
+	bench_loop(arg);
+
+	if (atomic_dec_and_test(&bench_running_threads))
+		complete(&bench_done);
+
+	/* kthread_stop() is going to collect us */
+	while (!kthread_should_stop()) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (!kthread_should_stop())
+			schedule();
+		__set_current_state(TASK_RUNNING);
+	}
+
+	return 0;
+}
+
+static int bench_cmp_u32(const void *a, const void *b)
+{
+	u32 x = *(const u32 *) a, y = *(const u32 *) b;
+
+	return (x > y) - (x < y);
+}
+
+static int bench_run(const struct qc71_bench_config *config)
+{
+	unsigned int thread_count = max(config->threads, 1U), i, errors = 0;
+	struct qc71_bench_thread *threads;
+	size_t sample_count = (size_t) config->loops * thread_count;
+	ktime_t start, elapsed;
+	u32 *samples;
+	int err = 0;
+
+	threads = kcalloc(thread_count, sizeof(*threads), GFP_KERNEL);
+	if (!threads)
+		return -ENOMEM;
+
+	samples = kvmalloc_array(sample_count, sizeof(*samples), GFP_KERNEL);
+	if (!samples) {
+		err = -ENOMEM;
+		goto out_free_threads;
+	}
+
+	for (i = 0; i < thread_count; i++) {
+		threads[i].config  = config;
+		threads[i].samples = samples + (size_t) i * config->loops;
+	}
+
+	WRITE_ONCE(bench_abort, false);
+	start = ktime_get();
+
+	if (!config->threads) {
+		bench_loop(&threads[0]);
+
+		if (READ_ONCE(bench_abort))
+			err = -EINTR;
+	} else {
+		atomic_set(&bench_running_threads, config->threads);
+		reinit_completion(&bench_done);
+
+		for (i = 0; i < config->threads; i++) {
+			struct task_struct *task = kthread_create(bench_thread_fn, &threads[i],
+								  "qc71_bench/%u", i);
+
+			if (IS_ERR(task)) {
+				err = PTR_ERR(task);
+				break;
+			}
+
+			get_task_struct(task);
+			threads[i].task = task;
+		}
+
+		if (err) {
+			/* the threads have not been started, so none of them are going to run */
+			for (i = 0; i < config->threads && threads[i].task; i++) {
+				kthread_stop(threads[i].task);
+				put_task_struct(threads[i].task);
+			}
+
+			goto out_free_samples;
+		}
+
+		for (i = 0; i < config->threads; i++)
+			wake_up_process(threads[i].task);
+
+		if (wait_for_completion_killable(&bench_done)) {
+			WRITE_ONCE(bench_abort, true);
+			wait_for_completion(&bench_done);
+			err = -EINTR;
+		}
+
+		for (i = 0; i < config->threads; i++) {
+			kthread_stop(threads[i].task);
+			put_task_struct(threads[i].task);
+		}
+	}
+
+	elapsed = ktime_sub(ktime_get(), start);
+
+	if (err)
+		goto out_free_samples;
+
+	for (i = 0; i < thread_count; i++)
+		errors += threads[i].errors;
+
+	sort(samples, sample_count, sizeof(*samples), bench_cmp_u32, NULL);
+
+	bench_result_len = scnprintf(bench_result, sizeof(bench_result),
+		"op: %s\n"
+		"addr: %#06x\n"
+		"prio: %s\n"
+		"threads: %u\n"
+		"loops: %u\n"
+		"errors: %u\n"
+		"elapsed_ns: %lld\n"
+		"ops_per_sec: %llu\n"
+		"min_ns: %u\n"
+		"p50_ns: %u\n"
+		"p99_ns: %u\n"
+		"p999_ns: %u\n"
+		"max_ns: %u\n",
+		config->op->name, (unsigned int) config->addr,
+		qc71_ec_prio_names[config->prio],
+		config->threads, config->loops, errors,
+		ktime_to_ns(elapsed),
+		div64_u64((u64) sample_count * NSEC_PER_SEC, max_t(s64, 1, ktime_to_ns(elapsed))),
+		samples[0],
+		samples[sample_count * 50 / 100],
+		samples[sample_count * 99 / 100],
+		samples[sample_count * 999 / 1000],
+		samples[sample_count - 1]);
+
+out_free_samples:
+	kvfree(samples);
+out_free_threads:
+	kfree(threads);
+
+	return err;
+}
+
+/* ========================================================================== */
+
+/* "op=<name> [addr=<addr>] [prio=<class>] [loops=<n>] [threads=<n>]" */
+static int bench_parse_config(char *str, struct qc71_bench_config *config)
+{
+	bool addr_set = false;
+	char *tok;
+	size_t i;
+	int err;
+
+	*config = (struct qc71_bench_config) {
+		.op    = &qc71_bench_ops[0],
+		.prio  = QC71_EC_PRIO_CONTROL,
+		.loops = 1000,
+	};
+
+	while ((tok = strsep(&str, " \t\n")) != NULL) {
+		char *key = strsep(&tok, "=");
+		unsigned int value;
+
+		if (!*key)
+			continue;
+
+		if (!tok)
+			return -EINVAL;
+
+		if (strcmp(key, "op") == 0) {
+			for (i = 0; i < ARRAY_SIZE(qc71_bench_ops); i++) {
+				if (strcmp(tok, qc71_bench_ops[i].name) == 0)
+					break;
+			}
+
+			if (i == ARRAY_SIZE(qc71_bench_ops))
+				return -EOPNOTSUPP;
+
+			config->op = &qc71_bench_ops[i];
+			continue;
+		}
+
+		if (strcmp(key, "prio") == 0) {
+			err = match_string(qc71_ec_prio_names, QC71_EC_PRIO_COUNT, tok);
+			if (err < 0)
+				return err;
+
+			config->prio = err;
+			continue;
+		}
+
+		err = kstrtouint(tok, 0, &value);
+		if (err)
+			return err;
+
+		if (strcmp(key, "addr") == 0 && value <= U16_MAX) {
+			config->addr = value;
+			addr_set = true;
+		} else if (strcmp(key, "loops") == 0 && 1 <= value && value <= BENCH_MAX_LOOPS) {
+			config->loops = value;
+		} else if (strcmp(key, "threads") == 0 && value <= BENCH_MAX_THREADS) {
+			config->threads = value;
+		} else {
+			return -EINVAL;
+		}
+	}
+
+	if (!addr_set)
+		config->addr = config->op->default_addr;
+
+	if ((size_t) config->loops * max(config->threads, 1U) > BENCH_MAX_SAMPLES)
+		return -E2BIG;
+
+	if (config->op->run == bench_write) {
+		err = ec_read_byte(config->addr);
+		if (err < 0)
+			return err;
+
+		config->value = err;
+	}
+
+	return 0;
+}
+
+static ssize_t bench_run_read(struct file *f, char __user *buf, size_t count, loff_t *offset)
+{
+	ssize_t ret = mutex_lock_interruptible(&bench_lock);
+
+	if (ret)
+		return ret;
+
+	ret = simple_read_from_buffer(buf, count, offset, bench_result, bench_result_len);
+
+	mutex_unlock(&bench_lock);
+
+	return ret;
+}
+
+/* runs the benchmark synchronously, the results can be read back from the same file */
+static ssize_t bench_run_write(struct file *f, const char __user *buf, size_t count, loff_t *offset)
+{
+	struct qc71_bench_config config;
+	char *str;
+	int err;
+
+	if (count >= PAGE_SIZE)
+		return -E2BIG;
+
+	str = memdup_user_nul(buf, count);
+	if (IS_ERR(str))
+		return PTR_ERR(str);
+
+	err = mutex_lock_interruptible(&bench_lock);
+	if (err)
+		goto out_free;
+
+	err = bench_parse_config(str, &config);
+	if (err)
+		goto out_unlock;
+
+	bench_result_len = 0;
+
+	err = bench_run(&config);
+
+out_unlock:
+	mutex_unlock(&bench_lock);
+out_free:
+	kfree(str);
+
+	return err ? err : count;
+}
+
+static const struct file_operations bench_run_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.read = bench_run_read,
+	.write = bench_run_write,
+	.llseek = default_llseek,
+};
+
+/* ========================================================================== */
+
+/* the file is removed together with its parent */
+int __init qc71_bench_setup(struct dentry *parent)
+{
+	struct dentry *d = debugfs_create_file("bench", 0600, parent, NULL, &bench_run_fops);
+
+	return PTR_ERR_OR_ZERO(d);
+}
+
+#endif
@@ -0,0 +1,14 @@
+// SPDX-License-Identifier: GPL-2.0
+#ifndef QC71_BENCH_H
+#define QC71_BENCH_H
+
+#if IS_ENABLED(CONFIG_DEBUG_FS)
+
+#include <linux/debugfs.h>
+#include <linux/init.h>
+
+int __init qc71_bench_setup(struct dentry *parent);
+
+#endif
+
+#endif /* QC71_BENCH_H */
@@ -0,0 +1,309 @@
+// SPDX-License-Identifier: GPL-2.0
+#include "pr.h"
+
+#include <linux/init.h>
+#include <linux/input.h>
+#include <linux/jiffies.h>
+#include <linux/kernel.h>
+#include <linux/moduleparam.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/types.h>
+#include <linux/workqueue.h>
+
+#include "boost.h"
+#include "ec.h"
+#include "perf_mode.h"
+#include "power_limit.h"
+
+/* ========================================================================== */
+
+static bool boost;
+module_param(boost, bool, 0444);
+MODULE_PARM_DESC(boost, "raise the turbo level and PL2 while the user is interacting with the machine (default=false)");
+
+static unsigned int boost_window_ms = 2000;
+module_param(boost_window_ms, uint, 0644);
+MODULE_PARM_DESC(boost_window_ms, "how long the boost lasts after the last input event (default=2000)");
+
+static unsigned int boost_interval_ms = 1000;
+module_param(boost_interval_ms, uint, 0644);
+MODULE_PARM_DESC(boost_interval_ms, "minimum time between the end of a boost and the start of the next one (default=1000)");
+
+static unsigned int boost_pl2_w;
+module_param(boost_pl2_w, uint, 0644);
+MODULE_PARM_DESC(boost_pl2_w, "PL2 in watts while boosting, 0 means the peak limit (default=0)");
+
+/* ========================================================================== */
+
+static void qc71_boost_start_fn(struct work_struct *work);
+static void qc71_boost_decay_fn(struct work_struct *work);
+
+static DECLARE_WORK(qc71_boost_start_work, qc71_boost_start_fn);
+static DECLARE_DELAYED_WORK(qc71_boost_decay_work, qc71_boost_decay_fn);
+
+/* written from the input handler, so it is accessed locklessly */
+static unsigned long qc71_boost_last_input;
+static unsigned long qc71_boost_next_allowed;
+static bool qc71_boost_active;
+
+/* protects the following variables, and serializes the EC writes */
+static DEFINE_MUTEX(qc71_boost_lock);
+static int qc71_boost_saved_turbo, qc71_boost_saved_pl2;
+static int qc71_boost_pl2;
+static unsigned int qc71_boost_selection;
+
+static bool qc71_boost_handler_registered;
+
+/* ========================================================================== */
+
+static unsigned long qc71_boost_window(void)
+{
+	return msecs_to_jiffies(READ_ONCE(boost_window_ms));
+}
+
+/* the governor leaves PL2 to the boost while it is running */
+bool qc71_boost_running(void)
+{
+	return READ_ONCE(qc71_boost_active);
+}
+
+static void qc71_boost_start_fn(struct work_struct *work)
+{
+	int expected[QC71_POWER_LIMIT_COUNT] = { -1, -1, -1 };
+	int limits[QC71_POWER_LIMIT_COUNT] = { -1, -1, -1 };
+	struct qc71_ec_txn_op op;
+	int status, pl2, err;
+
+	mutex_lock(&qc71_boost_lock);
+
+	if (READ_ONCE(qc71_boost_active))
+		goto out;
+
+	/* before the turbo level is read, so any later selection is noticed */
+	qc71_boost_selection = qc71_perf_mode_selection();
+
+	status = ec_read_byte(CTRL_2_ADDR);
+	if (status < 0)
+		goto out;
+
+	pl2 = qc71_power_limit_get(QC71_POWER_LIMIT_PL2);
+
+	qc71_boost_saved_turbo = status & CTRL_2_TURBO_LEVEL_MASK;
+	qc71_boost_saved_pl2 = pl2;
+	qc71_boost_pl2 = -1;
+
+	op = QC71_EC_TXN_UPDATE_OP(CTRL_2_ADDR, CTRL_2_TURBO_LEVEL_MASK, CTRL_2_TURBO_LEVEL_3);
+
+	err = qc71_ec_txn_execute(&op, 1);
+	if (err) {
+		pr_warn_ratelimited("failed to set the turbo level for the boost: %d\n", err);
+		goto out;
+	}
+
+	/* before PL2 is raised, so that the governor stops changing it */
+	WRITE_ONCE(qc71_boost_active, true);
+
+	if (pl2 >= 0) {
+		unsigned int target = READ_ONCE(boost_pl2_w) ?: qc71_power_limit_max();
+
+		/* -EAGAIN: the governor changed it after it was read */
+		expected[QC71_POWER_LIMIT_PL2] = pl2;
+		limits[QC71_POWER_LIMIT_PL2] = min_t(unsigned int, target, INT_MAX);
+
+		if (target > pl2 && !qc71_power_limit_replace(expected, limits))
+			qc71_boost_pl2 = target;
+	}
+
+	qc71_perf_mode_notify();
+
+	queue_delayed_work(system_freezable_wq, &qc71_boost_decay_work, qc71_boost_window());
+
+out:
+	mutex_unlock(&qc71_boost_lock);
+}
+
+/* only restores what has not been changed by someone else since */
+static void qc71_boost_restore(void)
+{
+	int expected[QC71_POWER_LIMIT_COUNT] = { -1, -1, -1 };
+	int limits[QC71_POWER_LIMIT_COUNT] = { -1, -1, -1 };
+	struct qc71_ec_txn_op op;
+	int status;
+
+	if (qc71_boost_pl2 >= 0) {
+		expected[QC71_POWER_LIMIT_PL2] = qc71_boost_pl2;
+		limits[QC71_POWER_LIMIT_PL2] = qc71_boost_saved_pl2;
+
+		(void) qc71_power_limit_replace(expected, limits);
+	}
+
+	/* e.g. the user selected the performance mode during the boost */
+	if (qc71_perf_mode_selection() != qc71_boost_selection)
+		return;
+
+	status = ec_read_byte(CTRL_2_ADDR);
+	if (status >= 0 && (status & CTRL_2_TURBO_LEVEL_MASK) == CTRL_2_TURBO_LEVEL_3) {
+		op = QC71_EC_TXN_UPDATE_OP(CTRL_2_ADDR, CTRL_2_TURBO_LEVEL_MASK,
+					   qc71_boost_saved_turbo);
+		if (!qc71_ec_txn_execute(&op, 1))
+			qc71_perf_mode_notify();
+	}
+}
+
+static void qc71_boost_decay_fn(struct work_struct *work)
+{
+	unsigned long end;
+
+	mutex_lock(&qc71_boost_lock);
+
+	end = READ_ONCE(qc71_boost_last_input) + qc71_boost_window();
+
+	/* there was input since the boost started, extend it without touching the EC */
+	if (time_before(jiffies, end)) {
+		queue_delayed_work(system_freezable_wq, &qc71_boost_decay_work, end - jiffies);
+		goto out;
+	}
+
+	qc71_boost_restore();
+
+	WRITE_ONCE(qc71_boost_next_allowed,
+		   jiffies + msecs_to_jiffies(READ_ONCE(boost_interval_ms)));
+
+	/* after PL2 is restored, so that the governor finds its own limits */
+	WRITE_ONCE(qc71_boost_active, false);
+
+out:
+	mutex_unlock(&qc71_boost_lock);
+}
+
+/* input handler */
+
+/* runs in atomic context */
+static void qc71_boost_event(struct input_handle *handle, unsigned int type,
+			     unsigned int code, int value)
+{
+	if (type == EV_KEY && value != 1)
+		return;
+
+	if (type != EV_KEY && type != EV_REL && type != EV_ABS)
+		return;
+
+	WRITE_ONCE(qc71_boost_last_input, jiffies);
+
+	if (!READ_ONCE(qc71_boost_active) &&
+	    time_after_eq(jiffies, READ_ONCE(qc71_boost_next_allowed)))
+		queue_work(system_freezable_wq, &qc71_boost_start_work);
+}
+
+/* keyboards and pointing devices, e.g. not the power button or the accelerometer */
+static bool qc71_boost_match(struct input_handler *handler, struct input_dev *dev)
+{
+	if (test_bit(EV_KEY, dev->evbit) && test_bit(KEY_A, dev->keybit))
+		return true;
+
+	if (test_bit(EV_KEY, dev->evbit) && test_bit(EV_REL, dev->evbit))
+		return true;
+
+	return test_bit(INPUT_PROP_POINTER, dev->propbit);
+}
+
+static int qc71_boost_connect(struct input_handler *handler, struct input_dev *dev,
+			      const struct input_device_id *id)
+{
+	struct input_handle *handle;
+	int err;
+
+	handle = kzalloc(sizeof(*handle), GFP_KERNEL);
+	if (!handle)
+		return -ENOMEM;
+
+	handle->dev = dev;
+	handle->handler = handler;
+	handle->name = KBUILD_MODNAME "_boost";
+
+	err = input_register_handle(handle);
+	if (err)
+		goto out_free;
+
+	err = input_open_device(handle);
+	if (err)
+		goto out_unregister;
+
+	return 0;
+
+out_unregister:
+	input_unregister_handle(handle);
+out_free:
+	kfree(handle);
+	return err;
+}
+
+static void qc71_boost_disconnect(struct input_handle *handle)
+{
+	input_close_device(handle);
+	input_unregister_handle(handle);
+	kfree(handle);
+}
+
+/* narrowed down by qc71_boost_match() */
+static const struct input_device_id qc71_boost_ids[] = {
+	{
+		.flags = INPUT_DEVICE_ID_MATCH_EVBIT,
+		.evbit = { BIT_MASK(EV_KEY) },
+	},
+	{ }
+};
+
+static struct input_handler qc71_boost_handler = {
+	.event = qc71_boost_event,
+	.match = qc71_boost_match,
+	.connect = qc71_boost_connect,
+	.disconnect = qc71_boost_disconnect,
+	.name = KBUILD_MODNAME "_boost",
+	.id_table = qc71_boost_ids,
+};
+
+/* ========================================================================== */
+
+int __init qc71_boost_setup(void)
+{
+	int err;
+
+	if (!boost)
+		return 0;
+
+	/* the power_limit submodule failed to initialize */
+	if (!qc71_power_limit_max())
+		return -ENODEV;
+
+	qc71_boost_next_allowed = jiffies;
+
+	err = input_register_handler(&qc71_boost_handler);
+	if (err)
+		return err;
+
+	qc71_boost_handler_registered = true;
+
+	return 0;
+}
+
+void qc71_boost_cleanup(void)
+{
+	if (!qc71_boost_handler_registered)
+		return;
+
+	/* no new work is queued after this */
+	input_unregister_handler(&qc71_boost_handler);
+	qc71_boost_handler_registered = false;
+
+	cancel_work_sync(&qc71_boost_start_work);
+	cancel_delayed_work_sync(&qc71_boost_decay_work);
+
+	mutex_lock(&qc71_boost_lock);
+	if (qc71_boost_active) {
+		qc71_boost_restore();
+		qc71_boost_active = false;
+	}
+	mutex_unlock(&qc71_boost_lock);
+}
@@ -0,0 +1,15 @@
+// SPDX-License-Identifier: GPL-2.0
+#ifndef QC71_BOOST_H
+#define QC71_BOOST_H
+
+#include <linux/init.h>
+#include <linux/types.h>
+
+/* ========================================================================== */
+
+int  __init qc71_boost_setup(void);
+void        qc71_boost_cleanup(void);
+
+bool qc71_boost_running(void);
+
+#endif /* QC71_BOOST_H */
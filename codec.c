@@ -0,0 +1,351 @@
+// SPDX-License-Identifier: GPL-2.0
+#include "pr.h"
+
+#include <linux/version.h>
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 12, 0)
+static inline int fixp_linear_interpolate(int x0, int y0, int x1, int y1, int x)
+{
+	if (y0 == y1 || x == x0)
+		return y0;
+	if (x1 == x0 || x == x1)
+		return y1;
+
+	return y0 + ((y1 - y0) * (x - x0) / (x1 - x0));
+}
+#else
+#include <linux/bug.h> /* fixp-arith.h needs it, but doesn't include it */
+#include <linux/fixp-arith.h>
+#endif
+
+#include <linux/errno.h>
+#include <linux/kernel.h>
+#include <linux/types.h>
+
+#include "codec.h"
+#include "ec.h"
+
+/* ========================================================================== */
+/* transactions */
+
+/* the value 'ops[i].addr' has right before 'ops[i]' is applied */
+static uint8_t qc71_ec_txn_current(const struct qc71_ec_txn_op *ops, size_t i)
+{
+	size_t j = i;
+
+	while (j-- > 0) {
+		if (ops[j].addr == ops[i].addr && ops[j].written)
+			return ops[j].value;
+	}
+
+	return ops[i].old;
+}
+
+/* a plain write only needs the old value if it is to be rolled back */
+static bool qc71_ec_txn_needs_old(const struct qc71_ec_txn_op *op, unsigned int flags)
+{
+	return op->type != QC71_EC_TXN_WRITE || (flags & QC71_EC_TXN_ROLLBACK);
+}
+
+/* the bytes a single read returned */
+struct qc71_ec_txn_read {
+	uint16_t addr;
+	union qc71_ec_result result;
+};
+
+/* a read returns the byte at its address in 'b1', and the following one in 'b2' */
+static const uint8_t *qc71_ec_txn_find_byte(const struct qc71_ec_txn_read *reads, size_t n,
+					    uint16_t addr)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		if (reads[i].addr == addr)
+			return &reads[i].result.bytes.b1;
+
+		if (reads[i].addr + 1 == addr)
+			return &reads[i].result.bytes.b2;
+	}
+
+	return NULL;
+}
+
+/*
+ * fills in the old values the operations need; a read returns the byte at
+ * the given address and the following one, so the lowest address that is
+ * not known yet is read each time, and every address is read at most once
+ */
+static int qc71_ec_txn_read_old(struct qc71_ec_txn_op *ops, size_t n, unsigned int flags,
+				const struct qc71_ec_txn_io *io)
+{
+	struct qc71_ec_txn_read reads[QC71_EC_TXN_MAX_OPS];
+	const uint8_t *b;
+	size_t i, k = 0;
+	int err;
+
+	for (;;) {
+		const struct qc71_ec_txn_op *lowest = NULL;
+
+		for (i = 0; i < n; i++) {
+			if (!qc71_ec_txn_needs_old(&ops[i], flags) ||
+			    qc71_ec_txn_find_byte(reads, k, ops[i].addr))
+				continue;
+
+			if (!lowest || ops[i].addr < lowest->addr)
+				lowest = &ops[i];
+		}
+
+		/* every read covers at least one operation, so there are at most 'n' */
+		if (!lowest || k >= ARRAY_SIZE(reads))
+			break;
+
+		err = io->read(lowest->addr, &reads[k].result);
+		if (err)
+			return err;
+
+		reads[k++].addr = lowest->addr;
+	}
+
+	for (i = 0; i < n; i++) {
+		b = qc71_ec_txn_find_byte(reads, k, ops[i].addr);
+		ops[i].old = b ? *b : 0;
+	}
+
+	return 0;
+}
+
+/*
+ * applies the operations in order, if any of them fails, the registers
+ * written so far are restored to their old values; the old values of plain
+ * writes are only read (and restored) if QC71_EC_TXN_ROLLBACK is given
+ */
+int qc71_ec_txn_apply(struct qc71_ec_txn_op *ops, size_t n, unsigned int flags,
+		      const struct qc71_ec_txn_io *io)
+{
+	size_t i;
+	int err = 0;
+
+	if (n > QC71_EC_TXN_MAX_OPS)
+		return -EINVAL;
+
+	for (i = 0; i < n; i++)
+		ops[i].written = false;
+
+	/* the old values are needed for the rollback and by the 'restore' operation */
+	err = qc71_ec_txn_read_old(ops, n, flags, io);
+	if (err)
+		return err;
+
+	for (i = 0; i < n; i++) {
+		struct qc71_ec_txn_op *op = &ops[i];
+		uint8_t cur = qc71_ec_txn_current(ops, i);
+
+		switch (op->type) {
+		case QC71_EC_TXN_READ:
+			op->value = cur;
+			continue;
+		case QC71_EC_TXN_WRITE:
+			break;
+		case QC71_EC_TXN_UPDATE:
+			op->value = (cur & ~op->mask) | (op->value & op->mask);
+			if (op->value == cur)
+				continue;
+			break;
+		case QC71_EC_TXN_RESTORE:
+			op->value = op->old;
+			break;
+		default:
+			err = -EINVAL;
+			goto rollback;
+		}
+
+		/* the write might take effect even if it fails */
+		op->written = true;
+
+		err = io->write(op->addr, op->value);
+		if (err)
+			goto rollback;
+	}
+
+	return 0;
+
+rollback:
+	do {
+		int rerr;
+
+		if (!ops[i].written || !qc71_ec_txn_needs_old(&ops[i], flags))
+			continue;
+
+		rerr = io->write(ops[i].addr, ops[i].old);
+		if (rerr)
+			pr_warn("failed to restore %#06x to %#04x: %d\n",
+				(unsigned int) ops[i].addr, (unsigned int) ops[i].old, rerr);
+	} while (i-- > 0);
+
+	return err;
+}
+
+/* ========================================================================== */
+/* fans */
+
+/* the EC takes values in [0, FAN_MAX_PWM], the hwmon interface uses [0, 255] */
+uint8_t qc71_fan_pwm_to_ec(uint8_t pwm)
+{
+	return fixp_linear_interpolate(0, 0, U8_MAX, FAN_MAX_PWM, pwm);
+}
+
+uint8_t qc71_fan_pwm_from_ec(uint8_t value)
+{
+	return fixp_linear_interpolate(0, 0, FAN_MAX_PWM, U8_MAX, min_t(uint8_t, value, FAN_MAX_PWM));
+}
+
+static int qc71_fan_io_read_byte(const struct qc71_ec_txn_io *io, uint16_t addr)
+{
+	union qc71_ec_result result;
+	int err = io->read(addr, &result);
+
+	if (err)
+		return err;
+
+	return result.bytes.b1;
+}
+
+/* returns the 'enum qc71_fan_mode' of the first fan */
+int qc71_fan_mode_read(const struct qc71_ec_txn_io *io)
+{
+	int err;
+
+	err = qc71_fan_io_read_byte(io, CTRL_1_ADDR);
+	if (err < 0)
+		return err;
+
+	if (!(err & CTRL_1_MANUAL_MODE))
+		return QC71_FAN_MODE_AUTO;
+
+	err = qc71_fan_io_read_byte(io, FAN_CTRL_ADDR);
+	if (err < 0)
+		return err;
+
+	if (err & FAN_CTRL_FAN_BOOST) {
+		err = qc71_fan_io_read_byte(io, FAN_PWM_1_ADDR);
+		if (err < 0)
+			return err;
+
+		return err >= FAN_MAX_PWM ? QC71_FAN_MODE_DISENGAGED : QC71_FAN_MODE_MANUAL;
+	}
+
+	if (err & FAN_CTRL_AUTO)
+		return QC71_FAN_MODE_AUTO;
+
+	return QC71_FAN_MODE_MANUAL;
+}
+
+/* fills 'ops' with the transaction switching to 'mode', returns the number of operations */
+int qc71_fan_mode_ops(unsigned int mode, struct qc71_ec_txn_op *ops)
+{
+	/* the fan control register is restored if the pwm cannot be set (QC71_EC_TXN_ROLLBACK) */
+	switch (mode) {
+	case QC71_FAN_MODE_DISENGAGED:
+		ops[0] = QC71_EC_TXN_WRITE_OP(FAN_CTRL_ADDR, FAN_CTRL_FAN_BOOST);
+		ops[1] = QC71_EC_TXN_WRITE_OP(FAN_PWM_1_ADDR, FAN_MAX_PWM);
+		return 2;
+	case QC71_FAN_MODE_MANUAL:
+		/* keep the current pwm, which changes when the fan boost is enabled */
+		ops[0] = QC71_EC_TXN_WRITE_OP(FAN_CTRL_ADDR, FAN_CTRL_FAN_BOOST);
+		ops[1] = QC71_EC_TXN_RESTORE_OP(FAN_PWM_1_ADDR);
+		return 2;
+	case QC71_FAN_MODE_AUTO:
+		ops[0] = QC71_EC_TXN_WRITE_OP(FAN_CTRL_ADDR, 0x80 | FAN_CTRL_AUTO);
+		return 1;
+	}
+
+	return -EINVAL;
+}
+
+/* ========================================================================== */
+/* lightbar */
+
+/* 'color' is given in the format of the 'color' attribute: a decimal digit per channel */
+int qc71_lightbar_color_to_rgb(unsigned int color, uint8_t rgb[LIGHTBAR_COLOR_COUNT])
+{
+	int i;
+
+	if (color > 999) /* color must lie in [0, 999] */
+		return -EINVAL;
+
+	for (i = LIGHTBAR_COLOR_COUNT - 1; i >= 0; i--, color /= 10)
+		rgb[i] = (color % 10) * LIGHTBAR_COLOR_LEVEL_STEP;
+
+	return 0;
+}
+
+/* channels between levels are rounded down */
+unsigned int qc71_lightbar_rgb_to_color(const uint8_t rgb[LIGHTBAR_COLOR_COUNT])
+{
+	unsigned int color = 0;
+	size_t i;
+
+	for (i = 0; i < LIGHTBAR_COLOR_COUNT; i++)
+		color = 10 * color + min(rgb[i] / LIGHTBAR_COLOR_LEVEL_STEP, 9);
+
+	return color;
+}
+
+/* ========================================================================== */
+/* battery */
+
+/* the EC stores 100% as 0 */
+int qc71_charge_limit_to_ec(int percent)
+{
+	if (!(1 <= percent && percent <= 100))
+		return -EINVAL;
+
+	return percent == 100 ? 0 : percent;
+}
+
+int qc71_charge_limit_from_ec(uint8_t value)
+{
+	value &= BATT_CHARGE_CTRL_VALUE_MASK;
+
+	return value == 0 ? 100 : value;
+}
+
+/* ========================================================================== */
+/* single bit settings of the platform device */
+
+static const struct {
+	uint16_t addr;
+	uint8_t mask;
+} qc71_ec_flags[QC71_FLAG_COUNT] = {
+	[QC71_FLAG_FAN_ALWAYS_ON]          = { BIOS_CTRL_3_ADDR,  BIOS_CTRL_3_FAN_ALWAYS_ON },
+	[QC71_FLAG_FAN_REDUCED_DUTY_CYCLE] = { BIOS_CTRL_3_ADDR,  BIOS_CTRL_3_FAN_REDUCED_DUTY_CYCLE },
+	[QC71_FLAG_FN_LOCK_SWITCH]         = { AP_BIOS_BYTE_ADDR, AP_BIOS_BYTE_FN_LOCK_SWITCH },
+	[QC71_FLAG_MANUAL_CONTROL]         = { CTRL_1_ADDR,       CTRL_1_MANUAL_MODE },
+};
+
+uint16_t qc71_ec_flag_addr(enum qc71_ec_flag flag)
+{
+	return qc71_ec_flags[flag].addr;
+}
+
+bool qc71_ec_flag_get(enum qc71_ec_flag flag, uint8_t value)
+{
+	return value & qc71_ec_flags[flag].mask;
+}
+
+struct qc71_ec_txn_op qc71_ec_flag_op(enum qc71_ec_flag flag, bool on)
+{
+	return QC71_EC_TXN_UPDATE_OP(qc71_ec_flags[flag].addr, qc71_ec_flags[flag].mask,
+				     on ? qc71_ec_flags[flag].mask : 0);
+}
+
+/* the super key lock can only be toggled, 'status' is the value of STATUS_1 */
+size_t qc71_super_key_lock_ops(uint8_t status, bool on, struct qc71_ec_txn_op *ops)
+{
+	if (on == !!(status & STATUS_1_SUPER_KEY_LOCK))
+		return 0;
+
+	ops[0] = QC71_EC_TXN_WRITE_OP(TRIGGER_1_ADDR, TRIGGER_1_SUPER_KEY_LOCK);
+
+	return 1;
+}
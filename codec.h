@@ -0,0 +1,88 @@
+// SPDX-License-Identifier: GPL-2.0
+#ifndef QC71_CODEC_H
+#define QC71_CODEC_H
+
+#include <linux/types.h>
+
+#include "ec.h"
+
+/*
+ * the encoding of the register values, and the state machines built on them;
+ * nothing here touches WMI/ACPI, so it is linked into the KUnit suite (tests/)
+ * and run against the emulated EC
+ */
+
+/* ========================================================================== */
+/* transactions */
+
+/* how qc71_ec_txn_apply() accesses the registers */
+struct qc71_ec_txn_io {
+	int (*read)(uint16_t addr, union qc71_ec_result *result);
+	int (*write)(uint16_t addr, uint8_t value);
+};
+
+int qc71_ec_txn_apply(struct qc71_ec_txn_op *ops, size_t n, unsigned int flags,
+		      const struct qc71_ec_txn_io *io);
+
+/* ========================================================================== */
+/* fans */
+
+#define FAN_MAX_PWM 200
+
+enum qc71_fan_mode {
+	QC71_FAN_MODE_DISENGAGED = 0, /* full speed */
+	QC71_FAN_MODE_MANUAL     = 1,
+	QC71_FAN_MODE_AUTO       = 2,
+	QC71_FAN_MODE_COUNT
+};
+
+#define QC71_FAN_MODE_MAX_OPS 2
+
+uint8_t qc71_fan_pwm_to_ec(uint8_t pwm);
+uint8_t qc71_fan_pwm_from_ec(uint8_t value);
+
+int qc71_fan_mode_read(const struct qc71_ec_txn_io *io);
+int qc71_fan_mode_ops(unsigned int mode, struct qc71_ec_txn_op *ops);
+
+/* ========================================================================== */
+/* lightbar */
+
+enum qc71_lightbar_color {
+	LIGHTBAR_RED         = 0,
+	LIGHTBAR_GREEN       = 1,
+	LIGHTBAR_BLUE        = 2,
+	LIGHTBAR_COLOR_COUNT
+};
+
+#define LIGHTBAR_MAX_LEVEL 36
+
+/* the 'color' attribute has 10 levels per channel, f(x) = 4x */
+#define LIGHTBAR_COLOR_LEVEL_STEP 4
+
+int qc71_lightbar_color_to_rgb(unsigned int color, uint8_t rgb[LIGHTBAR_COLOR_COUNT]);
+unsigned int qc71_lightbar_rgb_to_color(const uint8_t rgb[LIGHTBAR_COLOR_COUNT]);
+
+/* ========================================================================== */
+/* battery */
+
+int qc71_charge_limit_to_ec(int percent);
+int qc71_charge_limit_from_ec(uint8_t value);
+
+/* ========================================================================== */
+/* single bit settings of the platform device */
+
+enum qc71_ec_flag {
+	QC71_FLAG_FAN_ALWAYS_ON,
+	QC71_FLAG_FAN_REDUCED_DUTY_CYCLE,
+	QC71_FLAG_FN_LOCK_SWITCH,
+	QC71_FLAG_MANUAL_CONTROL,
+	QC71_FLAG_COUNT
+};
+
+uint16_t qc71_ec_flag_addr(enum qc71_ec_flag flag);
+bool qc71_ec_flag_get(enum qc71_ec_flag flag, uint8_t value);
+struct qc71_ec_txn_op qc71_ec_flag_op(enum qc71_ec_flag flag, bool on);
+
+size_t qc71_super_key_lock_ops(uint8_t status, bool on, struct qc71_ec_txn_op *ops);
+
+#endif /* QC71_CODEC_H */
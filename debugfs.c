@@ -1,20 +1,48 @@
 // SPDX-License-Identifier: GPL-2.0
 #include "pr.h"
 
+#include <linux/bitmap.h>
 #include <linux/debugfs.h>
 #include <linux/init.h>
+#include <linux/ktime.h>
+#include <linux/list.h>
+#include <linux/lockdep.h>
+#include <linux/mm.h>
 #include <linux/moduleparam.h>
+#include <linux/mutex.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/string.h>
 #include <linux/uaccess.h>
 #include <linux/sched/signal.h>
 #include <linux/types.h>
 
+#include "bench.h"
 #include "debugfs.h"
 #include "ec.h"
+#include "events.h"
+#include "record.h"
 
 #if IS_ENABLED(CONFIG_DEBUG_FS)
 
 #define DEBUGFS_DIR_NAME KBUILD_MODNAME
 
+#define EC_PAGE_SIZE  256
+#define EC_PAGE_COUNT 256
+
+#define SNAPSHOT_NAME_LEN  16
+#define SNAPSHOT_MAX_COUNT 16
+
+/* ========================================================================== */
+
+struct qc71_ec_snapshot {
+	struct list_head node;
+	char name[SNAPSHOT_NAME_LEN];
+	ktime_t time;
+	DECLARE_BITMAP(pages, EC_PAGE_COUNT);
+	uint8_t *data; /* EC_PAGE_SIZE bytes for every page in 'pages', in ascending order */
+};
+
 static const struct qc71_debugfs_attr {
 	const char *name;
 	uint16_t addr;
@@ -99,14 +127,23 @@ module_param(debugregs, bool, 0444);
 MODULE_PARM_DESC(debugregs, "expose various EC registers in debugfs (default=false)");
 
 static struct dentry *qc71_debugfs_dir,
-		     *qc71_debugfs_regs_dir;
+		     *qc71_debugfs_regs_dir,
+		     *qc71_debugfs_snapshot_dir;
+
+/* ========================================================================== */
+
+static DEFINE_MUTEX(snapshot_lock);
+static LIST_HEAD(snapshot_list);
+static unsigned int snapshot_count;
+static DECLARE_BITMAP(snapshot_pages, EC_PAGE_COUNT);
+static char snapshot_diff_names[2][SNAPSHOT_NAME_LEN];
 
 /* ========================================================================== */
 
 static int get_debugfs_byte(void *data, u64 *value)
 {
 	const struct qc71_debugfs_attr *attr = data;
-	int status = ec_read_byte(attr->addr);
+	int status = ec_read_byte_prio(attr->addr, QC71_EC_PRIO_BULK);
 
 	if (status < 0)
 		return status;
@@ -141,7 +178,7 @@ static ssize_t qc71_debugfs_ec_read(struct file *f, char __user *buf, size_t cou
 	size_t i;
 
 	for (i = 0; *offset + i < U16_MAX && i < count; i++) {
-		int err = ec_read_byte(*offset + i);
+		int err = ec_read_byte_prio(*offset + i, QC71_EC_PRIO_BULK);
 		u8 byte;
 
 		if (signal_pending(current))
@@ -201,6 +238,409 @@ static const struct file_operations qc71_debugfs_ec_fops = {
 	.llseek = default_llseek,
 };
 
+/* ========================================================================== */
+/* EC snapshots */
+
+/* 'snapshot_lock' must be held */
+static struct qc71_ec_snapshot *snapshot_find(const char *name)
+{
+	struct qc71_ec_snapshot *snap;
+
+	lockdep_assert_held(&snapshot_lock);
+
+	list_for_each_entry (snap, &snapshot_list, node) {
+		if (strcmp(snap->name, name) == 0)
+			return snap;
+	}
+
+	return NULL;
+}
+
+static void snapshot_free(struct qc71_ec_snapshot *snap)
+{
+	kvfree(snap->data);
+	kfree(snap);
+}
+
+/* returns the data of 'page' in 'snap', or NULL if 'snap' does not contain it */
+static const uint8_t *snapshot_page_data(const struct qc71_ec_snapshot *snap, unsigned int page)
+{
+	if (!test_bit(page, snap->pages))
+		return NULL;
+
+	return snap->data + bitmap_weight(snap->pages, page) * EC_PAGE_SIZE;
+}
+
+static int snapshot_capture(const char *name)
+{
+	struct qc71_ec_snapshot *snap, *old;
+	unsigned int page, i = 0;
+	int err;
+
+	if (!*name || strlen(name) >= SNAPSHOT_NAME_LEN)
+		return -EINVAL;
+
+	snap = kzalloc(sizeof(*snap), GFP_KERNEL);
+	if (!snap)
+		return -ENOMEM;
+
+	strscpy(snap->name, name, sizeof(snap->name));
+
+	err = mutex_lock_interruptible(&snapshot_lock);
+	if (err)
+		goto out_free;
+
+	bitmap_copy(snap->pages, snapshot_pages, EC_PAGE_COUNT);
+
+	if (bitmap_empty(snap->pages, EC_PAGE_COUNT)) {
+		err = -ENODATA;
+		goto out_unlock;
+	}
+
+	old = snapshot_find(name);
+
+	if (!old && snapshot_count >= SNAPSHOT_MAX_COUNT) {
+		err = -ENOSPC;
+		goto out_unlock;
+	}
+
+	snap->data = kvmalloc_array(bitmap_weight(snap->pages, EC_PAGE_COUNT),
+				    EC_PAGE_SIZE, GFP_KERNEL);
+	if (!snap->data) {
+		err = -ENOMEM;
+		goto out_unlock;
+	}
+
+	snap->time = ktime_get_real();
+
+	for_each_set_bit(page, snap->pages, EC_PAGE_COUNT) {
+		err = qc71_ec_read_block(ADDR(page, 0), snap->data + i * EC_PAGE_SIZE, EC_PAGE_SIZE);
+		if (err)
+			goto out_unlock;
+
+		i += 1;
+	}
+
+	if (old) {
+		list_replace(&old->node, &snap->node);
+		snapshot_free(old);
+	} else {
+		list_add_tail(&snap->node, &snapshot_list);
+		snapshot_count += 1;
+	}
+
+	snap = NULL;
+
+out_unlock:
+	mutex_unlock(&snapshot_lock);
+out_free:
+	if (snap)
+		snapshot_free(snap);
+
+	return err;
+}
+
+static int snapshot_drop(const char *name)
+{
+	struct qc71_ec_snapshot *snap;
+	int err;
+
+	err = mutex_lock_interruptible(&snapshot_lock);
+	if (err)
+		return err;
+
+	snap = snapshot_find(name);
+
+	if (snap) {
+		list_del(&snap->node);
+		snapshot_free(snap);
+		snapshot_count -= 1;
+	} else {
+		err = -ENOENT;
+	}
+
+	mutex_unlock(&snapshot_lock);
+
+	return err;
+}
+
+static void snapshot_drop_all(void)
+{
+	struct qc71_ec_snapshot *snap, *tmp;
+
+	mutex_lock(&snapshot_lock);
+
+	list_for_each_entry_safe (snap, tmp, &snapshot_list, node) {
+		list_del(&snap->node);
+		snapshot_free(snap);
+	}
+
+	snapshot_count = 0;
+
+	mutex_unlock(&snapshot_lock);
+}
+
+/* copies the string from userspace, and strips the surrounding whitespace */
+static char *snapshot_get_user_string(const char __user *buf, size_t count)
+{
+	char *str, *p;
+
+	if (count >= PAGE_SIZE)
+		return ERR_PTR(-E2BIG);
+
+	str = memdup_user_nul(buf, count);
+	if (IS_ERR(str))
+		return str;
+
+	/* strim() strips the trailing whitespace in-place */
+	p = strim(str);
+	memmove(str, p, strlen(p) + 1);
+
+	return str;
+}
+
+static ssize_t snapshot_capture_write(struct file *f, const char __user *buf, size_t count, loff_t *offset)
+{
+	char *name = snapshot_get_user_string(buf, count);
+	int err;
+
+	if (IS_ERR(name))
+		return PTR_ERR(name);
+
+	err = snapshot_capture(name);
+	kfree(name);
+
+	return err ? err : count;
+}
+
+static const struct file_operations snapshot_capture_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.write = snapshot_capture_write,
+};
+
+static ssize_t snapshot_drop_write(struct file *f, const char __user *buf, size_t count, loff_t *offset)
+{
+	char *name = snapshot_get_user_string(buf, count);
+	int err;
+
+	if (IS_ERR(name))
+		return PTR_ERR(name);
+
+	err = snapshot_drop(name);
+	kfree(name);
+
+	return err ? err : count;
+}
+
+static const struct file_operations snapshot_drop_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.write = snapshot_drop_write,
+};
+
+static int snapshot_list_show(struct seq_file *m, void *v)
+{
+	const struct qc71_ec_snapshot *snap;
+	int err;
+
+	err = mutex_lock_interruptible(&snapshot_lock);
+	if (err)
+		return err;
+
+	list_for_each_entry (snap, &snapshot_list, node) {
+		unsigned int page;
+
+		seq_printf(m, "%s %lld", snap->name, ktime_to_ns(snap->time));
+
+		for_each_set_bit(page, snap->pages, EC_PAGE_COUNT)
+			seq_printf(m, " %#04x", page);
+
+		seq_putc(m, '\n');
+	}
+
+	mutex_unlock(&snapshot_lock);
+
+	return 0;
+}
+
+DEFINE_SHOW_ATTRIBUTE(snapshot_list);
+
+static int snapshot_pages_show(struct seq_file *m, void *v)
+{
+	unsigned int page;
+	int err;
+
+	err = mutex_lock_interruptible(&snapshot_lock);
+	if (err)
+		return err;
+
+	for_each_set_bit(page, snapshot_pages, EC_PAGE_COUNT)
+		seq_printf(m, "%#04x ", page);
+
+	seq_putc(m, '\n');
+
+	mutex_unlock(&snapshot_lock);
+
+	return 0;
+}
+
+static int snapshot_pages_open(struct inode *inode, struct file *f)
+{
+	return single_open(f, snapshot_pages_show, inode->i_private);
+}
+
+/* accepts a whitespace separated list of page numbers, e.g. "0x04 0x07 0x18" */
+static ssize_t snapshot_pages_write(struct file *f, const char __user *buf, size_t count, loff_t *offset)
+{
+	DECLARE_BITMAP(pages, EC_PAGE_COUNT);
+	char *str, *p, *tok;
+	int err = 0;
+
+	str = snapshot_get_user_string(buf, count);
+	if (IS_ERR(str))
+		return PTR_ERR(str);
+
+	bitmap_zero(pages, EC_PAGE_COUNT);
+
+	p = str;
+	while ((tok = strsep(&p, " \t\n,")) != NULL) {
+		u8 page;
+
+		if (!*tok)
+			continue;
+
+		err = kstrtou8(tok, 0, &page);
+		if (err)
+			goto out;
+
+		set_bit(page, pages);
+	}
+
+	err = mutex_lock_interruptible(&snapshot_lock);
+	if (err)
+		goto out;
+
+	bitmap_copy(snapshot_pages, pages, EC_PAGE_COUNT);
+
+	mutex_unlock(&snapshot_lock);
+
+out:
+	kfree(str);
+
+	return err ? err : count;
+}
+
+static const struct file_operations snapshot_pages_fops = {
+	.owner = THIS_MODULE,
+	.open = snapshot_pages_open,
+	.read = seq_read,
+	.write = snapshot_pages_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+/* lists the addresses whose values differ, only pages present in both snapshots are compared */
+static int snapshot_diff_show(struct seq_file *m, void *v)
+{
+	const struct qc71_ec_snapshot *a, *b;
+	unsigned int page, i;
+	int err;
+
+	err = mutex_lock_interruptible(&snapshot_lock);
+	if (err)
+		return err;
+
+	a = snapshot_find(snapshot_diff_names[0]);
+	b = snapshot_find(snapshot_diff_names[1]);
+
+	if (!a || !b) {
+		err = -ENOENT;
+		goto out;
+	}
+
+	for_each_set_bit(page, a->pages, EC_PAGE_COUNT) {
+		const uint8_t *da = snapshot_page_data(a, page),
+			      *db = snapshot_page_data(b, page);
+
+		if (!db)
+			continue;
+
+		for (i = 0; i < EC_PAGE_SIZE; i++) {
+			if (da[i] != db[i])
+				seq_printf(m, "%#06x: %#04x -> %#04x\n",
+					   (unsigned int) ADDR(page, i),
+					   (unsigned int) da[i], (unsigned int) db[i]);
+		}
+	}
+
+out:
+	mutex_unlock(&snapshot_lock);
+
+	return err;
+}
+
+static int snapshot_diff_open(struct inode *inode, struct file *f)
+{
+	return single_open(f, snapshot_diff_show, inode->i_private);
+}
+
+/* selects the two snapshots to compare: "<old> <new>" */
+static ssize_t snapshot_diff_write(struct file *f, const char __user *buf, size_t count, loff_t *offset)
+{
+	char *str, *p, *old, *new;
+	int err;
+
+	str = snapshot_get_user_string(buf, count);
+	if (IS_ERR(str))
+		return PTR_ERR(str);
+
+	p = str;
+	old = strsep(&p, " \t");
+	new = p ? skip_spaces(p) : NULL;
+
+	if (!old || !*old || !new || !*new ||
+	    strlen(old) >= SNAPSHOT_NAME_LEN || strlen(new) >= SNAPSHOT_NAME_LEN) {
+		err = -EINVAL;
+		goto out;
+	}
+
+	err = mutex_lock_interruptible(&snapshot_lock);
+	if (err)
+		goto out;
+
+	strscpy(snapshot_diff_names[0], old, SNAPSHOT_NAME_LEN);
+	strscpy(snapshot_diff_names[1], new, SNAPSHOT_NAME_LEN);
+
+	mutex_unlock(&snapshot_lock);
+
+out:
+	kfree(str);
+
+	return err ? err : count;
+}
+
+static const struct file_operations snapshot_diff_fops = {
+	.owner = THIS_MODULE,
+	.open = snapshot_diff_open,
+	.read = seq_read,
+	.write = snapshot_diff_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static const struct {
+	const char *name;
+	umode_t mode;
+	const struct file_operations *fops;
+} qc71_debugfs_snapshot_files[] = {
+	{"capture", 0200, &snapshot_capture_fops},
+	{"diff",    0600, &snapshot_diff_fops},
+	{"drop",    0200, &snapshot_drop_fops},
+	{"list",    0400, &snapshot_list_fops},
+	{"pages",   0600, &snapshot_pages_fops},
+};
+
 /* ========================================================================== */
 
 int __init qc71_debugfs_setup(void)
@@ -247,6 +687,47 @@ int __init qc71_debugfs_setup(void)
 		goto out;
 	}
 
+	qc71_debugfs_snapshot_dir = debugfs_create_dir("snapshot", qc71_debugfs_dir);
+
+	if (IS_ERR(qc71_debugfs_snapshot_dir)) {
+		err = PTR_ERR(qc71_debugfs_snapshot_dir);
+		debugfs_remove_recursive(qc71_debugfs_dir);
+		goto out;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(qc71_debugfs_snapshot_files); i++) {
+		d = debugfs_create_file(qc71_debugfs_snapshot_files[i].name,
+					qc71_debugfs_snapshot_files[i].mode,
+					qc71_debugfs_snapshot_dir, NULL,
+					qc71_debugfs_snapshot_files[i].fops);
+
+		if (IS_ERR(d)) {
+			err = PTR_ERR(d);
+			debugfs_remove_recursive(qc71_debugfs_dir);
+			goto out;
+		}
+	}
+
+	err = qc71_record_setup(qc71_debugfs_dir);
+	if (err) {
+		debugfs_remove_recursive(qc71_debugfs_dir);
+		goto out;
+	}
+
+	err = qc71_bench_setup(qc71_debugfs_dir);
+	if (err) {
+		debugfs_remove_recursive(qc71_debugfs_dir);
+		goto out;
+	}
+
+	qc71_ec_sched_debugfs_setup(qc71_debugfs_dir);
+	qc71_ec_cache_debugfs_setup(qc71_debugfs_dir);
+	qc71_wmi_events_debugfs_setup(qc71_debugfs_dir);
+
+	set_bit(0x04, snapshot_pages);
+	set_bit(0x07, snapshot_pages);
+	set_bit(0x18, snapshot_pages);
+
 out:
 	return err;
 }
@@ -255,6 +736,8 @@ void qc71_debugfs_cleanup(void)
 {
 	/* checks if IS_ERR_OR_NULL() */
 	debugfs_remove_recursive(qc71_debugfs_dir);
+	qc71_record_cleanup();
+	snapshot_drop_all();
 }
 
 #endif
@@ -2,19 +2,60 @@
 #include "pr.h"
 
 #include <linux/acpi.h>
+#include <linux/completion.h>
 #include <linux/compiler_types.h>
 #include <linux/error-injection.h>
+#include <linux/ktime.h>
+#include <linux/list.h>
+#include <linux/lockdep.h>
+#include <linux/moduleparam.h>
+#include <linux/refcount.h>
 #include <linux/rwsem.h>
 #include <linux/printk.h>
+#include <linux/sched/signal.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/string.h>
 #include <linux/wmi.h>
 
+#include "codec.h"
 #include "ec.h"
+#include "ec_emu.h"
+#include "record.h"
 #include "wmi.h"
 
 /* ========================================================================== */
 
+/* number of read transactions done by qc71_ec_read_block() without dropping 'ec_lock' */
+#define EC_READ_BLOCK_CHUNK 16
+
+/* ========================================================================== */
+
+/* a read in progress, concurrent readers of the same address wait for it instead of issuing their own */
+struct qc71_ec_inflight_read {
+	struct list_head node;
+	uint16_t addr;
+	refcount_t refs;
+	struct completion done;
+	union qc71_ec_result result;
+	int err;
+};
+
+/* ========================================================================== */
+
 static DECLARE_RWSEM(ec_lock);
 
+static DEFINE_SPINLOCK(ec_inflight_lock);
+static LIST_HEAD(ec_inflight_reads);
+
+static const struct qc71_ec_backend *qc71_ec_backend = &qc71_ec_wmi_backend;
+
+static char *ec_backend = "wmi";
+module_param(ec_backend, charp, 0444);
+MODULE_PARM_DESC(ec_backend, "EC access method: 'wmi' or 'emu' (in-memory emulation, no hardware needed) (default=wmi)");
+
+static bool ec_emu_initialized;
+
 /* ========================================================================== */
 
 int __must_check qc71_ec_lock(void)
@@ -27,8 +68,8 @@ void qc71_ec_unlock(void)
 	up_write(&ec_lock);
 }
 
-int __must_check qc71_ec_transaction(uint16_t addr, uint16_t data,
-				     union qc71_ec_result *result, bool read)
+static int qc71_ec_wmi_transaction(uint16_t addr, uint16_t data,
+				   union qc71_ec_result *result, bool read)
 {
 	uint8_t buf[] = {
 		addr & 0xFF,
@@ -48,30 +89,21 @@ int __must_check qc71_ec_transaction(uint16_t addr, uint16_t data,
 	struct acpi_buffer input = { sizeof(buf), buf },
 			   output = { sizeof(output_buf), output_buf };
 	union acpi_object *obj;
-	acpi_status status = AE_OK;
-	int err;
-
-	if (read) err = down_read_killable(&ec_lock);
-	else      err = down_write_killable(&ec_lock);
-
-	if (err)
-		goto out;
+	acpi_status status;
+	int err = 0;
 
 	memset(output_buf, 0, sizeof(output_buf));
 
 	status = wmi_evaluate_method(QC71_WMI_WMBC_GUID, 0,
 				     QC71_WMBC_GETSETULONG_ID, &input, &output);
 
-	if (read) up_read(&ec_lock);
-	else      up_write(&ec_lock);
+	obj = output.pointer;
 
 	if (ACPI_FAILURE(status)) {
 		err = -EIO;
 		goto out;
 	}
 
-	obj = output.pointer;
-
 	if (result) {
 		if (obj && obj->type == ACPI_TYPE_BUFFER && obj->buffer.length >= sizeof(*result)) {
 			memcpy(result, obj->buffer.pointer, sizeof(*result));
@@ -98,4 +130,421 @@ out:
 
 	return err;
 }
-ALLOW_ERROR_INJECTION(qc71_ec_transaction, ERRNO);
+
+const struct qc71_ec_backend qc71_ec_wmi_backend = {
+	.name        = "wmi",
+	.transaction = qc71_ec_wmi_transaction,
+};
+
+/* ========================================================================== */
+
+bool qc71_ec_backend_is_wmi(void)
+{
+	return READ_ONCE(qc71_ec_backend) == &qc71_ec_wmi_backend;
+}
+
+/* returns the previous backend */
+const struct qc71_ec_backend *qc71_ec_set_backend(const struct qc71_ec_backend *backend)
+{
+	const struct qc71_ec_backend *old;
+
+	/* wait for the transactions using the old backend to finish */
+	down_write(&ec_lock);
+
+	old = qc71_ec_backend;
+	qc71_ec_backend = backend;
+
+	qc71_ec_cache_invalidate_all();
+
+	up_write(&ec_lock);
+
+	pr_info("using the '%s' EC backend\n", backend->name);
+
+	return old;
+}
+
+/* 'ec_lock' must be held */
+static int __must_check __qc71_ec_transaction(uint16_t addr, uint16_t data,
+					      union qc71_ec_result *result, bool read)
+{
+	ktime_t start = ktime_get();
+	int err;
+
+	err = qc71_ec_backend->transaction(addr, data, result, read);
+
+	qc71_record_ec_transaction(addr, data, result, read, err, start);
+
+	return err;
+}
+
+/* 'ec_inflight_lock' must be held */
+static struct qc71_ec_inflight_read *qc71_ec_inflight_find(uint16_t addr)
+{
+	struct qc71_ec_inflight_read *req;
+
+	lockdep_assert_held(&ec_inflight_lock);
+
+	list_for_each_entry (req, &ec_inflight_reads, node) {
+		if (req->addr == addr)
+			return req;
+	}
+
+	return NULL;
+}
+
+static void qc71_ec_inflight_put(struct qc71_ec_inflight_read *req)
+{
+	if (refcount_dec_and_test(&req->refs))
+		kfree(req);
+}
+
+/*
+ * a write is about to change 'addr', readers arriving from now on must not
+ * share the result of a read that started earlier (which covers 'addr' if
+ * it was issued for any of 'addr' and the 3 preceding addresses, the same
+ * window the register cache invalidates)
+ */
+static void qc71_ec_inflight_invalidate(uint16_t addr)
+{
+	struct qc71_ec_inflight_read *req, *tmp;
+
+	spin_lock(&ec_inflight_lock);
+
+	list_for_each_entry_safe (req, tmp, &ec_inflight_reads, node) {
+		if (req->addr <= addr && addr - req->addr < sizeof(union qc71_ec_result))
+			list_del_init(&req->node);
+	}
+
+	spin_unlock(&ec_inflight_lock);
+}
+
+/* 'ec_lock' must be held for writing */
+static int qc71_ec_raw_write(uint16_t addr, uint16_t data)
+{
+	lockdep_assert_held_write(&ec_lock);
+
+	qc71_ec_inflight_invalidate(addr);
+	qc71_ec_cache_invalidate(addr);
+
+	return __qc71_ec_transaction(addr, data, NULL, false);
+}
+
+static int qc71_ec_locked_transaction(uint16_t addr, uint16_t data,
+				      union qc71_ec_result *result, bool read)
+{
+	int err;
+
+	if (read) err = down_read_killable(&ec_lock);
+	else      err = down_write_killable(&ec_lock);
+
+	if (err)
+		return err;
+
+	if (read) err = __qc71_ec_transaction(addr, data, result, read);
+	else      err = qc71_ec_raw_write(addr, data);
+
+	if (read) up_read(&ec_lock);
+	else      up_write(&ec_lock);
+
+	return err;
+}
+
+/* waits for the read in progress, returns -EAGAIN if it has to be retried */
+static int qc71_ec_read_join(struct qc71_ec_inflight_read *req, union qc71_ec_result *result)
+{
+	int err = wait_for_completion_killable(&req->done);
+
+	if (!err) {
+		err = req->err;
+
+		/* the issuer has been killed, which does not concern us */
+		if (err == -EINTR && !fatal_signal_pending(current))
+			err = -EAGAIN;
+		else if (!err)
+			*result = req->result;
+	}
+
+	qc71_ec_inflight_put(req);
+
+	return err;
+}
+
+static int qc71_ec_read_shared(uint16_t addr, union qc71_ec_result *result)
+{
+	struct qc71_ec_inflight_read *req, *new = NULL;
+	int err;
+
+again:
+	spin_lock(&ec_inflight_lock);
+
+	req = qc71_ec_inflight_find(addr);
+	if (req) {
+		refcount_inc(&req->refs);
+		spin_unlock(&ec_inflight_lock);
+
+		kfree(new);
+		new = NULL;
+
+		err = qc71_ec_read_join(req, result);
+		if (err == -EAGAIN)
+			goto again;
+
+		return err;
+	}
+
+	if (!new) {
+		spin_unlock(&ec_inflight_lock);
+
+		new = kmalloc(sizeof(*new), GFP_KERNEL);
+		if (!new)
+			return qc71_ec_locked_transaction(addr, 0, result, true);
+
+		new->addr = addr;
+		refcount_set(&new->refs, 1);
+		init_completion(&new->done);
+
+		/* somebody might have started reading 'addr' in the meantime */
+		goto again;
+	}
+
+	list_add(&new->node, &ec_inflight_reads);
+
+	spin_unlock(&ec_inflight_lock);
+
+	err = qc71_ec_locked_transaction(addr, 0, &new->result, true);
+	new->err = err;
+
+	spin_lock(&ec_inflight_lock);
+	list_del_init(&new->node);
+	spin_unlock(&ec_inflight_lock);
+
+	complete_all(&new->done);
+
+	if (!err)
+		*result = new->result;
+
+	qc71_ec_inflight_put(new);
+
+	return err;
+}
+
+int __must_check qc71_ec_transaction_prio(uint16_t addr, uint16_t data,
+					  union qc71_ec_result *result, bool read,
+					  enum qc71_ec_prio prio)
+{
+	/* bulk reads are for debugging, they always go to the EC */
+	bool cached = read && result && prio != QC71_EC_PRIO_BULK;
+	u64 gen;
+	int err;
+
+	if (cached && qc71_ec_cache_lookup(addr, result, &gen)) {
+		qc71_ec_queue_overlay(addr, result);
+		return 0;
+	}
+
+	/* a queued write must not land after this one, and overwrite it */
+	if (!read)
+		qc71_ec_queue_drain();
+
+	err = qc71_ec_sched_enter(prio, 1);
+	if (err)
+		return err;
+
+	if (read && result) {
+		err = qc71_ec_read_shared(addr, result);
+
+		if (!err && cached)
+			qc71_ec_cache_fill(addr, result, gen);
+
+		if (!err)
+			qc71_ec_queue_overlay(addr, result);
+	} else {
+		err = qc71_ec_locked_transaction(addr, data, result, read);
+	}
+
+	qc71_ec_sched_exit(prio);
+
+	return err;
+}
+ALLOW_ERROR_INJECTION(qc71_ec_transaction_prio, ERRNO);
+
+/*
+ * a read transaction returns the byte at 'addr' in 'b1', and the byte
+ * following it in 'b2' (see qc71_fan_get_rpm()), so a block can be read
+ * using half as many WMI calls; 'ec_lock' is only dropped between chunks,
+ * which are scheduled as bulk accesses
+ */
+int __must_check qc71_ec_read_block(uint16_t addr, uint8_t *buf, size_t len)
+{
+	union qc71_ec_result result;
+	size_t i = 0, end;
+	int err = 0;
+
+	if (len > (size_t) U16_MAX + 1 - addr)
+		return -EINVAL;
+
+	while (i < len && !err) {
+		end = min(len, i + 2 * EC_READ_BLOCK_CHUNK);
+
+		err = qc71_ec_sched_enter(QC71_EC_PRIO_BULK, DIV_ROUND_UP(end - i, 2));
+		if (err)
+			break;
+
+		err = down_read_killable(&ec_lock);
+		if (err) {
+			qc71_ec_sched_exit(QC71_EC_PRIO_BULK);
+			break;
+		}
+
+		for (; i < end; i += 2) {
+			if (fatal_signal_pending(current)) {
+				err = -EINTR;
+				break;
+			}
+
+			err = __qc71_ec_transaction(addr + i, 0, &result, true);
+			if (err)
+				break;
+
+			buf[i] = result.bytes.b1;
+
+			if (i + 1 < len)
+				buf[i + 1] = result.bytes.b2;
+		}
+
+		up_read(&ec_lock);
+		qc71_ec_sched_exit(QC71_EC_PRIO_BULK);
+	}
+
+	return err;
+}
+
+/* ========================================================================== */
+
+static int qc71_ec_txn_raw_read(uint16_t addr, union qc71_ec_result *result)
+{
+	return __qc71_ec_transaction(addr, 0, result, true);
+}
+
+static int qc71_ec_txn_raw_write(uint16_t addr, uint8_t value)
+{
+	return qc71_ec_raw_write(addr, value);
+}
+
+/* 'ec_lock' must be held for writing while a transaction uses these */
+static const struct qc71_ec_txn_io qc71_ec_txn_raw_io = {
+	.read  = qc71_ec_txn_raw_read,
+	.write = qc71_ec_txn_raw_write,
+};
+
+/*
+ * removes the writes and updates that would not change the (cached) current
+ * value of their register, so that no lock or transaction is needed for them;
+ * ops touching the same register as another op are kept; returns the new count
+ */
+size_t qc71_ec_txn_prune(struct qc71_ec_txn_op *ops, size_t n)
+{
+	size_t i, j, k = 0;
+
+	for (i = 0; i < n; i++) {
+		const struct qc71_ec_txn_op *op = &ops[i];
+		bool keep = op->type != QC71_EC_TXN_WRITE && op->type != QC71_EC_TXN_UPDATE;
+		int cur;
+
+		for (j = 0; j < n && !keep; j++)
+			keep = j != i && ops[j].addr == op->addr;
+
+		if (!keep) {
+			cur = ec_read_byte(op->addr);
+			keep = cur < 0 || (cur & op->mask) != (op->value & op->mask);
+		}
+
+		if (keep)
+			ops[k++] = *op;
+	}
+
+	return k;
+}
+
+/*
+ * executes the operations in order while holding 'ec_lock', if any of them
+ * fails, the registers written so far are restored to their old values
+ * (plain writes only with QC71_EC_TXN_ROLLBACK); queued writes are carried
+ * out first
+ */
+int __must_check qc71_ec_txn_execute_flags(struct qc71_ec_txn_op *ops, size_t n, unsigned int flags)
+{
+	int err;
+
+	if (n == 0 || n > QC71_EC_TXN_MAX_OPS)
+		return -EINVAL;
+
+	qc71_ec_queue_drain();
+
+	err = qc71_ec_sched_enter(QC71_EC_PRIO_CONTROL, 2 * n);
+	if (err)
+		return err;
+
+	err = down_write_killable(&ec_lock);
+	if (err)
+		goto out;
+
+	err = qc71_ec_txn_apply(ops, n, flags, &qc71_ec_txn_raw_io);
+
+	up_write(&ec_lock);
+
+out:
+	qc71_ec_sched_exit(QC71_EC_PRIO_CONTROL);
+
+	return err;
+}
+
+int __must_check qc71_ec_txn_execute(struct qc71_ec_txn_op *ops, size_t n)
+{
+	return qc71_ec_txn_execute_flags(ops, n, 0);
+}
+
+/* ========================================================================== */
+
+int __init qc71_ec_setup(void)
+{
+	int err;
+
+	if (sysfs_streq(ec_backend, "wmi")) {
+		if (!wmi_has_guid(QC71_WMI_WMBC_GUID)) {
+			pr_err("WMI GUID not found\n");
+			return -ENODEV;
+		}
+	} else if (sysfs_streq(ec_backend, "emu")) {
+		err = qc71_ec_emu_setup();
+		if (err)
+			return err;
+
+		ec_emu_initialized = true;
+		qc71_ec_set_backend(&qc71_ec_emu_backend);
+	} else {
+		pr_err("unknown EC backend: '%s'\n", ec_backend);
+		return -EINVAL;
+	}
+
+	qc71_ec_cache_setup();
+
+	err = qc71_ec_queue_setup();
+	if (err) {
+		qc71_ec_cleanup();
+		return err;
+	}
+
+	return 0;
+}
+
+void qc71_ec_cleanup(void)
+{
+	qc71_ec_queue_cleanup();
+
+	if (ec_emu_initialized) {
+		qc71_ec_set_backend(&qc71_ec_wmi_backend);
+		qc71_ec_emu_cleanup();
+		ec_emu_initialized = false;
+	}
+}
@@ -3,6 +3,7 @@
 #define QC71_LAPTOP_EC_H
 
 #include <linux/compiler_types.h>
+#include <linux/init.h>
 #include <linux/types.h>
 
 /* ========================================================================== */
@@ -236,8 +237,117 @@ union qc71_ec_result {
 	} bytes;
 };
 
-int __must_check qc71_ec_transaction(uint16_t addr, uint16_t data,
-				     union qc71_ec_result *result, bool read);
+struct qc71_ec_backend {
+	const char *name;
+	int (*transaction)(uint16_t addr, uint16_t data,
+			   union qc71_ec_result *result, bool read);
+};
+
+extern const struct qc71_ec_backend qc71_ec_wmi_backend;
+
+/* ========================================================================== */
+
+/* in decreasing order of priority */
+enum qc71_ec_prio {
+	QC71_EC_PRIO_INTERACTIVE, /* hotkeys, events */
+	QC71_EC_PRIO_CONTROL,     /* configuration changes, the default */
+	QC71_EC_PRIO_TELEMETRY,   /* periodic polling, e.g. hwmon */
+	QC71_EC_PRIO_BULK,        /* debugging, dumps */
+	QC71_EC_PRIO_COUNT,
+};
+
+extern const char * const qc71_ec_prio_names[QC71_EC_PRIO_COUNT];
+
+/* ========================================================================== */
+
+#define QC71_EC_TXN_MAX_OPS 16
+
+/* the old values of plain writes are read as well, so that they can be rolled back */
+#define QC71_EC_TXN_ROLLBACK BIT(0)
+
+enum qc71_ec_txn_op_type {
+	QC71_EC_TXN_READ,    /* stores the value in 'value' */
+	QC71_EC_TXN_WRITE,   /* writes 'value' */
+	QC71_EC_TXN_UPDATE,  /* changes the bits of 'mask' to those of 'value', skipped if they already match */
+	QC71_EC_TXN_RESTORE, /* writes back the value 'addr' had when the transaction started */
+};
+
+struct qc71_ec_txn_op {
+	enum qc71_ec_txn_op_type type;
+	uint16_t addr;
+	uint8_t mask;
+	uint8_t value;
+
+	/* used by qc71_ec_txn_execute() */
+	uint8_t old;
+	bool written;
+};
+
+#define QC71_EC_TXN_READ_OP(_addr) \
+	((struct qc71_ec_txn_op) { .type = QC71_EC_TXN_READ, .addr = (_addr) })
+#define QC71_EC_TXN_WRITE_OP(_addr, _value) \
+	((struct qc71_ec_txn_op) { .type = QC71_EC_TXN_WRITE, .addr = (_addr), .mask = 0xFF, .value = (_value) })
+#define QC71_EC_TXN_UPDATE_OP(_addr, _mask, _value) \
+	((struct qc71_ec_txn_op) { .type = QC71_EC_TXN_UPDATE, .addr = (_addr), .mask = (_mask), .value = (_value) })
+#define QC71_EC_TXN_RESTORE_OP(_addr) \
+	((struct qc71_ec_txn_op) { .type = QC71_EC_TXN_RESTORE, .addr = (_addr), .mask = 0xFF })
+
+/* ========================================================================== */
+
+int  __init qc71_ec_setup(void);
+void        qc71_ec_cleanup(void);
+
+const struct qc71_ec_backend *qc71_ec_set_backend(const struct qc71_ec_backend *backend);
+bool qc71_ec_backend_is_wmi(void);
+
+int __must_check qc71_ec_transaction_prio(uint16_t addr, uint16_t data,
+					  union qc71_ec_result *result, bool read,
+					  enum qc71_ec_prio prio);
+
+int __must_check qc71_ec_read_block(uint16_t addr, uint8_t *buf, size_t len);
+
+int __must_check qc71_ec_txn_execute_flags(struct qc71_ec_txn_op *ops, size_t n, unsigned int flags);
+int __must_check qc71_ec_txn_execute(struct qc71_ec_txn_op *ops, size_t n);
+size_t qc71_ec_txn_prune(struct qc71_ec_txn_op *ops, size_t n);
+
+int  __init qc71_ec_queue_setup(void);
+void        qc71_ec_queue_cleanup(void);
+
+int __must_check qc71_ec_txn_queue(const struct qc71_ec_txn_op *ops, size_t n, void (*failed)(void));
+int __must_check qc71_ec_write_flush(void);
+void qc71_ec_queue_drain(void);
+void qc71_ec_queue_overlay(uint16_t addr, union qc71_ec_result *result);
+
+struct dentry;
+
+void __init qc71_ec_cache_setup(void);
+void __init qc71_ec_cache_debugfs_setup(struct dentry *parent);
+bool qc71_ec_cache_lookup(uint16_t addr, union qc71_ec_result *result, u64 *gen);
+void qc71_ec_cache_fill(uint16_t addr, const union qc71_ec_result *result, u64 gen);
+void qc71_ec_cache_invalidate(uint16_t addr);
+void qc71_ec_cache_invalidate_all(void);
+
+int __must_check qc71_ec_sched_enter(enum qc71_ec_prio prio, unsigned int n);
+void qc71_ec_sched_exit(enum qc71_ec_prio prio);
+void __init qc71_ec_sched_debugfs_setup(struct dentry *parent);
+
+static inline __must_check int qc71_ec_transaction(uint16_t addr, uint16_t data,
+						   union qc71_ec_result *result, bool read)
+{
+	return qc71_ec_transaction_prio(addr, data, result, read, QC71_EC_PRIO_CONTROL);
+}
+
+static inline __must_check int qc71_ec_read_prio(uint16_t addr, union qc71_ec_result *result,
+						 enum qc71_ec_prio prio)
+{
+	return qc71_ec_transaction_prio(addr, 0, result, true, prio);
+}
+
+static inline __must_check int qc71_ec_write_prio(uint16_t addr, uint16_t data,
+						  enum qc71_ec_prio prio)
+{
+	return qc71_ec_transaction_prio(addr, data, NULL, false, prio);
+}
 
 static inline __must_check int qc71_ec_read(uint16_t addr, union qc71_ec_result *result)
 {
@@ -254,12 +364,18 @@ static inline __must_check int ec_write_byte(uint16_t addr, uint8_t data)
 	return qc71_ec_write(addr, data);
 }
 
-static inline __must_check int ec_read_byte(uint16_t addr)
+static inline __must_check int ec_write_byte_prio(uint16_t addr, uint8_t data,
+						   enum qc71_ec_prio prio)
+{
+	return qc71_ec_write_prio(addr, data, prio);
+}
+
+static inline __must_check int ec_read_byte_prio(uint16_t addr, enum qc71_ec_prio prio)
 {
 	union qc71_ec_result result;
 	int err;
 
-	err = qc71_ec_read(addr, &result);
+	err = qc71_ec_read_prio(addr, &result, prio);
 
 	if (err)
 		return err;
@@ -267,4 +383,9 @@ static inline __must_check int ec_read_byte(uint16_t addr)
 	return result.bytes.b1;
 }
 
+static inline __must_check int ec_read_byte(uint16_t addr)
+{
+	return ec_read_byte_prio(addr, QC71_EC_PRIO_CONTROL);
+}
+
 #endif /* QC71_LAPTOP_EC_H */
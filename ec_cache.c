@@ -0,0 +1,264 @@
+// SPDX-License-Identifier: GPL-2.0
+#include "pr.h"
+
+#include <linux/bsearch.h>
+#include <linux/debugfs.h>
+#include <linux/init.h>
+#include <linux/jiffies.h>
+#include <linux/kernel.h>
+#include <linux/moduleparam.h>
+#include <linux/seq_file.h>
+#include <linux/sort.h>
+#include <linux/spinlock.h>
+#include <linux/types.h>
+
+#include "ec.h"
+
+/* ========================================================================== */
+
+enum qc71_ec_cache_policy {
+	EC_CACHE_STATIC, /* never changes */
+	EC_CACHE_EVENT,  /* only changed by the driver, or the EC along with a WMI event */
+	EC_CACHE_TTL,    /* changed by the EC on its own */
+};
+
+struct qc71_ec_cache_entry {
+	uint16_t addr;
+	enum qc71_ec_cache_policy policy;
+
+	/* protected by 'ec_cache_lock' */
+	bool valid;
+	unsigned long expires; /* EC_CACHE_TTL only */
+	union qc71_ec_result result;
+};
+
+/* ========================================================================== */
+
+static bool ec_cache = true;
+module_param(ec_cache, bool, 0644);
+MODULE_PARM_DESC(ec_cache, "cache the values of EC registers (default=true)");
+
+static unsigned int ec_cache_ttl_ms = 250;
+module_param(ec_cache_ttl_ms, uint, 0644);
+MODULE_PARM_DESC(ec_cache_ttl_ms, "how long the registers the EC changes on its own are cached, 0 disables it (default=250)");
+
+/* ========================================================================== */
+
+/* sorted by address in qc71_ec_cache_setup() */
+static struct qc71_ec_cache_entry ec_cache_entries[] = {
+	{ PROJ_ID_ADDR,          EC_CACHE_STATIC },
+	{ PLATFORM_ID_ADDR,      EC_CACHE_STATIC },
+	{ KEYBOARD_TYPE_ADDR,    EC_CACHE_STATIC },
+	{ SUPPORT_1_ADDR,        EC_CACHE_STATIC },
+	{ SUPPORT_2_ADDR,        EC_CACHE_STATIC },
+	{ SUPPORT_5_ADDR,        EC_CACHE_STATIC },
+
+	{ BIOS_CTRL_1_ADDR,      EC_CACHE_EVENT },
+	{ BIOS_CTRL_3_ADDR,      EC_CACHE_EVENT },
+	{ STATUS_1_ADDR,         EC_CACHE_EVENT },
+	{ CTRL_2_ADDR,           EC_CACHE_EVENT },
+	{ CTRL_3_ADDR,           EC_CACHE_EVENT },
+	{ CTRL_4_ADDR,           EC_CACHE_EVENT },
+	{ PL1_ADDR,              EC_CACHE_EVENT },
+	{ PL2_ADDR,              EC_CACHE_EVENT },
+	{ PL4_ADDR,              EC_CACHE_EVENT },
+	{ DEVICE_STATUS_ADDR,    EC_CACHE_EVENT },
+	{ POWER_SOURCE_ADDR,     EC_CACHE_EVENT },
+	{ POWER_STATUS_ADDR,     EC_CACHE_EVENT },
+	{ LIGHTBAR_CTRL_ADDR,    EC_CACHE_EVENT },
+	{ LIGHTBAR_RED_ADDR,     EC_CACHE_EVENT },
+	{ LIGHTBAR_GREEN_ADDR,   EC_CACHE_EVENT },
+	{ LIGHTBAR_BLUE_ADDR,    EC_CACHE_EVENT },
+
+	{ BATT_STATUS_ADDR,      EC_CACHE_TTL },
+	/* the EC sets the "reached" bit on its own, without an event */
+	{ BATT_CHARGE_CTRL_ADDR, EC_CACHE_TTL },
+	{ FAN_CTRL_ADDR,         EC_CACHE_TTL },
+	{ FAN_RPM_1_ADDR,        EC_CACHE_TTL },
+	{ FAN_RPM_2_ADDR,        EC_CACHE_TTL },
+	{ FAN_PWM_1_ADDR,        EC_CACHE_TTL },
+	{ FAN_PWM_2_ADDR,        EC_CACHE_TTL },
+	{ FAN_TEMP_1_ADDR,       EC_CACHE_TTL },
+	{ FAN_TEMP_2_ADDR,       EC_CACHE_TTL },
+};
+
+/* writing a trigger register changes other registers as well */
+static const struct {
+	uint16_t addr;
+	uint16_t affected;
+} ec_cache_side_effects[] = {
+	{ TRIGGER_1_ADDR, STATUS_1_ADDR },
+	/* the turbo level selects the power limits */
+	{ CTRL_2_ADDR,    PL1_ADDR },
+	{ CTRL_2_ADDR,    PL2_ADDR },
+	{ CTRL_2_ADDR,    PL4_ADDR },
+};
+
+/* protects the entries, and the following variables */
+static DEFINE_SPINLOCK(ec_cache_lock);
+static u64 ec_cache_gen; /* incremented on every invalidation */
+static u64 ec_cache_hits, ec_cache_misses, ec_cache_invalidations;
+
+/* ========================================================================== */
+
+static int qc71_ec_cache_cmp(const void *a, const void *b)
+{
+	const struct qc71_ec_cache_entry *x = a, *y = b;
+
+	return (int) x->addr - (int) y->addr;
+}
+
+static struct qc71_ec_cache_entry *qc71_ec_cache_find(uint16_t addr)
+{
+	struct qc71_ec_cache_entry key = { .addr = addr };
+
+	return bsearch(&key, ec_cache_entries, ARRAY_SIZE(ec_cache_entries),
+		       sizeof(ec_cache_entries[0]), qc71_ec_cache_cmp);
+}
+
+/* ========================================================================== */
+
+/* returns true and fills 'result' if 'addr' is cached, otherwise 'gen' is to be passed to qc71_ec_cache_fill() */
+bool qc71_ec_cache_lookup(uint16_t addr, union qc71_ec_result *result, u64 *gen)
+{
+	struct qc71_ec_cache_entry *e = qc71_ec_cache_find(addr);
+	bool hit = false;
+
+	if (!e)
+		return false;
+
+	spin_lock(&ec_cache_lock);
+
+	*gen = ec_cache_gen;
+
+	if (e->valid && e->policy == EC_CACHE_TTL && time_after_eq(jiffies, e->expires))
+		e->valid = false;
+
+	if (e->valid && READ_ONCE(ec_cache)) {
+		*result = e->result;
+		hit = true;
+		ec_cache_hits += 1;
+	} else {
+		ec_cache_misses += 1;
+	}
+
+	spin_unlock(&ec_cache_lock);
+
+	return hit;
+}
+
+/* stores the result of a read, unless there was an invalidation since the lookup */
+void qc71_ec_cache_fill(uint16_t addr, const union qc71_ec_result *result, u64 gen)
+{
+	unsigned int ttl = READ_ONCE(ec_cache_ttl_ms);
+	struct qc71_ec_cache_entry *e;
+
+	e = qc71_ec_cache_find(addr);
+	if (!e || !READ_ONCE(ec_cache) || (e->policy == EC_CACHE_TTL && !ttl))
+		return;
+
+	spin_lock(&ec_cache_lock);
+
+	if (gen == ec_cache_gen) {
+		e->valid = true;
+		e->result = *result;
+		e->expires = jiffies + msecs_to_jiffies(ttl);
+	}
+
+	spin_unlock(&ec_cache_lock);
+}
+
+/* 'ec_cache_lock' must be held; a cached result holds the bytes of the following 3 addresses as well */
+static void __qc71_ec_cache_invalidate(uint16_t addr)
+{
+	struct qc71_ec_cache_entry *e;
+	unsigned int i;
+
+	for (i = 0; i < sizeof(union qc71_ec_result) && i <= addr; i++) {
+		e = qc71_ec_cache_find(addr - i);
+		if (e)
+			e->valid = false;
+	}
+}
+
+void qc71_ec_cache_invalidate(uint16_t addr)
+{
+	size_t i;
+
+	spin_lock(&ec_cache_lock);
+
+	ec_cache_gen += 1;
+	ec_cache_invalidations += 1;
+
+	__qc71_ec_cache_invalidate(addr);
+
+	for (i = 0; i < ARRAY_SIZE(ec_cache_side_effects); i++) {
+		if (ec_cache_side_effects[i].addr == addr)
+			__qc71_ec_cache_invalidate(ec_cache_side_effects[i].affected);
+	}
+
+	spin_unlock(&ec_cache_lock);
+}
+
+void qc71_ec_cache_invalidate_all(void)
+{
+	size_t i;
+
+	spin_lock(&ec_cache_lock);
+
+	ec_cache_gen += 1;
+	ec_cache_invalidations += 1;
+
+	for (i = 0; i < ARRAY_SIZE(ec_cache_entries); i++)
+		ec_cache_entries[i].valid = false;
+
+	spin_unlock(&ec_cache_lock);
+}
+
+/* ========================================================================== */
+
+static const char * const qc71_ec_cache_policy_names[] = {
+	[EC_CACHE_STATIC] = "static",
+	[EC_CACHE_EVENT]  = "event",
+	[EC_CACHE_TTL]    = "ttl",
+};
+
+static int qc71_ec_cache_show(struct seq_file *m, void *v)
+{
+	size_t i;
+
+	spin_lock(&ec_cache_lock);
+
+	seq_printf(m, "hits: %llu\nmisses: %llu\ninvalidations: %llu\n",
+		   ec_cache_hits, ec_cache_misses, ec_cache_invalidations);
+
+	for (i = 0; i < ARRAY_SIZE(ec_cache_entries); i++) {
+		const struct qc71_ec_cache_entry *e = &ec_cache_entries[i];
+
+		seq_printf(m, "%#06x %-6s ", (unsigned int) e->addr,
+			   qc71_ec_cache_policy_names[e->policy]);
+
+		if (e->valid)
+			seq_printf(m, "%#04x\n", (unsigned int) e->result.bytes.b1);
+		else
+			seq_puts(m, "-\n");
+	}
+
+	spin_unlock(&ec_cache_lock);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(qc71_ec_cache);
+
+/* ========================================================================== */
+
+void __init qc71_ec_cache_debugfs_setup(struct dentry *parent)
+{
+	debugfs_create_file("cache", 0400, parent, NULL, &qc71_ec_cache_fops);
+}
+
+void __init qc71_ec_cache_setup(void)
+{
+	sort(ec_cache_entries, ARRAY_SIZE(ec_cache_entries), sizeof(ec_cache_entries[0]),
+	     qc71_ec_cache_cmp, NULL);
+}
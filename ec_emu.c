@@ -0,0 +1,302 @@
+// SPDX-License-Identifier: GPL-2.0
+#include "pr.h"
+
+#include <linux/debugfs.h>
+#include <linux/delay.h>
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/lockdep.h>
+#include <linux/moduleparam.h>
+#include <linux/random.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/string.h>
+#include <linux/types.h>
+#include <linux/uaccess.h>
+#include <linux/vmalloc.h>
+
+#include "ec.h"
+#include "ec_emu.h"
+
+/* ========================================================================== */
+
+/* the result of a read at the last address extends 3 bytes past the end */
+#define EMU_REGFILE_SIZE (U16_MAX + 1 + 3)
+
+#define EMU_MAX_RULES 32
+
+/* ========================================================================== */
+
+enum qc71_ec_emu_op {
+	EMU_OP_SET,
+	EMU_OP_CLEAR,
+	EMU_OP_TOGGLE,
+};
+
+/* writing any of the bits of 'mask' to 'addr' applies 'op' to the bits of 'target_mask' in 'target' */
+struct qc71_ec_emu_rule {
+	uint16_t addr;
+	uint8_t mask;
+	enum qc71_ec_emu_op op;
+	uint16_t target;
+	uint8_t target_mask;
+};
+
+static const char * const qc71_ec_emu_op_names[] = {
+	[EMU_OP_SET]    = "set",
+	[EMU_OP_CLEAR]  = "clear",
+	[EMU_OP_TOGGLE] = "toggle",
+};
+
+/* the trigger register is write-only, it is cleared by the default rules */
+static const struct qc71_ec_emu_rule qc71_ec_emu_default_rules[] = {
+	{ TRIGGER_1_ADDR, TRIGGER_1_SUPER_KEY_LOCK, EMU_OP_TOGGLE, STATUS_1_ADDR,  STATUS_1_SUPER_KEY_LOCK },
+	{ TRIGGER_1_ADDR, TRIGGER_1_LIGHTBAR,       EMU_OP_TOGGLE, STATUS_1_ADDR,  STATUS_1_LIGHTBAR },
+	{ TRIGGER_1_ADDR, TRIGGER_1_FAN_BOOST,      EMU_OP_TOGGLE, STATUS_1_ADDR,  STATUS_1_FAN_BOOST },
+	{ TRIGGER_1_ADDR, U8_MAX,                   EMU_OP_CLEAR,  TRIGGER_1_ADDR, U8_MAX },
+};
+
+/* values a QC71 device reports, everything else reads as zero */
+static const struct {
+	uint16_t addr;
+	uint8_t value;
+} qc71_ec_emu_initial_values[] = {
+	{ PROJ_ID_ADDR,       PROJ_ID_GJxCN },
+	{ SUPPORT_1_ADDR,     SUPPORT_1_SUPER_KEY_LOCK | SUPPORT_1_LIGHTBAR | SUPPORT_1_FAN_BOOST },
+	{ SUPPORT_2_ADDR,     SUPPORT_2_SILENT_MODE },
+	{ SUPPORT_5_ADDR,     SUPPORT_5_FAN | SUPPORT_5_FAN_TURBO },
+	{ FAN_CTRL_ADDR,      0x80 | FAN_CTRL_AUTO },
+	{ FAN_TEMP_1_ADDR,    45 },
+	{ FAN_TEMP_2_ADDR,    40 },
+	{ FAN_RPM_1_ADDR,     0x0a },
+	{ FAN_RPM_2_ADDR,     0x0a },
+	{ LIGHTBAR_CTRL_ADDR, LIGHTBAR_CTRL_S3_OFF },
+	{ LIGHTBAR_BLUE_ADDR, 36 },
+	{ DEVICE_STATUS_ADDR, DEVICE_STATUS_WIFI_ON },
+	{ PL1_ADDR,           45 },
+	{ PL2_ADDR,           90 },
+	{ PL4_ADDR,           120 },
+};
+
+/* ========================================================================== */
+
+static unsigned int emu_latency_us;
+module_param(emu_latency_us, uint, 0644);
+MODULE_PARM_DESC(emu_latency_us, "duration of an emulated EC transaction (default=0)");
+
+static unsigned int emu_jitter_us;
+module_param(emu_jitter_us, uint, 0644);
+MODULE_PARM_DESC(emu_jitter_us, "maximum random delay added to an emulated EC transaction (default=0)");
+
+/* ========================================================================== */
+
+/* protects the following variables */
+static DEFINE_SPINLOCK(emu_lock);
+static uint8_t *emu_regfile;
+static struct qc71_ec_emu_rule emu_rules[EMU_MAX_RULES];
+static unsigned int emu_rule_count;
+
+static struct dentry *qc71_ec_emu_debugfs_dir;
+
+/* ========================================================================== */
+
+static void qc71_ec_emu_delay(void)
+{
+	unsigned int us = READ_ONCE(emu_latency_us),
+		     jitter = READ_ONCE(emu_jitter_us);
+
+	if (jitter)
+		us += get_random_u32() % (jitter + 1);
+
+	if (us)
+		usleep_range(us, us + us / 8 + 1);
+}
+
+/* 'emu_lock' must be held */
+static void qc71_ec_emu_apply_rules(uint16_t addr, uint8_t value)
+{
+	unsigned int i;
+
+	lockdep_assert_held(&emu_lock);
+
+	for (i = 0; i < emu_rule_count; i++) {
+		const struct qc71_ec_emu_rule *rule = &emu_rules[i];
+		uint8_t *target = &emu_regfile[rule->target];
+
+		if (rule->addr != addr || !(value & rule->mask))
+			continue;
+
+		switch (rule->op) {
+		case EMU_OP_SET:
+			*target |= rule->target_mask;
+			break;
+		case EMU_OP_CLEAR:
+			*target &= ~rule->target_mask;
+			break;
+		case EMU_OP_TOGGLE:
+			*target ^= rule->target_mask;
+			break;
+		}
+	}
+}
+
+static int qc71_ec_emu_transaction(uint16_t addr, uint16_t data,
+				   union qc71_ec_result *result, bool read)
+{
+	qc71_ec_emu_delay();
+
+	spin_lock(&emu_lock);
+
+	if (read) {
+		if (result) {
+			result->bytes.b1 = emu_regfile[addr];
+			result->bytes.b2 = emu_regfile[addr + 1];
+			result->bytes.b3 = emu_regfile[addr + 2];
+			result->bytes.b4 = emu_regfile[addr + 3];
+		}
+	} else {
+		emu_regfile[addr] = data & 0xFF;
+		qc71_ec_emu_apply_rules(addr, data & 0xFF);
+	}
+
+	spin_unlock(&emu_lock);
+
+	return 0;
+}
+
+const struct qc71_ec_backend qc71_ec_emu_backend = {
+	.name        = "emu",
+	.transaction = qc71_ec_emu_transaction,
+};
+
+/* ========================================================================== */
+/* debugfs interface for the rules: "<addr> <mask> <set|clear|toggle> <target> <target mask>" */
+
+static int qc71_ec_emu_rules_show(struct seq_file *m, void *v)
+{
+	unsigned int i;
+
+	spin_lock(&emu_lock);
+
+	for (i = 0; i < emu_rule_count; i++) {
+		const struct qc71_ec_emu_rule *rule = &emu_rules[i];
+
+		seq_printf(m, "%#06x %#04x %s %#06x %#04x\n",
+			   (unsigned int) rule->addr, (unsigned int) rule->mask,
+			   qc71_ec_emu_op_names[rule->op],
+			   (unsigned int) rule->target, (unsigned int) rule->target_mask);
+	}
+
+	spin_unlock(&emu_lock);
+
+	return 0;
+}
+
+static int qc71_ec_emu_rules_open(struct inode *inode, struct file *f)
+{
+	return single_open(f, qc71_ec_emu_rules_show, inode->i_private);
+}
+
+/* appends a rule, "reset" restores the default rules */
+static ssize_t qc71_ec_emu_rules_write(struct file *f, const char __user *buf,
+				       size_t count, loff_t *offset)
+{
+	struct qc71_ec_emu_rule rule;
+	unsigned int addr, mask, target, target_mask;
+	char op[8], *str;
+	int err = 0, i;
+
+	if (count >= PAGE_SIZE)
+		return -E2BIG;
+
+	str = memdup_user_nul(buf, count);
+	if (IS_ERR(str))
+		return PTR_ERR(str);
+
+	if (sysfs_streq(str, "reset")) {
+		spin_lock(&emu_lock);
+		memcpy(emu_rules, qc71_ec_emu_default_rules, sizeof(qc71_ec_emu_default_rules));
+		emu_rule_count = ARRAY_SIZE(qc71_ec_emu_default_rules);
+		spin_unlock(&emu_lock);
+		goto out;
+	}
+
+	if (sscanf(str, "%i %i %7s %i %i", &addr, &mask, op, &target, &target_mask) != 5 ||
+	    addr > U16_MAX || mask > U8_MAX || target > U16_MAX || target_mask > U8_MAX) {
+		err = -EINVAL;
+		goto out;
+	}
+
+	i = match_string(qc71_ec_emu_op_names, ARRAY_SIZE(qc71_ec_emu_op_names), op);
+	if (i < 0) {
+		err = i;
+		goto out;
+	}
+
+	rule = (struct qc71_ec_emu_rule) {
+		.addr        = addr,
+		.mask        = mask,
+		.op          = i,
+		.target      = target,
+		.target_mask = target_mask,
+	};
+
+	spin_lock(&emu_lock);
+
+	if (emu_rule_count < ARRAY_SIZE(emu_rules))
+		emu_rules[emu_rule_count++] = rule;
+	else
+		err = -ENOSPC;
+
+	spin_unlock(&emu_lock);
+
+out:
+	kfree(str);
+
+	return err ? err : count;
+}
+
+static const struct file_operations qc71_ec_emu_rules_fops = {
+	.owner = THIS_MODULE,
+	.open = qc71_ec_emu_rules_open,
+	.read = seq_read,
+	.write = qc71_ec_emu_rules_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+/* ========================================================================== */
+
+/* also used by the KUnit suite, outside of the module init */
+int qc71_ec_emu_setup(void)
+{
+	size_t i;
+
+	emu_regfile = vzalloc(EMU_REGFILE_SIZE);
+	if (!emu_regfile)
+		return -ENOMEM;
+
+	for (i = 0; i < ARRAY_SIZE(qc71_ec_emu_initial_values); i++)
+		emu_regfile[qc71_ec_emu_initial_values[i].addr] = qc71_ec_emu_initial_values[i].value;
+
+	memcpy(emu_rules, qc71_ec_emu_default_rules, sizeof(qc71_ec_emu_default_rules));
+	emu_rule_count = ARRAY_SIZE(qc71_ec_emu_default_rules);
+
+	/* the rules can be changed regardless of 'debugregs' */
+	qc71_ec_emu_debugfs_dir = debugfs_create_dir(KBUILD_MODNAME "_emu", NULL);
+	if (!IS_ERR(qc71_ec_emu_debugfs_dir))
+		debugfs_create_file("rules", 0600, qc71_ec_emu_debugfs_dir, NULL,
+				    &qc71_ec_emu_rules_fops);
+
+	return 0;
+}
+
+void qc71_ec_emu_cleanup(void)
+{
+	/* checks if IS_ERR_OR_NULL() */
+	debugfs_remove_recursive(qc71_ec_emu_debugfs_dir);
+
+	vfree(emu_regfile);
+	emu_regfile = NULL;
+}
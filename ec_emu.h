@@ -0,0 +1,16 @@
+// SPDX-License-Identifier: GPL-2.0
+#ifndef QC71_EC_EMU_H
+#define QC71_EC_EMU_H
+
+#include "ec.h"
+
+/* ========================================================================== */
+
+extern const struct qc71_ec_backend qc71_ec_emu_backend;
+
+/* ========================================================================== */
+
+int  qc71_ec_emu_setup(void);
+void qc71_ec_emu_cleanup(void);
+
+#endif /* QC71_EC_EMU_H */
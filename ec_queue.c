@@ -0,0 +1,226 @@
+// SPDX-License-Identifier: GPL-2.0
+#include "pr.h"
+
+#include <linux/init.h>
+#include <linux/list.h>
+#include <linux/overflow.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/string.h>
+#include <linux/types.h>
+#include <linux/workqueue.h>
+
+#include "ec.h"
+
+/* ========================================================================== */
+
+#define EC_QUEUE_MAX_LENGTH 64
+
+/* ========================================================================== */
+
+/* a transaction group, its writes are carried out together */
+struct qc71_ec_queued_txn {
+	struct list_head node;
+	void (*failed)(void);
+	size_t n;
+	struct qc71_ec_txn_op ops[];
+};
+
+/* ========================================================================== */
+
+static struct workqueue_struct *qc71_ec_queue_wq;
+
+/* protects the following variables */
+static DEFINE_SPINLOCK(ec_queue_lock);
+static LIST_HEAD(ec_queue);
+static unsigned int ec_queue_length;
+static int ec_queue_err;
+
+/* ========================================================================== */
+
+/*
+ * the first entry stays on the list until it has been written,
+ * so readers see the queued value all the way
+ */
+static void qc71_ec_queue_work_fn(struct work_struct *work)
+{
+	struct qc71_ec_txn_op ops[QC71_EC_TXN_MAX_OPS];
+	struct qc71_ec_queued_txn *w;
+	size_t i;
+	int err;
+
+	for (;;) {
+		spin_lock(&ec_queue_lock);
+		w = list_first_entry_or_null(&ec_queue, struct qc71_ec_queued_txn, node);
+		spin_unlock(&ec_queue_lock);
+
+		if (!w)
+			break;
+
+		/* the queued operations are read by qc71_ec_queue_overlay() in the meantime */
+		memcpy(ops, w->ops, w->n * sizeof(*ops));
+
+		err = qc71_ec_txn_execute(ops, w->n);
+		if (err) {
+			pr_warn("failed to carry out queued EC transaction (first address %#06x): %d\n",
+				(unsigned int) w->ops[0].addr, err);
+
+			/* some of the writes might have taken effect */
+			for (i = 0; i < w->n; i++)
+				qc71_ec_cache_invalidate(w->ops[i].addr);
+
+			if (w->failed)
+				w->failed();
+		}
+
+		spin_lock(&ec_queue_lock);
+
+		list_del(&w->node);
+		ec_queue_length -= 1;
+
+		if (err && !ec_queue_err)
+			ec_queue_err = err;
+
+		spin_unlock(&ec_queue_lock);
+
+		kfree(w);
+	}
+}
+
+static DECLARE_WORK(qc71_ec_queue_work, qc71_ec_queue_work_fn);
+
+/* ========================================================================== */
+
+/* waits until every queued write has been carried out */
+void qc71_ec_queue_drain(void)
+{
+	/* the queued transactions themselves are executed by the worker */
+	if (qc71_ec_queue_wq && current_work() != &qc71_ec_queue_work)
+		flush_work(&qc71_ec_queue_work);
+}
+
+/* like qc71_ec_queue_drain(), but returns the first error since the last flush */
+int qc71_ec_write_flush(void)
+{
+	int err;
+
+	qc71_ec_queue_drain();
+
+	spin_lock(&ec_queue_lock);
+	err = ec_queue_err;
+	ec_queue_err = 0;
+	spin_unlock(&ec_queue_lock);
+
+	return err;
+}
+
+/*
+ * queues the transaction group, which is carried out in order with respect to
+ * the other queued ones, qc71_ec_write_flush() can be used to wait for it;
+ * 'failed' (if any) is called from the worker if it cannot be carried out,
+ * so it must not wait for the queue
+ */
+int qc71_ec_txn_queue(const struct qc71_ec_txn_op *ops, size_t n, void (*failed)(void))
+{
+	struct qc71_ec_queued_txn *w;
+	bool full;
+
+	if (n == 0 || n > QC71_EC_TXN_MAX_OPS)
+		return -EINVAL;
+
+	if (!qc71_ec_queue_wq) {
+		struct qc71_ec_txn_op tmp[QC71_EC_TXN_MAX_OPS];
+
+		memcpy(tmp, ops, n * sizeof(*ops));
+
+		return qc71_ec_txn_execute(tmp, n);
+	}
+
+	w = kmalloc(struct_size(w, ops, n), GFP_KERNEL);
+	if (!w)
+		return -ENOMEM;
+
+	w->failed = failed;
+	w->n = n;
+	memcpy(w->ops, ops, n * sizeof(*ops));
+
+	for (;;) {
+		spin_lock(&ec_queue_lock);
+
+		full = ec_queue_length >= EC_QUEUE_MAX_LENGTH;
+		if (!full) {
+			list_add_tail(&w->node, &ec_queue);
+			ec_queue_length += 1;
+		}
+
+		spin_unlock(&ec_queue_lock);
+
+		if (!full)
+			break;
+
+		/* let the queue drain */
+		qc71_ec_queue_drain();
+	}
+
+	queue_work(qc71_ec_queue_wq, &qc71_ec_queue_work);
+
+	return 0;
+}
+
+static void qc71_ec_queue_overlay_byte(uint8_t *b, const struct qc71_ec_txn_op *op)
+{
+	switch (op->type) {
+	case QC71_EC_TXN_WRITE:
+	case QC71_EC_TXN_UPDATE:
+		*b = (*b & ~op->mask) | (op->value & op->mask);
+		break;
+	default:
+		/* 'restore' leaves the value as it is by the end of the transaction */
+		break;
+	}
+}
+
+/* applies the queued writes to the bytes of 'result' they affect, in order */
+void qc71_ec_queue_overlay(uint16_t addr, union qc71_ec_result *result)
+{
+	struct qc71_ec_queued_txn *w;
+	size_t i;
+
+	if (!READ_ONCE(ec_queue_length))
+		return;
+
+	spin_lock(&ec_queue_lock);
+
+	list_for_each_entry (w, &ec_queue, node) {
+		for (i = 0; i < w->n; i++) {
+			if (w->ops[i].addr == addr)
+				qc71_ec_queue_overlay_byte(&result->bytes.b1, &w->ops[i]);
+			else if (w->ops[i].addr == addr + 1)
+				qc71_ec_queue_overlay_byte(&result->bytes.b2, &w->ops[i]);
+		}
+	}
+
+	spin_unlock(&ec_queue_lock);
+}
+
+/* ========================================================================== */
+
+int __init qc71_ec_queue_setup(void)
+{
+	qc71_ec_queue_wq = alloc_ordered_workqueue(KBUILD_MODNAME "_ec_writes", 0);
+	if (!qc71_ec_queue_wq)
+		return -ENOMEM;
+
+	return 0;
+}
+
+void qc71_ec_queue_cleanup(void)
+{
+	if (!qc71_ec_queue_wq)
+		return;
+
+	(void) qc71_ec_write_flush();
+
+	destroy_workqueue(qc71_ec_queue_wq);
+	qc71_ec_queue_wq = NULL;
+}
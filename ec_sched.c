@@ -0,0 +1,223 @@
+// SPDX-License-Identifier: GPL-2.0
+#include "pr.h"
+
+#include <linux/debugfs.h>
+#include <linux/hrtimer.h>
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/moduleparam.h>
+#include <linux/sched.h>
+#include <linux/sched/signal.h>
+#include <linux/seq_file.h>
+#include <linux/spinlock.h>
+#include <linux/types.h>
+#include <linux/wait.h>
+
+#include "ec.h"
+
+/* ========================================================================== */
+
+/* the budgeted classes may use the budget of this long in advance */
+#define EC_SCHED_BURST_NS (100 * NSEC_PER_MSEC)
+
+/* ========================================================================== */
+
+struct qc71_ec_sched_stats {
+	u64 transactions;
+	u64 requests;
+	u64 throttled;
+	u64 wait_ns;
+	u64 max_wait_ns;
+	unsigned int depth;
+	unsigned int max_depth;
+};
+
+const char * const qc71_ec_prio_names[QC71_EC_PRIO_COUNT] = {
+	[QC71_EC_PRIO_INTERACTIVE] = "interactive",
+	[QC71_EC_PRIO_CONTROL]     = "control",
+	[QC71_EC_PRIO_TELEMETRY]   = "telemetry",
+	[QC71_EC_PRIO_BULK]        = "bulk",
+};
+
+/* ========================================================================== */
+
+static unsigned int ec_budget_tps;
+module_param(ec_budget_tps, uint, 0644);
+MODULE_PARM_DESC(ec_budget_tps, "EC transactions per second available to telemetry and bulk accesses, 0 means unlimited (default=0)");
+
+/* ========================================================================== */
+
+static DECLARE_WAIT_QUEUE_HEAD(ec_sched_wq);
+
+/* protects the following variables */
+static DEFINE_SPINLOCK(ec_sched_lock);
+static struct qc71_ec_sched_stats ec_sched_stats[QC71_EC_PRIO_COUNT];
+static unsigned int ec_sched_interactive; /* waiting or running interactive requests */
+static ktime_t ec_sched_tat; /* when the budget is next fully used up */
+
+/* ========================================================================== */
+
+static inline bool qc71_ec_prio_is_budgeted(enum qc71_ec_prio prio)
+{
+	return prio >= QC71_EC_PRIO_TELEMETRY;
+}
+
+/* returns 0 if 'n' transactions fit into the budget, otherwise how long to wait */
+static u64 qc71_ec_sched_take_budget(unsigned int n)
+{
+	unsigned int budget = READ_ONCE(ec_budget_tps);
+	ktime_t now;
+	u64 delay = 0;
+
+	if (!budget)
+		return 0;
+
+	spin_lock(&ec_sched_lock);
+
+	now = ktime_get();
+
+	if (ktime_before(ktime_sub_ns(ec_sched_tat, EC_SCHED_BURST_NS), now)) {
+		if (ktime_before(ec_sched_tat, now))
+			ec_sched_tat = now;
+
+		ec_sched_tat = ktime_add_ns(ec_sched_tat, div_u64((u64) n * NSEC_PER_SEC, budget));
+	} else {
+		delay = ktime_to_ns(ktime_sub(ec_sched_tat, now)) - EC_SCHED_BURST_NS;
+	}
+
+	spin_unlock(&ec_sched_lock);
+
+	/* the budget may be changed in the meantime, so do not sleep too long at once */
+	return min_t(u64, delay, NSEC_PER_SEC);
+}
+
+static int qc71_ec_sched_sleep(u64 delay)
+{
+	ktime_t timeout = ns_to_ktime(delay);
+
+	set_current_state(TASK_KILLABLE);
+	schedule_hrtimeout(&timeout, HRTIMER_MODE_REL);
+
+	return fatal_signal_pending(current) ? -EINTR : 0;
+}
+
+/*
+ * must be called before issuing 'n' transactions of the given priority class,
+ * if it succeeds, qc71_ec_sched_exit() must be called when they are done;
+ * telemetry and bulk accesses wait for the interactive ones and are limited
+ * to 'ec_budget_tps'
+ */
+int qc71_ec_sched_enter(enum qc71_ec_prio prio, unsigned int n)
+{
+	struct qc71_ec_sched_stats *stats = &ec_sched_stats[prio];
+	bool throttled = false;
+	ktime_t start;
+	u64 waited;
+	int err = 0;
+
+	spin_lock(&ec_sched_lock);
+
+	stats->depth += 1;
+	stats->max_depth = max(stats->max_depth, stats->depth);
+
+	if (prio == QC71_EC_PRIO_INTERACTIVE)
+		ec_sched_interactive += 1;
+
+	spin_unlock(&ec_sched_lock);
+
+	start = ktime_get();
+
+	while (qc71_ec_prio_is_budgeted(prio)) {
+		u64 delay;
+
+		err = wait_event_killable(ec_sched_wq, !READ_ONCE(ec_sched_interactive));
+		if (err)
+			break;
+
+		delay = qc71_ec_sched_take_budget(n);
+		if (!delay)
+			break;
+
+		throttled = true;
+
+		err = qc71_ec_sched_sleep(delay);
+		if (err)
+			break;
+	}
+
+	waited = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	spin_lock(&ec_sched_lock);
+
+	stats->depth -= 1;
+	stats->requests += 1;
+	stats->wait_ns += waited;
+	stats->max_wait_ns = max(stats->max_wait_ns, waited);
+
+	if (throttled)
+		stats->throttled += 1;
+
+	if (!err)
+		stats->transactions += n;
+
+	spin_unlock(&ec_sched_lock);
+
+	if (err)
+		qc71_ec_sched_exit(prio);
+
+	return err;
+}
+
+void qc71_ec_sched_exit(enum qc71_ec_prio prio)
+{
+	bool wake = false;
+
+	if (prio != QC71_EC_PRIO_INTERACTIVE)
+		return;
+
+	spin_lock(&ec_sched_lock);
+	ec_sched_interactive -= 1;
+	wake = !ec_sched_interactive;
+	spin_unlock(&ec_sched_lock);
+
+	if (wake)
+		wake_up_all(&ec_sched_wq);
+}
+
+/* ========================================================================== */
+
+static int qc71_ec_sched_stats_show(struct seq_file *m, void *v)
+{
+	struct qc71_ec_sched_stats stats[QC71_EC_PRIO_COUNT];
+	unsigned int i;
+
+	spin_lock(&ec_sched_lock);
+	memcpy(stats, ec_sched_stats, sizeof(stats));
+	spin_unlock(&ec_sched_lock);
+
+	seq_printf(m, "budget_tps: %u\n", READ_ONCE(ec_budget_tps));
+	seq_printf(m, "%-12s %12s %12s %10s %6s %10s %12s %12s\n",
+		   "class", "transactions", "requests", "throttled",
+		   "depth", "max_depth", "avg_wait_us", "max_wait_us");
+
+	for (i = 0; i < ARRAY_SIZE(stats); i++) {
+		seq_printf(m, "%-12s %12llu %12llu %10llu %6u %10u %12llu %12llu\n",
+			   qc71_ec_prio_names[i],
+			   stats[i].transactions, stats[i].requests, stats[i].throttled,
+			   stats[i].depth, stats[i].max_depth,
+			   stats[i].requests ? div64_u64(stats[i].wait_ns, stats[i].requests) / NSEC_PER_USEC : 0,
+			   div_u64(stats[i].max_wait_ns, NSEC_PER_USEC));
+	}
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(qc71_ec_sched_stats);
+
+/* ========================================================================== */
+
+void __init qc71_ec_sched_debugfs_setup(struct dentry *parent)
+{
+	debugfs_create_file("sched", 0400, parent, NULL, &qc71_ec_sched_stats_fops);
+}
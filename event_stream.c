@@ -0,0 +1,233 @@
+// SPDX-License-Identifier: GPL-2.0
+#include "pr.h"
+
+#include <linux/compiler.h>
+#include <linux/fs.h>
+#include <linux/init.h>
+#include <linux/miscdevice.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/poll.h>
+#include <linux/sched/signal.h>
+#include <linux/slab.h>
+#include <linux/types.h>
+#include <linux/uaccess.h>
+#include <linux/wait.h>
+
+#include "event_stream.h"
+
+/* ========================================================================== */
+
+#define EVENT_STREAM_SIZE 256 /* must be a power of two */
+
+/* ========================================================================== */
+
+struct qc71_event_slot {
+	unsigned long seq; /* the position of the record plus one, 0 while it is being written */
+	struct qc71_event_record rec;
+};
+
+struct qc71_event_reader {
+	struct mutex lock;
+	unsigned long pos;
+	unsigned long lost; /* not yet reported */
+};
+
+/* ========================================================================== */
+
+/*
+ * there is only a single producer (the event workqueue), the readers
+ * do not take any locks shared with it, and they do not affect each other;
+ * a reader that falls behind more than EVENT_STREAM_SIZE records
+ * loses the oldest ones, and gets an overflow record instead
+ */
+static struct qc71_event_slot event_ring[EVENT_STREAM_SIZE];
+static unsigned long event_head;
+
+static DECLARE_WAIT_QUEUE_HEAD(event_wq);
+
+static bool event_stream_registered;
+
+/* ========================================================================== */
+
+void qc71_event_stream_push(const struct qc71_event_record *rec)
+{
+	unsigned long head = event_head;
+	struct qc71_event_slot *slot = &event_ring[head % EVENT_STREAM_SIZE];
+
+	WRITE_ONCE(slot->seq, 0);
+	smp_wmb();
+
+	slot->rec = *rec;
+
+	smp_store_release(&slot->seq, head + 1);
+	smp_store_release(&event_head, head + 1);
+
+	wake_up_interruptible_poll(&event_wq, EPOLLIN | EPOLLRDNORM);
+}
+
+static bool qc71_event_stream_empty(const struct qc71_event_reader *r)
+{
+	return smp_load_acquire(&event_head) == r->pos && !r->lost;
+}
+
+/* 'r->lock' must be held */
+static bool qc71_event_stream_fetch(struct qc71_event_reader *r, struct qc71_event_record *rec)
+{
+	for (;;) {
+		unsigned long head = smp_load_acquire(&event_head), seq, skip;
+		const struct qc71_event_slot *slot;
+
+		if (head - r->pos > EVENT_STREAM_SIZE) {
+			r->lost += head - EVENT_STREAM_SIZE - r->pos;
+			r->pos = head - EVENT_STREAM_SIZE;
+		}
+
+		if (r->lost) {
+			*rec = (struct qc71_event_record) {
+				.time_ns = ktime_get_ns(),
+				.kind    = QC71_EVENT_RECORD_OVERFLOW,
+				.value   = min_t(unsigned long, r->lost, U32_MAX),
+			};
+			r->lost = 0;
+			return true;
+		}
+
+		if (head == r->pos)
+			return false;
+
+		slot = &event_ring[r->pos % EVENT_STREAM_SIZE];
+
+		seq = smp_load_acquire(&slot->seq);
+		if (seq == r->pos + 1) {
+			*rec = slot->rec;
+			smp_rmb();
+
+			if (READ_ONCE(slot->seq) == seq) {
+				r->pos += 1;
+				return true;
+			}
+		}
+
+		/*
+		 * the producer has lapped the reader in the meantime, and is
+		 * writing (or has written) this slot; instead of waiting for it,
+		 * continue at the oldest slot it cannot be writing, and report
+		 * the skipped records as lost
+		 */
+		head = smp_load_acquire(&event_head);
+		skip = head + 1 - r->pos > EVENT_STREAM_SIZE ? head + 1 - EVENT_STREAM_SIZE - r->pos : 1;
+
+		r->lost += skip;
+		r->pos += skip;
+	}
+}
+
+/* ========================================================================== */
+
+static int qc71_event_stream_open(struct inode *inode, struct file *f)
+{
+	struct qc71_event_reader *r = kzalloc(sizeof(*r), GFP_KERNEL);
+
+	if (!r)
+		return -ENOMEM;
+
+	mutex_init(&r->lock);
+
+	/* only the events arriving from now on are delivered */
+	r->pos = smp_load_acquire(&event_head);
+
+	f->private_data = r;
+
+	return stream_open(inode, f);
+}
+
+static int qc71_event_stream_release(struct inode *inode, struct file *f)
+{
+	kfree(f->private_data);
+
+	return 0;
+}
+
+/* returns as many whole records as fit into the buffer */
+static ssize_t qc71_event_stream_read(struct file *f, char __user *buf, size_t count, loff_t *offset)
+{
+	struct qc71_event_reader *r = f->private_data;
+	struct qc71_event_record rec;
+	size_t copied = 0;
+	int err;
+
+	if (count < sizeof(rec))
+		return -EINVAL;
+
+	for (;;) {
+		err = mutex_lock_interruptible(&r->lock);
+		if (err)
+			return err;
+
+		while (copied + sizeof(rec) <= count && qc71_event_stream_fetch(r, &rec)) {
+			if (copy_to_user(buf + copied, &rec, sizeof(rec))) {
+				mutex_unlock(&r->lock);
+				return copied ? copied : -EFAULT;
+			}
+
+			copied += sizeof(rec);
+		}
+
+		mutex_unlock(&r->lock);
+
+		if (copied)
+			return copied;
+
+		if (f->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+
+		err = wait_event_interruptible(event_wq, !qc71_event_stream_empty(r));
+		if (err)
+			return err;
+	}
+}
+
+static __poll_t qc71_event_stream_poll(struct file *f, struct poll_table_struct *wait)
+{
+	struct qc71_event_reader *r = f->private_data;
+
+	poll_wait(f, &event_wq, wait);
+
+	return qc71_event_stream_empty(r) ? 0 : EPOLLIN | EPOLLRDNORM;
+}
+
+static const struct file_operations qc71_event_stream_fops = {
+	.owner   = THIS_MODULE,
+	.open    = qc71_event_stream_open,
+	.release = qc71_event_stream_release,
+	.read    = qc71_event_stream_read,
+	.poll    = qc71_event_stream_poll,
+};
+
+static struct miscdevice qc71_event_stream_dev = {
+	.minor = MISC_DYNAMIC_MINOR,
+	.name  = "qc71_events",
+	.fops  = &qc71_event_stream_fops,
+	.mode  = 0440,
+};
+
+/* ========================================================================== */
+
+int __init qc71_event_stream_setup(void)
+{
+	int err = misc_register(&qc71_event_stream_dev);
+
+	if (!err)
+		event_stream_registered = true;
+
+	return err;
+}
+
+void qc71_event_stream_cleanup(void)
+{
+	if (event_stream_registered) {
+		misc_deregister(&qc71_event_stream_dev);
+		event_stream_registered = false;
+	}
+}
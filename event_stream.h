@@ -0,0 +1,30 @@
+// SPDX-License-Identifier: GPL-2.0
+#ifndef QC71_EVENT_STREAM_H
+#define QC71_EVENT_STREAM_H
+
+#include <linux/init.h>
+#include <linux/types.h>
+
+/* ========================================================================== */
+/* the records read from /dev/qc71_events */
+
+enum qc71_event_record_kind {
+	QC71_EVENT_RECORD_WMI      = 0,
+	QC71_EVENT_RECORD_OVERFLOW = 1, /* 'value' records were lost */
+};
+
+struct qc71_event_record {
+	__u64 time_ns; /* CLOCK_MONOTONIC */
+	__u32 kind;    /* enum qc71_event_record_kind */
+	__u32 value;   /* the WMI notify value, or the number of lost records */
+	__u64 data;    /* the integer event data */
+} __packed;
+
+/* ========================================================================== */
+
+void qc71_event_stream_push(const struct qc71_event_record *rec);
+
+int  __init qc71_event_stream_setup(void);
+void        qc71_event_stream_cleanup(void);
+
+#endif /* QC71_EVENT_STREAM_H */
@@ -0,0 +1,128 @@
+// SPDX-License-Identifier: GPL-2.0
+#include "pr.h"
+
+#include <linux/errno.h>
+#include <linux/kernel.h>
+#include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/types.h>
+
+#include "ec.h"
+#include "event_table.h"
+#include "events.h"
+
+/*
+ * what the codes of the 0xd2 events mean, and who handles them; nothing here
+ * depends on WMI/ACPI, so it is linked into the KUnit suite (tests/)
+ */
+
+/* ========================================================================== */
+
+const struct qc71_wmi_event_desc qc71_wmi_event_descs[QC71_WMI_EVENT_CODE_COUNT] = {
+	[QC71_EVENT_CAPS_LOCK]            = { "caps lock" },
+	[QC71_EVENT_NUM_LOCK]             = { "num lock" },
+	[QC71_EVENT_SCROLL_LOCK]          = { "scroll lock" },
+	[QC71_EVENT_TOUCHPAD_ON]          = { "touchpad on" },
+	[QC71_EVENT_TOUCHPAD_OFF]         = { "touchpad off" },
+	/* reporting these could be left to acpi_video_handles_brightness_key_presses() */
+	[QC71_EVENT_BRIGHTNESS_UP]        = { "increase screen brightness" },
+	[QC71_EVENT_BRIGHTNESS_DOWN]      = { "decrease screen brightness" },
+	/* triggered in automatic mode when the rfkill hotkey is pressed */
+	[QC71_EVENT_RADIO_ON]             = { "radio on",  0, { DEVICE_STATUS_ADDR } },
+	[QC71_EVENT_RADIO_OFF]            = { "radio off", 0, { DEVICE_STATUS_ADDR } },
+	[QC71_EVENT_MUTE]                 = { "toggle mute" },
+	[QC71_EVENT_VOLUME_DOWN]          = { "decrease volume" },
+	[QC71_EVENT_VOLUME_UP]            = { "increase volume" },
+	[QC71_EVENT_LIGHTBAR_ON]          = { "lightbar on" },
+	[QC71_EVENT_LIGHTBAR_OFF]         = { "lightbar off" },
+	[QC71_EVENT_SUPER_KEY_LOCK_ON]    = { "enable super key lock" },
+	[QC71_EVENT_SUPER_KEY_LOCK_OFF]   = { "disable super key lock" },
+	[QC71_EVENT_AIRPLANE_MODE]        = { "toggle airplane mode" },
+	[QC71_EVENT_SUPER_KEY_LOCK]       = { "super key lock state changed",
+					      QC71_WMI_EVENT_COALESCE, { STATUS_1_ADDR } },
+	[QC71_EVENT_LIGHTBAR]             = { "lightbar state changed",
+					      QC71_WMI_EVENT_COALESCE, { STATUS_1_ADDR, LIGHTBAR_CTRL_ADDR } },
+	[QC71_EVENT_FAN_BOOST]            = { "fan boost state changed",
+					      QC71_WMI_EVENT_COALESCE, { STATUS_1_ADDR } },
+	[QC71_EVENT_AC]                   = { "AC plugged/unplugged",
+					      QC71_WMI_EVENT_COALESCE,
+					      { POWER_SOURCE_ADDR, POWER_STATUS_ADDR, BATT_STATUS_ADDR,
+						/* the firmware switches to the limits of the power source */
+						PL1_ADDR, PL2_ADDR, PL4_ADDR } },
+	[QC71_EVENT_PERF_MODE]            = { "change perf mode", 0,
+					      { CTRL_2_ADDR, CTRL_3_ADDR, CTRL_4_ADDR } },
+	[QC71_EVENT_KBD_BACKLIGHT_DOWN]   = { "keyboard backlight decrease" },
+	[QC71_EVENT_KBD_BACKLIGHT_UP]     = { "keyboard backlight increase" },
+	[QC71_EVENT_FN_LOCK]              = { "toggle Fn lock", 0, { BIOS_CTRL_1_ADDR } },
+	[QC71_EVENT_KBD_BACKLIGHT]        = { "keyboard backlight changed",
+					      QC71_WMI_EVENT_COALESCE, { CTRL_2_ADDR } },
+};
+
+/* ========================================================================== */
+
+/* protected by 'qc71_wmi_event_handlers_lock' */
+static struct hlist_head qc71_wmi_event_handlers[QC71_WMI_EVENT_CODE_COUNT];
+
+static DEFINE_MUTEX(qc71_wmi_event_handlers_lock);
+
+/* ========================================================================== */
+
+/*
+ * 'h->fn' is called from the event workqueue whenever an event with 'h->code'
+ * arrives, it must not (un)register handlers itself
+ */
+int qc71_wmi_event_register(struct qc71_wmi_event_handler *h)
+{
+	if (!h->fn)
+		return -EINVAL;
+
+	mutex_lock(&qc71_wmi_event_handlers_lock);
+	hlist_add_head(&h->node, &qc71_wmi_event_handlers[h->code]);
+	mutex_unlock(&qc71_wmi_event_handlers_lock);
+
+	return 0;
+}
+
+/* when it returns, 'h->fn' is not running, and will not be called anymore */
+void qc71_wmi_event_unregister(struct qc71_wmi_event_handler *h)
+{
+	mutex_lock(&qc71_wmi_event_handlers_lock);
+	hlist_del_init(&h->node);
+	mutex_unlock(&qc71_wmi_event_handlers_lock);
+}
+
+/*
+ * invalidates the registers the event changed, then runs the handlers of
+ * 'code'; returns 'code', or -ERANGE if it is not a valid code
+ */
+int qc71_wmi_event_dispatch_code(u64 code)
+{
+	const struct qc71_wmi_event_desc *desc;
+	struct qc71_wmi_event_handler *h;
+	size_t i;
+
+	if (code >= QC71_WMI_EVENT_CODE_COUNT) {
+		pr_warn_ratelimited("unknown code: %llu\n", (unsigned long long) code);
+		return -ERANGE;
+	}
+
+	desc = &qc71_wmi_event_descs[code];
+
+	if (!desc->name)
+		pr_warn_ratelimited("unknown code: %u\n", (unsigned int) code);
+	else
+		pr_debug("%s\n", desc->name);
+
+	/* before anything reads them */
+	for (i = 0; i < ARRAY_SIZE(desc->regs) && desc->regs[i]; i++)
+		qc71_ec_cache_invalidate(desc->regs[i]);
+
+	mutex_lock(&qc71_wmi_event_handlers_lock);
+
+	hlist_for_each_entry (h, &qc71_wmi_event_handlers[code], node)
+		h->fn(code);
+
+	mutex_unlock(&qc71_wmi_event_handlers_lock);
+
+	return code;
+}
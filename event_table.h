@@ -0,0 +1,32 @@
+// SPDX-License-Identifier: GPL-2.0
+#ifndef QC71_EVENT_TABLE_H
+#define QC71_EVENT_TABLE_H
+
+#include <linux/bits.h>
+#include <linux/types.h>
+
+#include "events.h"
+
+/* ========================================================================== */
+
+#define QC71_WMI_EVENT_CODE_COUNT 256
+
+/*
+ * the event only reports a state change, so only the last one of a burst
+ * (e.g. while the keyboard backlight key is held) needs to be handled
+ */
+#define QC71_WMI_EVENT_COALESCE BIT(0)
+
+struct qc71_wmi_event_desc {
+	const char *name;
+	unsigned int flags;
+	uint16_t regs[6]; /* registers the EC changes before sending the event */
+};
+
+extern const struct qc71_wmi_event_desc qc71_wmi_event_descs[QC71_WMI_EVENT_CODE_COUNT];
+
+/* ========================================================================== */
+
+int qc71_wmi_event_dispatch_code(u64 code);
+
+#endif /* QC71_EVENT_TABLE_H */
@@ -2,26 +2,64 @@
 #include "pr.h"
 
 #include <acpi/video.h>
-#include <dt-bindings/leds/common.h>
 #include <linux/acpi.h>
+#include <linux/atomic.h>
+#include <linux/bitmap.h>
+#include <linux/debugfs.h>
 #include <linux/init.h>
 #include <linux/input.h>
 #include <linux/input/sparse-keymap.h>
-#include <linux/leds.h>
-
+#include <linux/kfifo.h>
+#include <linux/ktime.h>
+#include <linux/mutex.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
+
+#include "ec.h"
+#include "event_stream.h"
+#include "event_table.h"
+#include "events.h"
 #include "misc.h"
 #include "pdev.h"
+#include "record.h"
 #include "wmi.h"
 
 /* ========================================================================== */
 
-#define KBD_BL_LED_SUFFIX ":" LED_FUNCTION_KBD_BACKLIGHT
+#define QC71_WMI_EVENT_QUEUE_LENGTH 64
+
+#define CREATE_TRACE_POINTS
+#include "trace.h"
 
 /* ========================================================================== */
 
-static struct {
+/* an event decoded in the notify handler */
+struct qc71_wmi_event {
+	ktime_t time;
+	u64 data;  /* the integer, if 'type' is ACPI_TYPE_INTEGER */
+	u32 value; /* the notify value */
+	u32 type;  /* the type of the ACPI object, ACPI_TYPE_ANY if there is none */
+};
+
+/* ========================================================================== */
+
+/*
+ * the firmware delivers integers and short buffers, 256 bytes of data is the
+ * most a recording keeps as well; the data of a buffer or string follows the
+ * object, and a string is terminated by a NUL byte not counted in its length
+ */
+#define QC71_WMI_EVENT_MAX_DATA_SIZE 256
+#define QC71_WMI_EVENT_SCRATCH_SIZE  (sizeof(union acpi_object) + QC71_WMI_EVENT_MAX_DATA_SIZE + 1)
+
+static struct qc71_wmi_event_guid {
 	const char *guid;
 	bool handler_installed;
+
+	/* the event data is decoded here, serialized by 'scratch_lock' */
+	struct mutex scratch_lock;
+	u8 scratch[QC71_WMI_EVENT_SCRATCH_SIZE] __aligned(8);
 } qc71_wmi_event_guids[] = {
 	{ .guid = QC71_WMI_EVENT0_GUID },
 	{ .guid = QC71_WMI_EVENT1_GUID },
@@ -65,267 +103,309 @@ static const struct key_entry qc71_wmi_hotkeys[] = {
 
 static struct input_dev *qc71_input_dev;
 
-/* ========================================================================== */
+static struct workqueue_struct *qc71_wmi_event_wq;
 
-static void toggle_fn_lock_from_event_handler(void)
-{
-	int status = qc71_fn_lock_get_state();
+/* serializes the producers, the only consumer is 'qc71_wmi_event_work' */
+static DEFINE_SPINLOCK(qc71_wmi_event_fifo_lock);
+static DEFINE_KFIFO(qc71_wmi_event_fifo, struct qc71_wmi_event, QC71_WMI_EVENT_QUEUE_LENGTH);
 
-	if (status < 0)
-		return;
+/* the per-code state of the 0xd2 events */
+static struct qc71_wmi_event_entry {
+	atomic_long_t count;
+	atomic_t pending; /* the number of queued events, if QC71_WMI_EVENT_COALESCE */
+	bool key;         /* has an entry in 'qc71_wmi_hotkeys' that is not ignored */
+} qc71_wmi_event_entries[QC71_WMI_EVENT_CODE_COUNT];
 
-	/* seemingly the returned status in the WMI event handler is not the current */
-	pr_info("setting Fn lock state from %d to %d\n", !status, status);
-	qc71_fn_lock_set_state(status);
-}
+static struct {
+	atomic_long_t received;
+	atomic_long_t failed;     /* wmi_get_event_data() failed */
+	atomic_long_t overflowed; /* did not fit into the scratch buffer, and was dropped */
+	atomic_long_t dropped;    /* the queue was full */
+	atomic_long_t coalesced;
+	atomic_long_t by_type[ACPI_TYPE_BUFFER + 1]; /* index 0 is ACPI_TYPE_ANY, i.e. no data */
+} qc71_wmi_event_stats;
 
-#if IS_ENABLED(CONFIG_LEDS_BRIGHTNESS_HW_CHANGED)
-extern struct rw_semaphore leds_list_lock;
-extern struct list_head leds_list;
+/* ========================================================================== */
 
-static void emit_keyboard_led_hw_changed(void)
+static void qc71_wmi_event_d2_handler(union acpi_object *obj)
 {
-	struct led_classdev *led;
+	int code;
 
-	if (down_read_killable(&leds_list_lock))
+	if (!obj || obj->type != ACPI_TYPE_INTEGER)
 		return;
 
-	list_for_each_entry (led, &leds_list, node) {
-		size_t name_length;
-		const char *suffix;
-
-		if (!(led->flags & LED_BRIGHT_HW_CHANGED))
-			continue;
-
-		name_length = strlen(led->name);
-
-		if (name_length < strlen(KBD_BL_LED_SUFFIX))
-			continue;
+	code = qc71_wmi_event_dispatch_code(obj->integer.value);
+	if (code < 0)
+		return;
 
-		suffix = led->name + name_length - strlen(KBD_BL_LED_SUFFIX);
+	atomic_long_inc(&qc71_wmi_event_entries[code].count);
 
-		if (strcmp(suffix, KBD_BL_LED_SUFFIX) == 0) {
-			if (mutex_lock_interruptible(&led->led_access))
-				break;
+	if (qc71_wmi_event_entries[code].key && qc71_input_dev)
+		sparse_keymap_report_event(qc71_input_dev, code, 1, true);
+}
 
-			if (led_update_brightness(led) >= 0)
-				led_classdev_notify_brightness_hw_changed(led, led->brightness);
+static void qc71_wmi_event_dispatch(u32 value, union acpi_object *obj)
+{
+	switch (value) {
+	case 0xd2:
+		qc71_wmi_event_d2_handler(obj);
+		break;
+	case 0xd1:
+	case 0xd0:
+		break;
+	}
+}
 
-			mutex_unlock(&led->led_access);
-			break;
-		}
+static void qc71_wmi_event_process(const struct qc71_wmi_event *ev)
+{
+	union acpi_object obj = { .type = ev->type }, *pobj = NULL;
+
+	if (ev->type == ACPI_TYPE_INTEGER) {
+		obj.integer.value = ev->data;
+		pobj = &obj;
+	} else if (ev->type != ACPI_TYPE_ANY) {
+		/* only the type is kept */
+		pobj = &obj;
 	}
 
-	up_read(&leds_list_lock);
+	qc71_wmi_event_dispatch(ev->value, pobj);
 }
-#endif
 
-static void qc71_wmi_event_d2_handler(union acpi_object *obj)
+static bool qc71_wmi_event_coalescable(const struct qc71_wmi_event *ev)
 {
-	bool do_report = true;
+	return ev->value == 0xd2 && ev->type == ACPI_TYPE_INTEGER &&
+	       ev->data < QC71_WMI_EVENT_CODE_COUNT &&
+	       (qc71_wmi_event_descs[ev->data].flags & QC71_WMI_EVENT_COALESCE);
+}
 
-	if (!obj || obj->type != ACPI_TYPE_INTEGER)
-		return;
+/* returns true if a later event in the queue makes this one redundant */
+static bool qc71_wmi_event_coalesced(const struct qc71_wmi_event *ev)
+{
+	if (!qc71_wmi_event_coalescable(ev))
+		return false;
 
-	switch (obj->integer.value) {
-	/* caps lock */
-	case 1:
-		pr_info("caps lock\n");
-		break;
+	if (atomic_dec_return(&qc71_wmi_event_entries[ev->data].pending) == 0)
+		return false;
 
-	/* num lock */
-	case 2:
-		pr_info("num lock\n");
-		break;
+	atomic_long_inc(&qc71_wmi_event_stats.coalesced);
 
-	/* scroll lock */
-	case 3:
-		pr_info("scroll lock\n");
-		break;
+	return true;
+}
 
-	/* touchpad on */
-	case 4:
-		pr_info("touchpad on\n");
-		break;
+static void qc71_wmi_event_work_fn(struct work_struct *work)
+{
+	struct qc71_wmi_event ev;
 
-	/* touchpad off */
-	case 5:
-		pr_info("touchpad off\n");
-		break;
+	while (kfifo_out(&qc71_wmi_event_fifo, &ev, 1)) {
+		struct qc71_event_record rec = {
+			.time_ns = ktime_to_ns(ev.time),
+			.kind    = QC71_EVENT_RECORD_WMI,
+			.value   = ev.value,
+			.data    = ev.data,
+		};
 
-	/* increase screen brightness */
-	case 20:
-		pr_info("increase screen brightness\n");
-		/* do_report = !acpi_video_handles_brightness_key_presses() */
-		break;
+		/* userspace gets every event */
+		qc71_event_stream_push(&rec);
 
-	/* decrease screen brightness */
-	case 21:
-		pr_info("decrease screen brightness\n");
-		/* do_report = !acpi_video_handles_brightness_key_presses() */
-		break;
-
-	/* radio on */
-	case 26:
-		/* triggered in automatic mode when the rfkill hotkey is pressed */
-		pr_info("radio on\n");
-		break;
+		if (qc71_wmi_event_coalesced(&ev))
+			continue;
 
-	/* radio off */
-	case 27:
-		/* triggered in automatic mode when the rfkill hotkey is pressed */
-		pr_info("radio off\n");
-		break;
+		qc71_wmi_event_process(&ev);
+	}
+}
 
-	/* mute/unmute */
-	case 53:
-		pr_info("toggle mute\n");
-		break;
+static DECLARE_WORK(qc71_wmi_event_work, qc71_wmi_event_work_fn);
 
-	/* decrease volume */
-	case 54:
-		pr_info("decrease volume\n");
-		break;
+static void qc71_wmi_event_queue(const struct qc71_wmi_event *ev)
+{
+	bool coalescable = qc71_wmi_event_coalescable(ev);
+	unsigned long flags;
+	unsigned int ok;
 
-	/* increase volume */
-	case 55:
-		pr_info("increase volume\n");
-		break;
+	spin_lock_irqsave(&qc71_wmi_event_fifo_lock, flags);
 
-	case 57:
-		pr_info("lightbar on\n");
-		break;
+	ok = kfifo_put(&qc71_wmi_event_fifo, *ev);
+	if (ok && coalescable)
+		atomic_inc(&qc71_wmi_event_entries[ev->data].pending);
 
-	case 58:
-		pr_info("lightbar off\n");
-		break;
+	spin_unlock_irqrestore(&qc71_wmi_event_fifo_lock, flags);
 
-	/* enable super key (win key) lock */
-	case 64:
-		pr_info("enable super key lock\n");
-		break;
+	if (!ok) {
+		atomic_long_inc(&qc71_wmi_event_stats.dropped);
+		pr_warn_ratelimited("event queue full, dropping event %#04x\n", (unsigned int) ev->value);
+		return;
+	}
 
-	/* decrease volume */
-	case 65:
-		pr_info("disable super key lock\n");
-		break;
+	queue_work(qc71_wmi_event_wq, &qc71_wmi_event_work);
+}
 
-	/* enable/disable airplane mode */
-	case 164:
-		pr_info("toggle airplane mode\n");
-		break;
+static void qc71_wmi_event_decode(u32 value, const union acpi_object *obj, struct qc71_wmi_event *ev)
+{
+	*ev = (struct qc71_wmi_event) {
+		.time  = ktime_get(),
+		.value = value,
+		.type  = obj ? obj->type : ACPI_TYPE_ANY,
+	};
+
+	if (obj && obj->type == ACPI_TYPE_INTEGER)
+		ev->data = obj->integer.value;
+}
 
-	/* super key (win key) lock state changed */
-	case 165:
-		pr_info("super key lock state changed\n");
-		sysfs_notify(&qc71_platform_dev->dev.kobj, NULL, "super_key_lock");
-		break;
+/* the statistics, the trace event and the recording of an event from the firmware */
+static void qc71_wmi_event_account(u32 value, const union acpi_object *obj,
+				   const struct qc71_wmi_event *ev)
+{
+	atomic_long_inc(&qc71_wmi_event_stats.received);
 
-	case 166:
-		pr_info("lightbar state changed\n");
-		break;
+	if (ev->type < ARRAY_SIZE(qc71_wmi_event_stats.by_type))
+		atomic_long_inc(&qc71_wmi_event_stats.by_type[ev->type]);
 
-	/* fan boost state changed */
-	case 167:
-		pr_info("fan boost state changed\n");
-		break;
+	trace_qc71_wmi_event(value, obj);
 
-	/* charger unplugged/plugged in */
-	case 171:
-		pr_info("AC plugged/unplugged\n");
-		break;
+	/* the data of buffer events is only available here */
+	qc71_record_wmi_event(value, obj, ev->time);
+}
 
-	/* perf mode button pressed */
-	case 176:
-		pr_info("change perf mode\n");
-		/* TODO: should it be handled here? */
-		break;
+/*
+ * runs in the ACPI notify context, so it only decodes the event into the
+ * scratch buffer of the GUID, the rest is done by the workqueue
+ */
+static void qc71_wmi_event_handler(u32 value, void *context)
+{
+	struct qc71_wmi_event_guid *g = context;
+	struct acpi_buffer response = { sizeof(g->scratch), g->scratch };
+	union acpi_object *obj;
+	struct qc71_wmi_event ev;
+	acpi_status status;
 
-	/* increase keyboard backlight */
-	case 177:
-		pr_info("keyboard backlight decrease\n");
-		/* TODO: should it be handled here? */
-		break;
+	mutex_lock(&g->scratch_lock);
 
-	/* decrease keyboard backlight */
-	case 178:
-		pr_info("keyboard backlight increase\n");
-		/* TODO: should it be handled here? */
-		break;
+	status = wmi_get_event_data(value, &response);
 
-	/* toggle Fn lock (Fn+ESC)*/
-	case 184:
-		pr_info("toggle Fn lock\n");
-		toggle_fn_lock_from_event_handler();
-		sysfs_notify(&qc71_platform_dev->dev.kobj, NULL, "fn_lock");
-		break;
+	/*
+	 * _WED has already consumed the event, evaluating it again would
+	 * return the next one (or nothing), so the event is lost
+	 */
+	if (status == AE_BUFFER_OVERFLOW) {
+		atomic_long_inc(&qc71_wmi_event_stats.overflowed);
+		pr_warn_ratelimited("WMI event %#04x does not fit into the buffer, dropping it\n",
+				    (unsigned int) value);
+		goto out;
+	}
 
-	/* keyboard backlight brightness changed */
-	case 240:
-		pr_info("keyboard backlight changed\n");
+	if (ACPI_FAILURE(status)) {
+		atomic_long_inc(&qc71_wmi_event_stats.failed);
+		pr_err_ratelimited("bad WMI event status: %#010x\n", (unsigned int) status);
+		goto out;
+	}
 
-#if IS_ENABLED(CONFIG_LEDS_BRIGHTNESS_HW_CHANGED)
-		emit_keyboard_led_hw_changed();
-#endif
-		break;
+	obj = response.length ? response.pointer : NULL;
 
-	default:
-		pr_warn("unknown code: %u\n", (unsigned int) obj->integer.value);
-		break;
-	}
+	qc71_wmi_event_decode(value, obj, &ev);
+	qc71_wmi_event_account(value, obj, &ev);
 
-	if (do_report && qc71_input_dev)
-		sparse_keymap_report_event(qc71_input_dev,
-					   obj->integer.value, 1, true);
+	qc71_wmi_event_queue(&ev);
 
+out:
+	mutex_unlock(&g->scratch_lock);
 }
 
-static void qc71_wmi_event_handler(u32 value, void *context)
+/* handle an event as if it had been received from the firmware */
+void qc71_wmi_events_inject(u32 value, union acpi_object *obj)
 {
-	struct acpi_buffer response = { ACPI_ALLOCATE_BUFFER, NULL };
-	union acpi_object *obj;
-	acpi_status status;
+	struct qc71_wmi_event ev;
 
-	pr_info("%s(value=%#04x)\n", __func__, (unsigned int) value);
-	status = wmi_get_event_data(value, &response);
+	pr_debug("%s(value=%#04x)\n", __func__, (unsigned int) value);
 
-	if (ACPI_FAILURE(status)) {
-		pr_err("bad WMI event status: %#010x\n", (unsigned int) status);
+	if (!qc71_wmi_event_wq)
 		return;
-	}
 
-	obj = response.pointer;
+	qc71_wmi_event_decode(value, obj, &ev);
+	qc71_wmi_event_account(value, obj, &ev);
+	qc71_wmi_event_queue(&ev);
+}
+
+/*
+ * what the notify handler does with the event data, without queueing the event;
+ * it is not counted, traced or recorded, as it did not come from the firmware
+ */
+int qc71_wmi_events_bench_decode(u32 value, const union acpi_object *obj)
+{
+	struct qc71_wmi_event_guid *g = &qc71_wmi_event_guids[0];
+	struct qc71_wmi_event ev;
+
+	if (!qc71_wmi_event_wq)
+		return -ENODEV;
+
+	if (obj && obj->type == ACPI_TYPE_BUFFER &&
+	    sizeof(*obj) + obj->buffer.length > sizeof(g->scratch))
+		return -E2BIG;
 
+	mutex_lock(&g->scratch_lock);
+
+	/* stands in for wmi_get_event_data() filling the scratch buffer */
 	if (obj) {
-		pr_info("obj->type = %d\n", (int) obj->type);
-		if (obj->type == ACPI_TYPE_INTEGER) {
-			pr_info("int = %u\n", (unsigned int) obj->integer.value);
-		} else if (obj->type == ACPI_TYPE_STRING) {
-			pr_info("string = '%s'\n", obj->string.pointer);
-		} else if (obj->type == ACPI_TYPE_BUFFER) {
-			uint32_t i;
-
-			for (i = 0; i < obj->buffer.length; i++)
-				pr_info("buf[%u] = %#04x\n",
-					(unsigned int) i,
-					(unsigned int) obj->buffer.pointer[i]);
+		union acpi_object *copy = (union acpi_object *) g->scratch;
+
+		*copy = *obj;
+
+		if (obj->type == ACPI_TYPE_BUFFER) {
+			copy->buffer.pointer = g->scratch + sizeof(*copy);
+			memcpy(copy->buffer.pointer, obj->buffer.pointer, obj->buffer.length);
 		}
+
+		obj = copy;
 	}
 
-	switch (value) {
-	case 0xd2:
-		qc71_wmi_event_d2_handler(obj);
-		break;
-	case 0xd1:
-	case 0xd0:
-		break;
+	qc71_wmi_event_decode(value, obj, &ev);
+
+	mutex_unlock(&g->scratch_lock);
+
+	return 0;
+}
+
+/* ========================================================================== */
+
+static int qc71_wmi_events_stats_show(struct seq_file *m, void *v)
+{
+	static const char * const type_names[] = {
+		[ACPI_TYPE_ANY]     = "none",
+		[ACPI_TYPE_INTEGER] = "integer",
+		[ACPI_TYPE_STRING]  = "string",
+		[ACPI_TYPE_BUFFER]  = "buffer",
+	};
+	size_t i;
+
+	seq_printf(m, "received: %ld\n", atomic_long_read(&qc71_wmi_event_stats.received));
+	seq_printf(m, "failed: %ld\n", atomic_long_read(&qc71_wmi_event_stats.failed));
+	seq_printf(m, "overflowed: %ld\n", atomic_long_read(&qc71_wmi_event_stats.overflowed));
+	seq_printf(m, "dropped: %ld\n", atomic_long_read(&qc71_wmi_event_stats.dropped));
+	seq_printf(m, "coalesced: %ld\n", atomic_long_read(&qc71_wmi_event_stats.coalesced));
+
+	for (i = 0; i < ARRAY_SIZE(type_names); i++)
+		seq_printf(m, "type_%s: %ld\n", type_names[i],
+			   atomic_long_read(&qc71_wmi_event_stats.by_type[i]));
+
+	for (i = 0; i < ARRAY_SIZE(qc71_wmi_event_entries); i++) {
+		long count = atomic_long_read(&qc71_wmi_event_entries[i].count);
+
+		if (count)
+			seq_printf(m, "code_%zu: %ld (%s)\n", i, count,
+				   qc71_wmi_event_descs[i].name ?: "unknown");
 	}
 
-	kfree(obj);
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(qc71_wmi_events_stats);
+
+void __init qc71_wmi_events_debugfs_setup(struct dentry *parent)
+{
+	debugfs_create_file("events", 0400, parent, NULL, &qc71_wmi_events_stats_fops);
 }
 
 static int __init setup_input_dev(void)
 {
+	const struct key_entry *ke;
 	int err = 0;
 
 	qc71_input_dev = input_allocate_device();
@@ -341,6 +421,11 @@ static int __init setup_input_dev(void)
 	if (err)
 		goto err_free_device;
 
+	for (ke = qc71_wmi_hotkeys; ke->type != KE_END; ke++) {
+		if (ke->type != KE_IGNORE && ke->code < QC71_WMI_EVENT_CODE_COUNT)
+			qc71_wmi_event_entries[ke->code].key = true;
+	}
+
 	err = qc71_rfkill_get_wifi_state();
 	if (err >= 0)
 		input_report_switch(qc71_input_dev, SW_RFKILL_ALL, err);
@@ -366,12 +451,20 @@ int __init qc71_wmi_events_setup(void)
 {
 	int err = 0, i;
 
+	for (i = 0; i < ARRAY_SIZE(qc71_wmi_event_guids); i++)
+		mutex_init(&qc71_wmi_event_guids[i].scratch_lock);
+
+	qc71_wmi_event_wq = alloc_ordered_workqueue(KBUILD_MODNAME "_events", WQ_HIGHPRI);
+	if (!qc71_wmi_event_wq)
+		return -ENOMEM;
+
 	(void) setup_input_dev();
 
 	for (i = 0; i < ARRAY_SIZE(qc71_wmi_event_guids); i++) {
 		const char *guid = qc71_wmi_event_guids[i].guid;
 		acpi_status status =
-			wmi_install_notify_handler(guid, qc71_wmi_event_handler, NULL);
+			wmi_install_notify_handler(guid, qc71_wmi_event_handler,
+						   &qc71_wmi_event_guids[i]);
 
 		if (ACPI_FAILURE(status)) {
 			pr_warn("could not install WMI notify handler for '%s': [%#010lx] %s\n",
@@ -395,6 +488,12 @@ void qc71_wmi_events_cleanup(void)
 		}
 	}
 
+	/* waits for the queued events */
+	if (qc71_wmi_event_wq) {
+		destroy_workqueue(qc71_wmi_event_wq);
+		qc71_wmi_event_wq = NULL;
+	}
+
 	if (qc71_input_dev)
 		input_unregister_device(qc71_input_dev);
 }
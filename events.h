@@ -2,25 +2,63 @@
 #ifndef QC71_WMI_EVENTS_H
 #define QC71_WMI_EVENTS_H
 
-#if IS_ENABLED(CONFIG_LEDS_CLASS)
-
 #include <linux/init.h>
+#include <linux/list.h>
+#include <linux/types.h>
+
+/* ========================================================================== */
+
+/* the integer data of the 0xd2 WMI events */
+enum qc71_wmi_event_code {
+	QC71_EVENT_CAPS_LOCK           = 1,
+	QC71_EVENT_NUM_LOCK            = 2,
+	QC71_EVENT_SCROLL_LOCK         = 3,
+	QC71_EVENT_TOUCHPAD_ON         = 4,
+	QC71_EVENT_TOUCHPAD_OFF        = 5,
+	QC71_EVENT_BRIGHTNESS_UP       = 20,
+	QC71_EVENT_BRIGHTNESS_DOWN     = 21,
+	QC71_EVENT_RADIO_ON            = 26,
+	QC71_EVENT_RADIO_OFF           = 27,
+	QC71_EVENT_MUTE                = 53,
+	QC71_EVENT_VOLUME_DOWN         = 54,
+	QC71_EVENT_VOLUME_UP           = 55,
+	QC71_EVENT_LIGHTBAR_ON         = 57,
+	QC71_EVENT_LIGHTBAR_OFF        = 58,
+	QC71_EVENT_SUPER_KEY_LOCK_ON   = 64,
+	QC71_EVENT_SUPER_KEY_LOCK_OFF  = 65,
+	QC71_EVENT_AIRPLANE_MODE       = 164,
+	QC71_EVENT_SUPER_KEY_LOCK      = 165,
+	QC71_EVENT_LIGHTBAR            = 166,
+	QC71_EVENT_FAN_BOOST           = 167,
+	QC71_EVENT_AC                  = 171,
+	QC71_EVENT_PERF_MODE           = 176,
+	QC71_EVENT_KBD_BACKLIGHT_DOWN  = 177,
+	QC71_EVENT_KBD_BACKLIGHT_UP    = 178,
+	QC71_EVENT_FN_LOCK             = 184,
+	QC71_EVENT_KBD_BACKLIGHT       = 240,
+};
+
+struct qc71_wmi_event_handler {
+	struct hlist_node node;
+	u8 code;
+	void (*fn)(unsigned int code);
+};
+
+/* ========================================================================== */
+
+union acpi_object;
 
 int  __init qc71_wmi_events_setup(void);
 void        qc71_wmi_events_cleanup(void);
 
-#else
-
-static inline int qc71_wmi_events_setup(void)
-{
-	return 0;
-}
+void qc71_wmi_events_inject(u32 value, union acpi_object *obj);
 
-static inline void qc71_wmi_events_cleanup(void)
-{
+int qc71_wmi_event_register(struct qc71_wmi_event_handler *h);
+void qc71_wmi_event_unregister(struct qc71_wmi_event_handler *h);
 
-}
+struct dentry;
 
-#endif
+int qc71_wmi_events_bench_decode(u32 value, const union acpi_object *obj);
+void __init qc71_wmi_events_debugfs_setup(struct dentry *parent);
 
 #endif /* QC71_WMI_EVENTS_H */
@@ -5,7 +5,6 @@
 
 /* ========================================================================== */
 
-#define FAN_MAX_PWM        200
 #define FAN_CTRL_MAX_LEVEL   7
 #define FAN_CTRL_LEVEL(level) (128 + (level))
 
@@ -122,8 +122,18 @@ static int __init check_features_ec(void)
 		qc71_features.super_key_lock = !!(err & SUPPORT_1_SUPER_KEY_LOCK);
 		qc71_features.lightbar       = !!(err & SUPPORT_1_LIGHTBAR);
 		qc71_features.fan_boost      = !!(err & SUPPORT_1_FAN_BOOST);
+		qc71_features.overclock      = !!(err & SUPPORT_1_OVERCLOCK);
 	} else {
 		pr_warn("failed to query support_1 byte: %d\n", err);
+		return err;
+	}
+
+	err = ec_read_byte(SUPPORT_2_ADDR);
+
+	if (err >= 0) {
+		qc71_features.silent_mode = !!(err & SUPPORT_2_SILENT_MODE);
+	} else {
+		pr_warn("failed to query support_2 byte: %d\n", err);
 	}
 
 	return err;
@@ -134,6 +144,14 @@ static int __init check_features_bios(void)
 	const char *bios_version_str;
 	int bios_version;
 
+	/* there is no firmware to ask, assume every feature is present */
+	if (!qc71_ec_backend_is_wmi()) {
+		qc71_features.fn_lock           = true;
+		qc71_features.batt_charge_limit = true;
+		qc71_features.fan_extras        = true;
+		return 0;
+	}
+
 	if (!dmi_check_system(qc71_dmi_table)) {
 		pr_warn("no DMI match\n");
 		return -ENODEV;
@@ -12,6 +12,8 @@ struct qc71_features_struct {
 	bool fn_lock           : 1;
 	bool batt_charge_limit : 1;
 	bool fan_extras        : 1; /* duty cycle reduction, always on mode */
+	bool silent_mode       : 1;
+	bool overclock         : 1;
 };
 
 /* ========================================================================== */
@@ -0,0 +1,234 @@
+// SPDX-License-Identifier: GPL-2.0
+#include "pr.h"
+
+#include <linux/err.h>
+#include <linux/init.h>
+#include <linux/jiffies.h>
+#include <linux/kernel.h>
+#include <linux/minmax.h>
+#include <linux/moduleparam.h>
+#include <linux/thermal.h>
+#include <linux/types.h>
+#include <linux/workqueue.h>
+
+#include "boost.h"
+#include "fan.h"
+#include "governor.h"
+#include "power_limit.h"
+#include "trace.h"
+
+/* ========================================================================== */
+
+#define GOVERNOR_HYSTERESIS_C  3
+#define GOVERNOR_MAX_STEP_W    5
+
+/* ========================================================================== */
+
+static bool governor;
+module_param(governor, bool, 0444);
+MODULE_PARM_DESC(governor, "adjust PL1/PL2 to keep the temperature below governor_target_temp (default=false)");
+
+static unsigned int governor_target_temp = 85;
+module_param(governor_target_temp, uint, 0644);
+MODULE_PARM_DESC(governor_target_temp, "temperature in degrees Celsius the governor keeps the machine below (default=85)");
+
+static unsigned int governor_interval_ms = 1000;
+module_param(governor_interval_ms, uint, 0644);
+MODULE_PARM_DESC(governor_interval_ms, "time between two samples of the governor (default=1000)");
+
+static unsigned int governor_pl1_min_w = 10;
+module_param(governor_pl1_min_w, uint, 0644);
+MODULE_PARM_DESC(governor_pl1_min_w, "lowest PL1 the governor may set in watts (default=10)");
+
+static unsigned int governor_pl1_max_w;
+module_param(governor_pl1_max_w, uint, 0644);
+MODULE_PARM_DESC(governor_pl1_max_w, "highest PL1 the governor may set in watts, 0 means the peak limit (default=0)");
+
+/* ========================================================================== */
+
+static void qc71_governor_work_fn(struct work_struct *work);
+
+static DECLARE_DELAYED_WORK(qc71_governor_work, qc71_governor_work_fn);
+static bool qc71_governor_running;
+
+/* the limits set by someone else, restored at unload, and the PL2 - PL1 it keeps */
+static int qc71_governor_saved_pl1, qc71_governor_saved_pl2;
+static int qc71_governor_headroom;
+
+/* the limits the governor last wrote, it owns the limits while they are in place */
+static int qc71_governor_written_pl1, qc71_governor_written_pl2;
+
+/* the previous sample, only accessed from the work */
+static int qc71_governor_prev_temp, qc71_governor_prev_rpm;
+
+/* ========================================================================== */
+
+/* in degrees Celsius */
+static int qc71_governor_pkg_temp(void)
+{
+	struct thermal_zone_device *tz = thermal_zone_get_zone_by_name("x86_pkg_temp");
+	int temp, err;
+
+	if (IS_ERR(tz))
+		return PTR_ERR(tz);
+
+	err = thermal_zone_get_temp(tz, &temp);
+	if (err)
+		return err;
+
+	return temp / 1000;
+}
+
+/* the limits were changed by someone else (or the module was loaded), start over from them */
+static void qc71_governor_baseline(int pl1, int pl2)
+{
+	qc71_governor_saved_pl1 = qc71_governor_written_pl1 = pl1;
+	qc71_governor_saved_pl2 = qc71_governor_written_pl2 = pl2;
+	qc71_governor_headroom = max(pl2 - pl1, 0);
+}
+
+/* returns how many watts PL1 should change by */
+static int qc71_governor_step(int temp, int rpm)
+{
+	int error = (int) READ_ONCE(governor_target_temp) - temp;
+
+	/* too hot, back off in proportion to the overshoot */
+	if (error < 0)
+		return -clamp(-error, 1, GOVERNOR_MAX_STEP_W);
+
+	/*
+	 * there is room below the target, but only creep up if the temperature
+	 * is not rising and the fans are not ramping up, otherwise the firmware
+	 * is already reacting to an increasing load
+	 */
+	if (error > GOVERNOR_HYSTERESIS_C &&
+	    temp <= qc71_governor_prev_temp && rpm <= qc71_governor_prev_rpm)
+		return 1;
+
+	return 0;
+}
+
+static void qc71_governor_work_fn(struct work_struct *work)
+{
+	int expected[QC71_POWER_LIMIT_COUNT] = { -1, -1, -1 };
+	int limits[QC71_POWER_LIMIT_COUNT] = { -1, -1, -1 };
+	int temp_fan, temp_pkg, temp, rpm, pl1, pl2, pl4, new_pl1, new_pl2;
+	int pl1_min, pl1_max;
+
+	/* PL2 belongs to the boost until it restores it */
+	if (qc71_boost_running())
+		goto out;
+
+	temp_fan = qc71_fan_get_temp(0);
+	temp_pkg = qc71_governor_pkg_temp();
+	rpm = qc71_fan_get_rpm(0);
+
+	temp = max(temp_fan, temp_pkg);
+	if (temp < 0)
+		goto out;
+
+	if (rpm < 0)
+		rpm = 0;
+
+	pl1 = qc71_power_limit_get(QC71_POWER_LIMIT_PL1);
+	pl2 = qc71_power_limit_get(QC71_POWER_LIMIT_PL2);
+	pl4 = qc71_power_limit_get(QC71_POWER_LIMIT_PL4);
+	if (pl1 < 0 || pl2 < 0 || pl4 < 0)
+		goto out;
+
+	/* e.g. written by the user, or by the firmware on an AC event */
+	if (pl1 != qc71_governor_written_pl1 || pl2 != qc71_governor_written_pl2) {
+		qc71_governor_baseline(pl1, pl2);
+		goto out_sample;
+	}
+
+	pl1_max = READ_ONCE(governor_pl1_max_w) ?: qc71_power_limit_max();
+	pl1_max = min(pl1_max, pl4);
+	pl1_min = clamp_t(int, READ_ONCE(governor_pl1_min_w), QC71_POWER_LIMIT_MIN_W, pl1_max);
+
+	new_pl1 = clamp(pl1 + qc71_governor_step(temp, rpm), pl1_min, pl1_max);
+
+	/* keep the short term headroom of the current baseline */
+	new_pl2 = new_pl1 + qc71_governor_headroom;
+	new_pl2 = clamp(new_pl2, new_pl1, pl4);
+
+	trace_qc71_governor(temp_fan, temp_pkg, rpm, pl1, pl2, new_pl1, new_pl2);
+
+	if (new_pl1 != pl1 || new_pl2 != pl2) {
+		int err;
+
+		expected[QC71_POWER_LIMIT_PL1] = pl1;
+		expected[QC71_POWER_LIMIT_PL2] = pl2;
+		limits[QC71_POWER_LIMIT_PL1] = new_pl1;
+		limits[QC71_POWER_LIMIT_PL2] = new_pl2;
+
+		/* -EAGAIN: changed since they were read, the next sample starts over */
+		err = qc71_power_limit_replace(expected, limits);
+		if (!err) {
+			qc71_governor_written_pl1 = new_pl1;
+			qc71_governor_written_pl2 = new_pl2;
+		} else if (err != -EAGAIN) {
+			pr_warn_ratelimited("governor failed to set power limits: %d\n", err);
+		}
+	}
+
+out_sample:
+	qc71_governor_prev_temp = temp;
+	qc71_governor_prev_rpm = rpm;
+
+out:
+	queue_delayed_work(system_freezable_power_efficient_wq, &qc71_governor_work,
+			   msecs_to_jiffies(max(READ_ONCE(governor_interval_ms), 100U)));
+}
+
+/* ========================================================================== */
+
+int __init qc71_governor_setup(void)
+{
+	int pl1, pl2;
+
+	if (!governor)
+		return 0;
+
+	/* the power_limit submodule failed to initialize */
+	if (!qc71_power_limit_max())
+		return -ENODEV;
+
+	pl1 = qc71_power_limit_get(QC71_POWER_LIMIT_PL1);
+	if (pl1 < 0)
+		return pl1;
+
+	pl2 = qc71_power_limit_get(QC71_POWER_LIMIT_PL2);
+	if (pl2 < 0)
+		return pl2;
+
+	qc71_governor_baseline(pl1, pl2);
+
+	qc71_governor_prev_temp = INT_MAX;
+	qc71_governor_prev_rpm = INT_MAX;
+
+	queue_delayed_work(system_freezable_power_efficient_wq, &qc71_governor_work, 0);
+	qc71_governor_running = true;
+
+	return 0;
+}
+
+void qc71_governor_cleanup(void)
+{
+	int expected[QC71_POWER_LIMIT_COUNT] = { -1, -1, -1 };
+	int limits[QC71_POWER_LIMIT_COUNT] = { -1, -1, -1 };
+
+	if (!qc71_governor_running)
+		return;
+
+	cancel_delayed_work_sync(&qc71_governor_work);
+	qc71_governor_running = false;
+
+	/* unless someone else has set the limits since the governor last did */
+	expected[QC71_POWER_LIMIT_PL1] = qc71_governor_written_pl1;
+	expected[QC71_POWER_LIMIT_PL2] = qc71_governor_written_pl2;
+	limits[QC71_POWER_LIMIT_PL1] = qc71_governor_saved_pl1;
+	limits[QC71_POWER_LIMIT_PL2] = qc71_governor_saved_pl2;
+
+	(void) qc71_power_limit_replace(expected, limits);
+}
@@ -0,0 +1,26 @@
+// SPDX-License-Identifier: GPL-2.0
+#ifndef QC71_GOVERNOR_H
+#define QC71_GOVERNOR_H
+
+#if IS_ENABLED(CONFIG_HWMON)
+
+#include <linux/init.h>
+
+int  __init qc71_governor_setup(void);
+void        qc71_governor_cleanup(void);
+
+#else
+
+static inline int qc71_governor_setup(void)
+{
+	return 0;
+}
+
+static inline void qc71_governor_cleanup(void)
+{
+
+}
+
+#endif
+
+#endif /* QC71_GOVERNOR_H */
@@ -0,0 +1,177 @@
+// SPDX-License-Identifier: GPL-2.0
+#include "pr.h"
+
+#include <dt-bindings/leds/common.h>
+#include <linux/bitfield.h>
+#include <linux/init.h>
+#include <linux/leds.h>
+#include <linux/moduleparam.h>
+#include <linux/rwsem.h>
+#include <linux/string.h>
+#include <linux/types.h>
+
+#include "ec.h"
+#include "events.h"
+#include "led_kbd.h"
+#include "pdev.h"
+
+/* ========================================================================== */
+
+#define KBD_BL_LED_SUFFIX ":" LED_FUNCTION_KBD_BACKLIGHT
+
+/* ========================================================================== */
+
+static bool nokbdled;
+module_param(nokbdled, bool, 0444);
+MODULE_PARM_DESC(nokbdled, "do not register the keyboard backlight to the leds subsystem (default=false)");
+
+static bool kbd_led_registered;
+
+/* ========================================================================== */
+
+/* CTRL_2 is cached, and it is invalidated by the keyboard backlight event */
+static int qc71_kbd_led_get(void)
+{
+	int status = ec_read_byte(CTRL_2_ADDR);
+
+	if (status < 0)
+		return status;
+
+	if (status & CTRL_2_SINGLE_COLOR_KBD_BL_OFF)
+		return 0;
+
+	return FIELD_GET(CTRL_2_SINGLE_COLOR_KBD_BRIGHTNESS, status);
+}
+
+static enum led_brightness qc71_kbd_led_get_brightness(struct led_classdev *led_cdev)
+{
+	int brightness = qc71_kbd_led_get();
+
+	if (brightness < 0)
+		return led_cdev->brightness;
+
+	return brightness;
+}
+
+static int qc71_kbd_led_set_brightness(struct led_classdev *led_cdev,
+				       enum led_brightness value)
+{
+	struct qc71_ec_txn_op op;
+
+	if (value)
+		op = QC71_EC_TXN_UPDATE_OP(CTRL_2_ADDR,
+					   CTRL_2_SINGLE_COLOR_KBD_BL_OFF | CTRL_2_SINGLE_COLOR_KBD_BRIGHTNESS,
+					   FIELD_PREP(CTRL_2_SINGLE_COLOR_KBD_BRIGHTNESS, value));
+	else
+		op = QC71_EC_TXN_UPDATE_OP(CTRL_2_ADDR, CTRL_2_SINGLE_COLOR_KBD_BL_OFF,
+					   CTRL_2_SINGLE_COLOR_KBD_BL_OFF);
+
+	return qc71_ec_txn_execute(&op, 1);
+}
+
+static struct led_classdev qc71_kbd_led = {
+	.name                    = KBUILD_MODNAME "::" LED_FUNCTION_KBD_BACKLIGHT,
+	.max_brightness          = FIELD_MAX(CTRL_2_SINGLE_COLOR_KBD_BRIGHTNESS),
+	.brightness_get          = qc71_kbd_led_get_brightness,
+	.brightness_set_blocking = qc71_kbd_led_set_brightness,
+	.flags                   = LED_BRIGHT_HW_CHANGED,
+};
+
+/* ========================================================================== */
+
+#if IS_ENABLED(CONFIG_LEDS_BRIGHTNESS_HW_CHANGED)
+extern struct rw_semaphore leds_list_lock;
+extern struct list_head leds_list;
+
+/* for keyboards whose backlight is driven by another driver */
+static void emit_keyboard_led_hw_changed(void)
+{
+	struct led_classdev *led;
+
+	if (down_read_killable(&leds_list_lock))
+		return;
+
+	list_for_each_entry (led, &leds_list, node) {
+		size_t name_length;
+		const char *suffix;
+
+		if (!(led->flags & LED_BRIGHT_HW_CHANGED))
+			continue;
+
+		name_length = strlen(led->name);
+
+		if (name_length < strlen(KBD_BL_LED_SUFFIX))
+			continue;
+
+		suffix = led->name + name_length - strlen(KBD_BL_LED_SUFFIX);
+
+		if (strcmp(suffix, KBD_BL_LED_SUFFIX) == 0) {
+			if (mutex_lock_interruptible(&led->led_access))
+				break;
+
+			if (led_update_brightness(led) >= 0)
+				led_classdev_notify_brightness_hw_changed(led, led->brightness);
+
+			mutex_unlock(&led->led_access);
+			break;
+		}
+	}
+
+	up_read(&leds_list_lock);
+}
+#else
+static inline void emit_keyboard_led_hw_changed(void)
+{
+
+}
+#endif
+
+/* event handlers */
+
+static void qc71_kbd_led_event(unsigned int code)
+{
+	int brightness;
+
+	if (!kbd_led_registered) {
+		emit_keyboard_led_hw_changed();
+		return;
+	}
+
+	brightness = qc71_kbd_led_get();
+	if (brightness >= 0)
+		led_classdev_notify_brightness_hw_changed(&qc71_kbd_led, brightness);
+}
+
+static struct qc71_wmi_event_handler qc71_kbd_led_event_handler = {
+	.code = QC71_EVENT_KBD_BACKLIGHT,
+	.fn   = qc71_kbd_led_event,
+};
+
+/* ========================================================================== */
+
+int __init qc71_led_kbd_setup(void)
+{
+	int status;
+
+	status = ec_read_byte(CTRL_2_ADDR);
+
+	if (!nokbdled && status >= 0 && (status & CTRL_2_SINGLE_COLOR_KEYBOARD)) {
+		status = led_classdev_register(&qc71_platform_dev->dev, &qc71_kbd_led);
+		if (status)
+			pr_warn("failed to register keyboard backlight: %d\n", status);
+		else
+			kbd_led_registered = true;
+	}
+
+	return qc71_wmi_event_register(&qc71_kbd_led_event_handler);
+}
+
+void qc71_led_kbd_cleanup(void)
+{
+	qc71_wmi_event_unregister(&qc71_kbd_led_event_handler);
+
+	if (kbd_led_registered) {
+		led_classdev_unregister(&qc71_kbd_led);
+		kbd_led_registered = false;
+	}
+}
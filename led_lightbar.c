@@ -1,14 +1,27 @@
 // SPDX-License-Identifier: GPL-2.0
 #include "pr.h"
 
+#include <linux/atomic.h>
+#include <linux/bug.h>
 #include <linux/init.h>
-/* #include <linux/led-class-multicolor.h> */
+#include <linux/ktime.h>
+#include <linux/led-class-multicolor.h>
 #include <linux/leds.h>
+#include <linux/math64.h>
+#include <linux/minmax.h>
 #include <linux/moduleparam.h>
+#include <linux/mutex.h>
+#include <linux/notifier.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/suspend.h>
 #include <linux/types.h>
+#include <linux/workqueue.h>
 
 #include "util.h"
+#include "codec.h"
 #include "ec.h"
+#include "events.h"
 #include "features.h"
 #include "led_lightbar.h"
 #include "pdev.h"
@@ -17,75 +30,12 @@
 
 #if IS_ENABLED(CONFIG_LEDS_CLASS)
 
-enum qc71_lightbar_color {
-	LIGHTBAR_RED         = 0,
-	LIGHTBAR_GREEN       = 1,
-	LIGHTBAR_BLUE        = 2,
-	LIGHTBAR_COLOR_COUNT
-};
-
 static const uint16_t lightbar_color_addrs[LIGHTBAR_COLOR_COUNT] = {
 	[LIGHTBAR_RED]   = LIGHTBAR_RED_ADDR,
 	[LIGHTBAR_GREEN] = LIGHTBAR_GREEN_ADDR,
 	[LIGHTBAR_BLUE]  = LIGHTBAR_BLUE_ADDR,
 };
 
-static const uint8_t lightbar_colors[LIGHTBAR_COLOR_COUNT] = {
-	LIGHTBAR_RED,
-	LIGHTBAR_GREEN,
-	LIGHTBAR_BLUE,
-};
-
-/* f(x) = 4x */
-static const uint8_t lightbar_color_values[LIGHTBAR_COLOR_COUNT][10] = {
-	[LIGHTBAR_RED]   = {0, 4, 8, 12, 16, 20, 24, 28, 32, 36},
-	[LIGHTBAR_GREEN] = {0, 4, 8, 12, 16, 20, 24, 28, 32, 36},
-	[LIGHTBAR_BLUE]  = {0, 4, 8, 12, 16, 20, 24, 28, 32, 36},
-};
-
-/* inverse of 'lightbar_color_values' */
-static const uint8_t lightbar_pwm_to_level[LIGHTBAR_COLOR_COUNT][256] = {
-	[LIGHTBAR_RED] = {
-		 [0] = 0,
-		 [4] = 1,
-		 [8] = 2,
-		[12] = 3,
-		[16] = 4,
-		[20] = 5,
-		[24] = 6,
-		[28] = 7,
-		[32] = 8,
-		[36] = 9,
-	},
-
-	[LIGHTBAR_GREEN] = {
-		 [0] = 0,
-		 [4] = 1,
-		 [8] = 2,
-		[12] = 3,
-		[16] = 4,
-		[20] = 5,
-		[24] = 6,
-		[28] = 7,
-		[32] = 8,
-		[36] = 9,
-	},
-
-	[LIGHTBAR_BLUE] = {
-		 [0] = 0,
-		 [4] = 1,
-		 [8] = 2,
-		[12] = 3,
-		[16] = 4,
-		[20] = 5,
-		[24] = 6,
-		[28] = 7,
-		[32] = 8,
-		[36] = 9,
-	},
-};
-
-
 /* ========================================================================== */
 
 static bool nolightbar;
@@ -94,6 +44,14 @@ MODULE_PARM_DESC(nolightbar, "do not register the lightbar to the leds subsystem
 
 static bool lightbar_led_registered;
 
+/* protects the following variables, and serializes the color changes */
+static DEFINE_MUTEX(lightbar_lock);
+static uint8_t lightbar_shadow[LIGHTBAR_COLOR_COUNT]; /* the values last written (or queued) to the EC */
+static bool lightbar_shadow_valid;
+
+/* set by the EC write queue if a color change could not be carried out */
+static atomic_t lightbar_shadow_stale = ATOMIC_INIT(0);
+
 /* ========================================================================== */
 
 static inline int qc71_lightbar_get_status(void)
@@ -101,77 +59,511 @@ static inline int qc71_lightbar_get_status(void)
 	return ec_read_byte(LIGHTBAR_CTRL_ADDR);
 }
 
-static inline int qc71_lightbar_write_ctrl(uint8_t ctrl)
+/* ========================================================================== */
+
+static inline struct qc71_ec_txn_op qc71_lightbar_switch_op(uint8_t mask, bool on)
 {
-	return ec_write_byte(LIGHTBAR_CTRL_ADDR, ctrl);
+	return QC71_EC_TXN_UPDATE_OP(LIGHTBAR_CTRL_ADDR, mask, on ? 0 : mask);
 }
 
-/* ========================================================================== */
-
 static int qc71_lightbar_switch(uint8_t mask, bool on)
 {
-	int status;
+	struct qc71_ec_txn_op op = qc71_lightbar_switch_op(mask, on);
 
 	if (mask != LIGHTBAR_CTRL_S0_OFF && mask != LIGHTBAR_CTRL_S3_OFF)
 		return -EINVAL;
 
-	status = qc71_lightbar_get_status();
+	return qc71_ec_txn_execute(&op, 1);
+}
 
-	if (status < 0)
-		return status;
+/* fills 'ops' with the LIGHTBAR_COLOR_OPS writes setting 'color' given in the format of the 'color' attribute */
+int qc71_lightbar_color_ops(unsigned int color, struct qc71_ec_txn_op *ops)
+{
+	uint8_t rgb[LIGHTBAR_COLOR_COUNT];
+	size_t i;
+	int err;
 
-	return qc71_lightbar_write_ctrl(SET_BIT(status, mask, !on));
+	BUILD_BUG_ON(LIGHTBAR_COLOR_OPS != LIGHTBAR_COLOR_COUNT);
+
+	err = qc71_lightbar_color_to_rgb(color, rgb);
+	if (err)
+		return err;
+
+	for (i = 0; i < LIGHTBAR_COLOR_COUNT; i++)
+		ops[i] = QC71_EC_TXN_WRITE_OP(lightbar_color_addrs[i], rgb[i]);
+
+	return 0;
 }
 
-static int qc71_lightbar_set_color_level(uint8_t color, uint8_t level)
+/* the color has been changed without going through this file */
+void qc71_lightbar_color_changed(void)
 {
-	if (color >= ARRAY_SIZE(lightbar_color_addrs))
-		return -EINVAL;
+	mutex_lock(&lightbar_lock);
+	lightbar_shadow_valid = false;
+	mutex_unlock(&lightbar_lock);
+}
 
-	if (level >= ARRAY_SIZE(lightbar_color_values[color]))
-		return -EINVAL;
+/* called by the queue worker, which might be waited for with 'lightbar_lock' held */
+static void qc71_lightbar_queue_failed(void)
+{
+	atomic_set(&lightbar_shadow_stale, 1);
+}
 
-	return ec_write_byte(lightbar_color_addrs[color], lightbar_color_values[color][level]);
+/* 'lightbar_lock' must be held */
+static void qc71_lightbar_shadow_check(void)
+{
+	/* a failed color change might have written some of the channels */
+	if (atomic_xchg(&lightbar_shadow_stale, 0))
+		lightbar_shadow_valid = false;
 }
 
-static int qc71_lightbar_get_color_level(uint8_t color)
+/* 'lightbar_lock' must be held */
+static int qc71_lightbar_shadow_fill(void)
+{
+	uint8_t values[LIGHTBAR_COLOR_COUNT];
+	size_t i;
+
+	qc71_lightbar_shadow_check();
+
+	if (lightbar_shadow_valid)
+		return 0;
+
+	for (i = 0; i < ARRAY_SIZE(values); i++) {
+		int err = ec_read_byte(lightbar_color_addrs[i]);
+
+		if (err < 0)
+			return err;
+
+		values[i] = err;
+	}
+
+	memcpy(lightbar_shadow, values, sizeof(lightbar_shadow));
+	lightbar_shadow_valid = true;
+
+	return 0;
+}
+
+static int qc71_lightbar_get_rgb(uint8_t rgb[LIGHTBAR_COLOR_COUNT])
 {
 	int err;
 
-	if (color >= ARRAY_SIZE(lightbar_color_addrs))
-		return -EINVAL;
+	mutex_lock(&lightbar_lock);
 
-	err = ec_read_byte(lightbar_color_addrs[color]);
-	if (err < 0)
-		return err;
+	err = qc71_lightbar_shadow_fill();
+	if (!err)
+		memcpy(rgb, lightbar_shadow, sizeof(lightbar_shadow));
+
+	mutex_unlock(&lightbar_lock);
 
-	return lightbar_pwm_to_level[color][err];
+	return err;
+}
+
+/*
+ * queues the writes of the channels that differ from the shadow copy (and the
+ * switch if 'turn_on') as a single transaction; readers see the queued values,
+ * so there is no need to wait for the writes
+ */
+static int qc71_lightbar_set_rgb(const uint8_t rgb[LIGHTBAR_COLOR_COUNT], bool turn_on)
+{
+	struct qc71_ec_txn_op ops[1 + LIGHTBAR_COLOR_COUNT];
+	size_t i, n = 0;
+	int err;
+
+	for (i = 0; i < LIGHTBAR_COLOR_COUNT; i++)
+		if (rgb[i] > LIGHTBAR_MAX_LEVEL)
+			return -EINVAL;
+
+	mutex_lock(&lightbar_lock);
+
+	qc71_lightbar_shadow_check();
+
+	if (turn_on)
+		ops[n++] = qc71_lightbar_switch_op(LIGHTBAR_CTRL_S0_OFF, true);
+
+	for (i = 0; i < LIGHTBAR_COLOR_COUNT; i++)
+		if (!lightbar_shadow_valid || lightbar_shadow[i] != rgb[i])
+			ops[n++] = QC71_EC_TXN_WRITE_OP(lightbar_color_addrs[i], rgb[i]);
+
+	err = n ? qc71_ec_txn_queue(ops, n, qc71_lightbar_queue_failed) : 0;
+
+	/* a failed transaction might have written some of the channels */
+	if (!err)
+		memcpy(lightbar_shadow, rgb, sizeof(lightbar_shadow));
+
+	lightbar_shadow_valid = !err;
+
+	mutex_unlock(&lightbar_lock);
+
+	return err;
 }
 
 static int qc71_lightbar_set_rainbow_mode(bool on)
+{
+	struct qc71_ec_txn_op op = QC71_EC_TXN_UPDATE_OP(LIGHTBAR_CTRL_ADDR, LIGHTBAR_CTRL_RAINBOW,
+							 on ? LIGHTBAR_CTRL_RAINBOW : 0);
+
+	return qc71_ec_txn_execute(&op, 1);
+}
+
+/* returns the color in the format of the 'color' attribute, channels between levels are rounded down */
+int qc71_lightbar_get_color(void)
+{
+	uint8_t rgb[LIGHTBAR_COLOR_COUNT];
+	int err;
+
+	err = qc71_lightbar_get_rgb(rgb);
+	if (err)
+		return err;
+
+	return qc71_lightbar_rgb_to_color(rgb);
+}
+
+/* ========================================================================== */
+/* effect engine */
+
+#define LIGHTBAR_EFFECT_MAX_FRAMES 16
+#define LIGHTBAR_EFFECT_MAX_MS     60000
+
+static unsigned int lightbar_effect_fps = 10;
+module_param(lightbar_effect_fps, uint, 0644);
+MODULE_PARM_DESC(lightbar_effect_fps, "maximum number of lightbar updates per second while an effect is running (default=10)");
+
+/*
+ * the color fades linearly from the previous frame's color to 'rgb'
+ * in 'ms' milliseconds, the last frame is followed by the first one
+ */
+struct qc71_lightbar_frame {
+	uint8_t rgb[LIGHTBAR_COLOR_COUNT];
+	unsigned int ms;
+};
+
+static void qc71_lightbar_effect_fn(struct work_struct *work);
+static DECLARE_DELAYED_WORK(lightbar_effect_work, qc71_lightbar_effect_fn);
+
+/*
+ * serializes stopping and starting effects, it is held from cancelling the
+ * work until the new effect is queued, so that a concurrent stop cannot
+ * cancel the work of the effect that has just been started
+ */
+static DEFINE_MUTEX(lightbar_effect_ctl_lock);
+
+/* protects the following variables */
+static DEFINE_MUTEX(lightbar_effect_lock);
+static struct qc71_lightbar_frame lightbar_effect_frames[LIGHTBAR_EFFECT_MAX_FRAMES];
+static size_t lightbar_effect_frame_count; /* 0 if no effect is running */
+static unsigned int lightbar_effect_total_ms;
+static ktime_t lightbar_effect_start;
+static bool lightbar_effect_suspended;
+
+static bool lightbar_pm_notifier_registered;
+static bool lightbar_event_handler_registered;
+
+/* 'lightbar_effect_lock' must be held */
+static void qc71_lightbar_effect_color(u32 t, uint8_t rgb[LIGHTBAR_COLOR_COUNT])
+{
+	const struct qc71_lightbar_frame *prev, *cur;
+	size_t i, j;
+
+	for (i = 0; i < lightbar_effect_frame_count; i++) {
+		cur = &lightbar_effect_frames[i];
+
+		if (t < cur->ms)
+			break;
+
+		t -= cur->ms;
+	}
+
+	if (i == lightbar_effect_frame_count) {
+		memcpy(rgb, lightbar_effect_frames[i - 1].rgb, LIGHTBAR_COLOR_COUNT);
+		return;
+	}
+
+	prev = &lightbar_effect_frames[i ? i - 1 : lightbar_effect_frame_count - 1];
+
+	for (j = 0; j < LIGHTBAR_COLOR_COUNT; j++)
+		rgb[j] = prev->rgb[j] + ((int) cur->rgb[j] - prev->rgb[j]) * (int) t / (int) cur->ms;
+}
+
+static void qc71_lightbar_effect_fn(struct work_struct *work)
+{
+	unsigned int fps = clamp_val(READ_ONCE(lightbar_effect_fps), 1, 50);
+	uint8_t rgb[LIGHTBAR_COLOR_COUNT];
+	int status;
+	u32 t;
+
+	mutex_lock(&lightbar_effect_lock);
+
+	if (!lightbar_effect_frame_count || lightbar_effect_suspended)
+		goto out;
+
+	/* the status is cached, so checking it does not cost an EC access */
+	status = qc71_lightbar_get_status();
+
+	/* paused while the lightbar is off or in rainbow mode, until it is resumed */
+	if (status >= 0 && (status & (LIGHTBAR_CTRL_S0_OFF | LIGHTBAR_CTRL_RAINBOW)))
+		goto out;
+
+	div_u64_rem(ktime_ms_delta(ktime_get(), lightbar_effect_start),
+		    lightbar_effect_total_ms, &t);
+
+	qc71_lightbar_effect_color(t, rgb);
+
+	/* only the channels that changed since the last frame are written */
+	qc71_lightbar_set_rgb(rgb, false);
+
+	queue_delayed_work(system_freezable_wq, &lightbar_effect_work,
+			   msecs_to_jiffies(MSEC_PER_SEC / fps));
+
+out:
+	mutex_unlock(&lightbar_effect_lock);
+}
+
+/* the lightbar might have been turned on, or the rainbow mode off */
+void qc71_lightbar_effect_resume(void)
+{
+	mutex_lock(&lightbar_effect_lock);
+
+	if (lightbar_effect_frame_count && !lightbar_effect_suspended)
+		queue_delayed_work(system_freezable_wq, &lightbar_effect_work, 0);
+
+	mutex_unlock(&lightbar_effect_lock);
+}
+
+/* 'lightbar_effect_ctl_lock' must be held */
+static void __qc71_lightbar_effect_stop(void)
+{
+	mutex_lock(&lightbar_effect_lock);
+	lightbar_effect_frame_count = 0;
+	mutex_unlock(&lightbar_effect_lock);
+
+	cancel_delayed_work_sync(&lightbar_effect_work);
+}
+
+void qc71_lightbar_effect_stop(void)
+{
+	mutex_lock(&lightbar_effect_ctl_lock);
+	__qc71_lightbar_effect_stop();
+	mutex_unlock(&lightbar_effect_ctl_lock);
+}
+
+/* parses frames in the form of "R,G,B,MS" separated by whitespace, and starts the effect */
+static int qc71_lightbar_effect_start(const char *program)
+{
+	struct qc71_lightbar_frame frames[LIGHTBAR_EFFECT_MAX_FRAMES];
+	unsigned int total_ms = 0;
+	size_t i, n = 0;
+	int err = 0;
+	char *buf, *p, *tok;
+
+	buf = kstrdup(program, GFP_KERNEL);
+	if (!buf)
+		return -ENOMEM;
+
+	p = buf;
+
+	while ((tok = strsep(&p, " \t\n"))) {
+		unsigned int r, g, b, ms;
+		char c;
+
+		if (!*tok)
+			continue;
+
+		if (n == ARRAY_SIZE(frames) ||
+		    sscanf(tok, "%u,%u,%u,%u%c", &r, &g, &b, &ms, &c) != 4 ||
+		    r > LIGHTBAR_MAX_LEVEL || g > LIGHTBAR_MAX_LEVEL || b > LIGHTBAR_MAX_LEVEL ||
+		    ms > LIGHTBAR_EFFECT_MAX_MS) {
+			err = -EINVAL;
+			goto out;
+		}
+
+		frames[n].rgb[LIGHTBAR_RED] = r;
+		frames[n].rgb[LIGHTBAR_GREEN] = g;
+		frames[n].rgb[LIGHTBAR_BLUE] = b;
+		frames[n].ms = ms;
+
+		total_ms += ms;
+		n++;
+	}
+
+	mutex_lock(&lightbar_effect_ctl_lock);
+
+	__qc71_lightbar_effect_stop();
+
+	/* an empty program just stops the running effect */
+	if (!n)
+		goto out_unlock;
+
+	/* a program without any duration is a static color */
+	if (!total_ms) {
+		err = qc71_lightbar_set_rgb(frames[n - 1].rgb, false);
+		goto out_unlock;
+	}
+
+	mutex_lock(&lightbar_effect_lock);
+
+	for (i = 0; i < n; i++)
+		lightbar_effect_frames[i] = frames[i];
+
+	lightbar_effect_frame_count = n;
+	lightbar_effect_total_ms = total_ms;
+	lightbar_effect_start = ktime_get();
+
+	if (!lightbar_effect_suspended)
+		queue_delayed_work(system_freezable_wq, &lightbar_effect_work, 0);
+
+	mutex_unlock(&lightbar_effect_lock);
+
+out_unlock:
+	mutex_unlock(&lightbar_effect_ctl_lock);
+out:
+	kfree(buf);
+
+	return err;
+}
+
+static int qc71_lightbar_pm_notify(struct notifier_block *nb, unsigned long action, void *data)
+{
+	switch (action) {
+	case PM_HIBERNATION_PREPARE:
+	case PM_SUSPEND_PREPARE:
+		mutex_lock(&lightbar_effect_lock);
+		lightbar_effect_suspended = true;
+		mutex_unlock(&lightbar_effect_lock);
+
+		cancel_delayed_work_sync(&lightbar_effect_work);
+		break;
+	case PM_POST_HIBERNATION:
+	case PM_POST_SUSPEND:
+		mutex_lock(&lightbar_effect_lock);
+		lightbar_effect_suspended = false;
+		mutex_unlock(&lightbar_effect_lock);
+
+		qc71_lightbar_effect_resume();
+		break;
+	}
+
+	return NOTIFY_DONE;
+}
+
+static struct notifier_block qc71_lightbar_pm_nb = {
+	.notifier_call = qc71_lightbar_pm_notify,
+};
+
+/* event handlers */
+
+/* the registers have already been invalidated by the event code */
+static void qc71_lightbar_event(unsigned int code)
+{
+	qc71_lightbar_effect_resume();
+}
+
+static struct qc71_wmi_event_handler qc71_lightbar_event_handler = {
+	.code = QC71_EVENT_LIGHTBAR,
+	.fn   = qc71_lightbar_event,
+};
+
+/* ========================================================================== */
+
+#if IS_ENABLED(CONFIG_LEDS_CLASS_MULTICOLOR)
+
+static int qc71_lightbar_led_set_brightness(struct led_classdev *led_cdev,
+					    enum led_brightness brightness)
+{
+	struct led_classdev_mc *led_mc_cdev = lcdev_to_mccdev(led_cdev);
+	uint8_t rgb[LIGHTBAR_COLOR_COUNT];
+	size_t i;
+
+	/* the color set here would be overwritten by the next frame */
+	qc71_lightbar_effect_stop();
+
+	if (!brightness)
+		return qc71_lightbar_switch(LIGHTBAR_CTRL_S0_OFF, false);
+
+	led_mc_calc_color_components(led_mc_cdev, brightness);
+
+	for (i = 0; i < ARRAY_SIZE(rgb); i++)
+		rgb[i] = led_mc_cdev->subled_info[i].brightness;
+
+	return qc71_lightbar_set_rgb(rgb, true);
+}
+
+static struct mc_subled qc71_lightbar_subleds[LIGHTBAR_COLOR_COUNT] = {
+	[LIGHTBAR_RED] = {
+		.color_index = LED_COLOR_ID_RED,
+		.channel = LIGHTBAR_RED,
+	},
+	[LIGHTBAR_GREEN] = {
+		.color_index = LED_COLOR_ID_GREEN,
+		.channel = LIGHTBAR_GREEN,
+	},
+	[LIGHTBAR_BLUE] = {
+		.color_index = LED_COLOR_ID_BLUE,
+		.channel = LIGHTBAR_BLUE,
+	},
+};
+
+static struct led_classdev_mc qc71_lightbar_led_mc = {
+	.num_colors  = ARRAY_SIZE(qc71_lightbar_subleds),
+	.subled_info = qc71_lightbar_subleds,
+	.led_cdev = {
+		.name                    = KBUILD_MODNAME "::lightbar",
+		.max_brightness          = LIGHTBAR_MAX_LEVEL,
+		.brightness_set_blocking = qc71_lightbar_led_set_brightness,
+	},
+};
+
+#define qc71_lightbar_led (qc71_lightbar_led_mc.led_cdev)
+
+/* makes 'multi_intensity' reflect a color set using the 'color' attribute */
+static void qc71_lightbar_led_sync(const uint8_t rgb[LIGHTBAR_COLOR_COUNT])
+{
+	size_t i;
+
+	mutex_lock(&qc71_lightbar_led.led_access);
+
+	for (i = 0; i < ARRAY_SIZE(qc71_lightbar_subleds); i++)
+		qc71_lightbar_subleds[i].intensity = rgb[i];
+
+	mutex_unlock(&qc71_lightbar_led.led_access);
+}
+
+#else
+
+static enum led_brightness qc71_lightbar_led_get_brightness(struct led_classdev *led_cdev)
 {
 	int status = qc71_lightbar_get_status();
 
 	if (status < 0)
-		return status;
+		return 0;
 
-	return qc71_lightbar_write_ctrl(SET_BIT(status, LIGHTBAR_CTRL_RAINBOW, on));
+	return !(status & LIGHTBAR_CTRL_S0_OFF);
 }
 
-static int qc71_lightbar_set_color(unsigned int color)
+static int qc71_lightbar_led_set_brightness(struct led_classdev *led_cdev,
+					    enum led_brightness value)
 {
-	int err = 0, i;
+	int err = qc71_lightbar_switch(LIGHTBAR_CTRL_S0_OFF, !!value);
 
-	if (color > 999) /* color must lie in [0, 999] */
-		return -EINVAL;
-
-	for (i = ARRAY_SIZE(lightbar_colors) - 1; i >= 0 && !err; i--)
-		err = qc71_lightbar_set_color_level(lightbar_colors[i],
-						    do_div(color, 10));
+	if (!err && value)
+		qc71_lightbar_effect_resume();
 
 	return err;
 }
 
+static struct led_classdev qc71_lightbar_led = {
+	.name                    = KBUILD_MODNAME "::lightbar",
+	.max_brightness          = 1,
+	.brightness_get          = qc71_lightbar_led_get_brightness,
+	.brightness_set_blocking = qc71_lightbar_led_set_brightness,
+};
+
+static inline void qc71_lightbar_led_sync(const uint8_t rgb[LIGHTBAR_COLOR_COUNT])
+{
+
+}
+
+#endif
+
 /* ========================================================================== */
 /* lightbar attrs */
 
@@ -206,37 +598,32 @@ static ssize_t lightbar_s3_store(struct device *dev, struct device_attribute *at
 static ssize_t lightbar_color_show(struct device *dev,
 				   struct device_attribute *attr, char *buf)
 {
-	unsigned int color = 0;
-	size_t i;
-
-	for (i = 0; i < ARRAY_SIZE(lightbar_colors); i++) {
-		int level = qc71_lightbar_get_color_level(lightbar_colors[i]);
-
-		if (level < 0)
-			return level;
+	int color = qc71_lightbar_get_color();
 
-		color *= 10;
-
-		if (0 <= level && level <= 9)
-			color += level;
-	}
+	if (color < 0)
+		return color;
 
-	return sprintf(buf, "%03u\n", color);
+	return sprintf(buf, "%03d\n", color);
 }
 
 static ssize_t lightbar_color_store(struct device *dev, struct device_attribute *attr,
 				    const char *buf, size_t count)
 {
+	uint8_t rgb[LIGHTBAR_COLOR_COUNT];
 	unsigned int value;
 	int err;
 
-	if (kstrtouint(buf, 10, &value))
+	if (kstrtouint(buf, 10, &value) || qc71_lightbar_color_to_rgb(value, rgb))
 		return -EINVAL;
 
-	err = qc71_lightbar_set_color(value);
+	qc71_lightbar_effect_stop();
+
+	err = qc71_lightbar_set_rgb(rgb, false);
 	if (err)
 		return err;
 
+	qc71_lightbar_led_sync(rgb);
+
 	return count;
 }
 
@@ -265,140 +652,149 @@ static ssize_t lightbar_rainbow_store(struct device *dev, struct device_attribut
 	if (err)
 		return err;
 
+	if (!value)
+		qc71_lightbar_effect_resume();
+
 	return count;
 }
 
-static enum led_brightness qc71_lightbar_led_get_brightness(struct led_classdev *led_cdev)
+static ssize_t lightbar_effect_show(struct device *dev,
+				    struct device_attribute *attr, char *buf)
 {
-	int err = qc71_lightbar_get_status();
+	ssize_t len = 0;
+	size_t i;
 
-	if (err)
-		return 0;
+	mutex_lock(&lightbar_effect_lock);
 
-	return !(err & LIGHTBAR_CTRL_S0_OFF);
-}
+	for (i = 0; i < lightbar_effect_frame_count; i++) {
+		const struct qc71_lightbar_frame *frame = &lightbar_effect_frames[i];
 
-static int qc71_lightbar_led_set_brightness(struct led_classdev *led_cdev,
-					    enum led_brightness value)
-{
-	return qc71_lightbar_switch(LIGHTBAR_CTRL_S0_OFF, !!value);
-}
-
-#if 0
-static int qc71_lightbar_led_set_brightness(struct led_classdev *led_cdev,
-					    enum led_brightness brightness)
-{
-	struct led_classdev_mc *led_mc_cdev = lcdev_to_mccdev(led_cdev);
-	unsigned int color = 0, i;
-	int err;
+		len += scnprintf(buf + len, PAGE_SIZE - len, "%s%u,%u,%u,%u", i ? " " : "",
+				 frame->rgb[LIGHTBAR_RED], frame->rgb[LIGHTBAR_GREEN],
+				 frame->rgb[LIGHTBAR_BLUE], frame->ms);
+	}
 
-	led_mc_calc_color_components(led_mc_cdev, brightness);
+	mutex_unlock(&lightbar_effect_lock);
 
-	for (i = 0; i < led_mc_cdev->num_colors; i++) {
-		if (led_mc_cdev->subled_info[i].brightness > 9)
-			return -EINVAL;
+	len += scnprintf(buf + len, PAGE_SIZE - len, "\n");
 
-		color = 10 * color + led_mc_cdev->subled_info[i].brightness;
-	}
-
-	if (color) {
-		err = qc71_lightbar_switch(LIGHTBAR_CTRL_S0_OFF, 1);
+	return len;
+}
 
-		if (err)
-			goto out;
+static ssize_t lightbar_effect_store(struct device *dev, struct device_attribute *attr,
+				     const char *buf, size_t count)
+{
+	int err = qc71_lightbar_effect_start(buf);
 
-		err = qc71_lightbar_set_color(color);
-	} else {
-		err = qc71_lightbar_switch(LIGHTBAR_CTRL_S0_OFF, 0);
-	}
+	if (err)
+		return err;
 
-out:
-	return err;
+	return count;
 }
-#endif
 
 /* ========================================================================== */
 
 static DEVICE_ATTR(brightness_s3, 0644, lightbar_s3_show,      lightbar_s3_store);
 static DEVICE_ATTR(color,         0644, lightbar_color_show,   lightbar_color_store);
+static DEVICE_ATTR(effect,        0644, lightbar_effect_show,  lightbar_effect_store);
 static DEVICE_ATTR(rainbow_mode,  0644, lightbar_rainbow_show, lightbar_rainbow_store);
 
 static struct attribute *qc71_lightbar_led_attrs[] = {
 	&dev_attr_brightness_s3.attr,
 	&dev_attr_color.attr,
+	&dev_attr_effect.attr,
 	&dev_attr_rainbow_mode.attr,
 	NULL
 };
 
 ATTRIBUTE_GROUPS(qc71_lightbar_led);
 
-static struct led_classdev qc71_lightbar_led = {
-	.name                    = KBUILD_MODNAME "::lightbar",
-	.max_brightness          = 1,
-	.brightness_get          = qc71_lightbar_led_get_brightness,
-	.brightness_set_blocking = qc71_lightbar_led_set_brightness,
-	.groups                  = qc71_lightbar_led_groups,
-};
-
-#if 0
-static struct mc_subled qc71_lightbar_subleds[LIGHTBAR_COLOR_COUNT] = {
-	[LIGHTBAR_RED] = {
-		.color_index = LED_COLOR_ID_RED,
-	},
-	[LIGHTBAR_GREEN] = {
-		.color_index = LED_COLOR_ID_GREEN,
-	},
-	[LIGHTBAR_BLUE] = {
-		.color_index = LED_COLOR_ID_BLUE,
-	},
-};
-
-static struct led_classdev_mc qc71_lightbar_led = {
-	.num_colors  = ARRAY_SIZE(qc71_lightbar_subleds),
-	.subled_info = qc71_lightbar_subleds,
-	.led_cdev = {
-		.name                    = KBUILD_MODNAME "::lightbar",
-		.max_brightness          = 9,
-		.brightness_set_blocking = qc71_lightbar_led_set_brightness,
-	},
-};
-#endif
-
 /* ========================================================================== */
 
 int __init qc71_led_lightbar_setup(void)
 {
+	uint8_t rgb[LIGHTBAR_COLOR_COUNT];
+	size_t __maybe_unused i;
 	int err;
 
 	if (nolightbar || !qc71_features.lightbar)
 		return -ENODEV;
 
-#if 0
-	err = led_classdev_multicolor_register(&qc71_platform_dev->dev, &qc71_lightbar_led);
-#endif
-	err = led_classdev_register(&qc71_platform_dev->dev, &qc71_lightbar_led);
+	/* fills the shadow copy */
+	err = qc71_lightbar_get_rgb(rgb);
+	if (err)
+		return err;
 
-	if (!err)
-		lightbar_led_registered = true;
+#if IS_ENABLED(CONFIG_LEDS_CLASS_MULTICOLOR)
+	err = qc71_lightbar_get_status();
+	if (err < 0)
+		return err;
+
+	qc71_lightbar_led.brightness = (err & LIGHTBAR_CTRL_S0_OFF) ? 0 : LIGHTBAR_MAX_LEVEL;
+
+	/* 'led_access' is not initialized before the registration */
+	for (i = 0; i < ARRAY_SIZE(qc71_lightbar_subleds); i++)
+		qc71_lightbar_subleds[i].intensity = rgb[i];
+
+	err = led_classdev_multicolor_register(&qc71_platform_dev->dev, &qc71_lightbar_led_mc);
+	if (err)
+		return err;
+
+	/* the multicolor class overrides 'groups' */
+	err = device_add_groups(qc71_lightbar_led.dev, qc71_lightbar_led_groups);
+	if (err) {
+		led_classdev_multicolor_unregister(&qc71_lightbar_led_mc);
+		return err;
+	}
+#else
+	qc71_lightbar_led.groups = qc71_lightbar_led_groups;
 
-#if 0
-	err = device_add_groups(qc71_lightbar_led.led_cdev.dev, qc71_lightbar_led_groups);
+	err = led_classdev_register(&qc71_platform_dev->dev, &qc71_lightbar_led);
 	if (err)
-		led_classdev_multicolor_unregister(&qc71_lightbar_led);
+		return err;
 #endif
 
-	return err;
+	lightbar_led_registered = true;
+
+	/* the effects simply keep running without it */
+	if (!register_pm_notifier(&qc71_lightbar_pm_nb))
+		lightbar_pm_notifier_registered = true;
+
+	/* without it, only the driver itself can resume a paused effect */
+	if (!qc71_wmi_event_register(&qc71_lightbar_event_handler))
+		lightbar_event_handler_registered = true;
+
+	return 0;
 }
 
 void qc71_led_lightbar_cleanup(void)
 {
-	if (lightbar_led_registered) {
-#if 0
-		device_remove_groups(qc71_lightbar_led.led_cdev.dev, qc71_lightbar_led_groups);
-		led_classdev_multicolor_unregister(&qc71_lightbar_led);
-#endif
-		led_classdev_unregister(&qc71_lightbar_led);
+	if (!lightbar_led_registered)
+		return;
+
+	if (lightbar_event_handler_registered) {
+		qc71_wmi_event_unregister(&qc71_lightbar_event_handler);
+		lightbar_event_handler_registered = false;
+	}
+
+	if (lightbar_pm_notifier_registered) {
+		unregister_pm_notifier(&qc71_lightbar_pm_nb);
+		lightbar_pm_notifier_registered = false;
 	}
+
+	/* the attribute may start a new effect until the LED is unregistered */
+	qc71_lightbar_effect_stop();
+
+#if IS_ENABLED(CONFIG_LEDS_CLASS_MULTICOLOR)
+	device_remove_groups(qc71_lightbar_led.dev, qc71_lightbar_led_groups);
+	led_classdev_multicolor_unregister(&qc71_lightbar_led_mc);
+#else
+	led_classdev_unregister(&qc71_lightbar_led);
+#endif
+
+	qc71_lightbar_effect_stop();
+
+	lightbar_led_registered = false;
 }
 
 #endif
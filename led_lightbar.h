@@ -2,6 +2,10 @@
 #ifndef QC71_LED_LIGHTBAR_H
 #define QC71_LED_LIGHTBAR_H
 
+#define LIGHTBAR_COLOR_OPS 3
+
+struct qc71_ec_txn_op;
+
 #if IS_ENABLED(CONFIG_LEDS_CLASS)
 
 #include <linux/init.h>
@@ -9,8 +13,16 @@
 int  __init qc71_led_lightbar_setup(void);
 void        qc71_led_lightbar_cleanup(void);
 
+int qc71_lightbar_get_color(void);
+int qc71_lightbar_color_ops(unsigned int color, struct qc71_ec_txn_op *ops);
+void qc71_lightbar_color_changed(void);
+void qc71_lightbar_effect_stop(void);
+void qc71_lightbar_effect_resume(void);
+
 #else
 
+#include <linux/errno.h>
+
 static inline int qc71_led_lightbar_setup(void)
 {
 	return 0;
@@ -21,6 +33,31 @@ static inline void qc71_led_lightbar_cleanup(void)
 
 }
 
+static inline int qc71_lightbar_get_color(void)
+{
+	return -ENODEV;
+}
+
+static inline int qc71_lightbar_color_ops(unsigned int color, struct qc71_ec_txn_op *ops)
+{
+	return -ENODEV;
+}
+
+static inline void qc71_lightbar_color_changed(void)
+{
+
+}
+
+static inline void qc71_lightbar_effect_stop(void)
+{
+
+}
+
+static inline void qc71_lightbar_effect_resume(void)
+{
+
+}
+
 #endif
 
 #endif /* QC71_LED_LIGHTBAR_H */
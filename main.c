@@ -29,9 +29,18 @@
 /* submodules */
 #include "pdev.h"
 #include "events.h"
+#include "event_stream.h"
 #include "hwmon.h"
 #include "battery.h"
+#include "led_kbd.h"
 #include "led_lightbar.h"
+#include "platform_profile.h"
+#include "perf_mode.h"
+#include "power_limit.h"
+#include "powercap.h"
+#include "governor.h"
+#include "boost.h"
+#include "profile.h"
 #include "debugfs.h"
 
 /* ========================================================================== */
@@ -49,9 +58,18 @@ static struct qc71_submodule {
 } qc71_submodules[] __refdata = {
 	SUBMODULE_ENTRY(pdev, true), /* must be first */
 	SUBMODULE_ENTRY(wmi_events, false),
+	SUBMODULE_ENTRY(event_stream, false),
 	SUBMODULE_ENTRY(hwmon, false),
 	SUBMODULE_ENTRY(battery, false),
+	SUBMODULE_ENTRY(led_kbd, false),
 	SUBMODULE_ENTRY(led_lightbar, false),
+	SUBMODULE_ENTRY(platform_profile, false),
+	SUBMODULE_ENTRY(perf_mode, false), /* notifies platform_profile */
+	SUBMODULE_ENTRY(power_limit, false),
+	SUBMODULE_ENTRY(powercap, false), /* needs power_limit */
+	SUBMODULE_ENTRY(governor, false), /* needs power_limit */
+	SUBMODULE_ENTRY(boost, false), /* needs power_limit */
+	SUBMODULE_ENTRY(profile, false),
 	SUBMODULE_ENTRY(debugfs, false),
 };
 
@@ -73,10 +91,9 @@ static int __init qc71_laptop_module_init(void)
 {
 	int err = 0, i;
 
-	if (!wmi_has_guid(QC71_WMI_WMBC_GUID)) {
-		pr_err("WMI GUID not found\n");
-		err = -ENODEV; goto out;
-	}
+	err = qc71_ec_setup();
+	if (err)
+		return err;
 
 	err = ec_read_byte(PROJ_ID_ADDR);
 	if (err < 0) {
@@ -107,6 +124,8 @@ static int __init qc71_laptop_module_init(void)
 	if (qc71_features.fn_lock)           pr_cont(" fn-lock");
 	if (qc71_features.batt_charge_limit) pr_cont(" charge-limit");
 	if (qc71_features.fan_extras)        pr_cont(" fan-extras");
+	if (qc71_features.silent_mode)       pr_cont(" silent-mode");
+	if (qc71_features.overclock)         pr_cont(" overclock");
 	pr_cont("\n");
 
 	for (i = 0; i < ARRAY_SIZE(qc71_submodules); i++) {
@@ -125,10 +144,12 @@ static int __init qc71_laptop_module_init(void)
 	err = 0;
 
 out:
-	if (err)
+	if (err) {
 		do_cleanup();
-	else
+		qc71_ec_cleanup();
+	} else {
 		pr_info("module loaded\n");
+	}
 
 	return err;
 }
@@ -136,6 +157,7 @@ out:
 static void __exit qc71_laptop_module_cleanup(void)
 {
 	do_cleanup();
+	qc71_ec_cleanup();
 	pr_info("module unloaded\n");
 }
 
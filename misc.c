@@ -24,9 +24,9 @@ int qc71_rfkill_get_wifi_state(void)
 
 /* ========================================================================== */
 
-int qc71_fn_lock_get_state(void)
+int qc71_fn_lock_get_state(enum qc71_ec_prio prio)
 {
-	int status = ec_read_byte(BIOS_CTRL_1_ADDR);
+	int status = ec_read_byte_prio(BIOS_CTRL_1_ADDR, prio);
 
 	if (status < 0)
 		return status;
@@ -34,14 +34,14 @@ int qc71_fn_lock_get_state(void)
 	return !!(status & BIOS_CTRL_1_FN_LOCK_STATUS);
 }
 
-int qc71_fn_lock_set_state(bool state)
+int qc71_fn_lock_set_state(bool state, enum qc71_ec_prio prio)
 {
-	int status = ec_read_byte(BIOS_CTRL_1_ADDR);
+	int status = ec_read_byte_prio(BIOS_CTRL_1_ADDR, prio);
 
 	if (status < 0)
 		return status;
 
 	status = SET_BIT(status, BIOS_CTRL_1_FN_LOCK_STATUS, state);
 
-	return ec_write_byte(BIOS_CTRL_1_ADDR, status);
+	return ec_write_byte_prio(BIOS_CTRL_1_ADDR, status, prio);
 }
@@ -4,11 +4,13 @@
 
 #include <linux/types.h>
 
+#include "ec.h"
+
 /* ========================================================================== */
 
 int qc71_rfkill_get_wifi_state(void);
 
-int qc71_fn_lock_get_state(void);
-int qc71_fn_lock_set_state(bool state);
+int qc71_fn_lock_get_state(enum qc71_ec_prio prio);
+int qc71_fn_lock_set_state(bool state, enum qc71_ec_prio prio);
 
 #endif /* QC71_MISC_H */
@@ -7,11 +7,13 @@
 #include <linux/kernel.h>
 #include <linux/platform_device.h>
 
-#include "util.h"
+#include "codec.h"
 #include "ec.h"
+#include "events.h"
 #include "features.h"
 #include "misc.h"
 #include "pdev.h"
+#include "perf_mode.h"
 
 /* ========================================================================== */
 
@@ -19,78 +21,57 @@ struct platform_device *qc71_platform_dev;
 
 /* ========================================================================== */
 
-static ssize_t fan_reduced_duty_cycle_show(struct device *dev,
-					   struct device_attribute *attr, char *buf)
+/* the single bit settings in 'enum qc71_ec_flag' */
+static ssize_t qc71_flag_show(enum qc71_ec_flag flag, char *buf)
 {
-	int status = ec_read_byte(BIOS_CTRL_3_ADDR);
+	int status = ec_read_byte(qc71_ec_flag_addr(flag));
 
 	if (status < 0)
 		return status;
 
-	return sprintf(buf, "%d\n", !!(status & BIOS_CTRL_3_FAN_REDUCED_DUTY_CYCLE));
+	return sprintf(buf, "%d\n", qc71_ec_flag_get(flag, status));
 }
 
-static ssize_t fan_reduced_duty_cycle_store(struct device *dev, struct device_attribute *attr,
-					    const char *buf, size_t count)
+static ssize_t qc71_flag_store(enum qc71_ec_flag flag, const char *buf, size_t count)
 {
-	int status;
+	struct qc71_ec_txn_op op;
+	int err;
 	bool value;
 
 	if (kstrtobool(buf, &value))
 		return -EINVAL;
 
-	status = ec_read_byte(BIOS_CTRL_3_ADDR);
-	if (status < 0)
-		return status;
-
-	status = SET_BIT(status, BIOS_CTRL_3_FAN_REDUCED_DUTY_CYCLE, value);
-
-	status = ec_write_byte(BIOS_CTRL_3_ADDR, status);
+	op = qc71_ec_flag_op(flag, value);
 
-	if (status < 0)
-		return status;
+	err = qc71_ec_txn_execute(&op, 1);
+	if (err)
+		return err;
 
 	return count;
 }
 
-static ssize_t fan_always_on_show(struct device *dev,
-				  struct device_attribute *attr, char *buf)
-{
-	int status = ec_read_byte(BIOS_CTRL_3_ADDR);
-
-	if (status < 0)
-		return status;
-
-	return sprintf(buf, "%d\n", !!(status & BIOS_CTRL_3_FAN_ALWAYS_ON));
+#define QC71_FLAG_ATTR(_name, _flag) \
+static ssize_t _name ## _show(struct device *dev, struct device_attribute *attr, char *buf) \
+{ \
+	return qc71_flag_show(_flag, buf); \
+} \
+static ssize_t _name ## _store(struct device *dev, struct device_attribute *attr, \
+			       const char *buf, size_t count) \
+{ \
+	return qc71_flag_store(_flag, buf, count); \
 }
 
-static ssize_t fan_always_on_store(struct device *dev, struct device_attribute *attr,
-				   const char *buf, size_t count)
-{
-	int status;
-	bool value;
-
-	if (kstrtobool(buf, &value))
-		return -EINVAL;
-
-	status = ec_read_byte(BIOS_CTRL_3_ADDR);
-	if (status < 0)
-		return status;
-
-	status = SET_BIT(status, BIOS_CTRL_3_FAN_ALWAYS_ON, value);
-
-	status = ec_write_byte(BIOS_CTRL_3_ADDR, status);
+QC71_FLAG_ATTR(fan_always_on,          QC71_FLAG_FAN_ALWAYS_ON)
+QC71_FLAG_ATTR(fan_reduced_duty_cycle, QC71_FLAG_FAN_REDUCED_DUTY_CYCLE)
+QC71_FLAG_ATTR(fn_lock_switch,         QC71_FLAG_FN_LOCK_SWITCH)
+QC71_FLAG_ATTR(manual_control,         QC71_FLAG_MANUAL_CONTROL)
 
-	if (status < 0)
-		return status;
-
-	return count;
-}
+#undef QC71_FLAG_ATTR
 
 static ssize_t fn_lock_show(struct device *dev,
 			    struct device_attribute *attr, char *buf)
 {
-	int status = qc71_fn_lock_get_state();
+	int status = qc71_fn_lock_get_state(QC71_EC_PRIO_CONTROL);
 
 	if (status < 0)
 		return status;
@@ -107,130 +88,106 @@ static ssize_t fn_lock_store(struct device *dev, struct device_attribute *attr,
 	if (kstrtobool(buf, &value))
 		return -EINVAL;
 
-	status = qc71_fn_lock_set_state(value);
+	status = qc71_fn_lock_set_state(value, QC71_EC_PRIO_CONTROL);
 	if (status < 0)
 		return status;
 
 	return count;
 }
 
-static ssize_t fn_lock_switch_show(struct device *dev,
+static ssize_t super_key_lock_show(struct device *dev,
 				   struct device_attribute *attr, char *buf)
 {
-	int status = ec_read_byte(AP_BIOS_BYTE_ADDR);
+	int status = ec_read_byte(STATUS_1_ADDR);
 
 	if (status < 0)
 		return status;
 
-	return sprintf(buf, "%d\n", !!(status & AP_BIOS_BYTE_FN_LOCK_SWITCH));
+	return sprintf(buf, "%d\n", !!(status & STATUS_1_SUPER_KEY_LOCK));
 }
 
-static ssize_t fn_lock_switch_store(struct device *dev, struct device_attribute *attr,
+static ssize_t super_key_lock_store(struct device *dev, struct device_attribute *attr,
 				    const char *buf, size_t count)
 {
+	struct qc71_ec_txn_op op;
 	int status;
 	bool value;
 
 	if (kstrtobool(buf, &value))
 		return -EINVAL;
 
-	status = ec_read_byte(AP_BIOS_BYTE_ADDR);
+	status = ec_read_byte(STATUS_1_ADDR);
 	if (status < 0)
 		return status;
 
-	status = SET_BIT(status, AP_BIOS_BYTE_FN_LOCK_SWITCH, value);
-
-	status = ec_write_byte(AP_BIOS_BYTE_ADDR, status);
-
-	if (status < 0)
-		return status;
+	if (qc71_super_key_lock_ops(status, value, &op)) {
+		status = qc71_ec_txn_execute(&op, 1);
+		if (status < 0)
+			return status;
+	}
 
 	return count;
 }
 
-static ssize_t manual_control_show(struct device *dev,
-				   struct device_attribute *attr, char *buf)
+static ssize_t perf_mode_show(struct device *dev,
+			      struct device_attribute *attr, char *buf)
 {
-	int status = ec_read_byte(CTRL_1_ADDR);
+	int mode = qc71_perf_mode_get();
 
-	if (status < 0)
-		return status;
+	if (mode < 0)
+		return mode;
 
-	return sprintf(buf, "%d\n", !!(status & CTRL_1_MANUAL_MODE));
+	return sprintf(buf, "%s\n", qc71_perf_mode_names[mode]);
 }
 
-static ssize_t manual_control_store(struct device *dev, struct device_attribute *attr,
-				    const char *buf, size_t count)
+static ssize_t perf_mode_store(struct device *dev, struct device_attribute *attr,
+			       const char *buf, size_t count)
 {
-	int status;
-	bool value;
-
-	if (kstrtobool(buf, &value))
-		return -EINVAL;
-
-	status = ec_read_byte(CTRL_1_ADDR);
-	if (status < 0)
-		return status;
+	int mode = qc71_perf_mode_parse(buf), err;
 
-	status = SET_BIT(status, CTRL_1_MANUAL_MODE, value);
+	if (mode < 0)
+		return mode;
 
-	status = ec_write_byte(CTRL_1_ADDR, status);
+	err = qc71_perf_mode_set(mode);
+	if (err)
+		return err;
 
-	if (status < 0)
-		return status;
+	qc71_perf_mode_notify();
 
 	return count;
 }
 
-static ssize_t super_key_lock_show(struct device *dev,
-				   struct device_attribute *attr, char *buf)
-{
-	int status = ec_read_byte(STATUS_1_ADDR);
-
-	if (status < 0)
-		return status;
-
-	return sprintf(buf, "%d\n", !!(status & STATUS_1_SUPER_KEY_LOCK));
-}
-
-static ssize_t super_key_lock_store(struct device *dev, struct device_attribute *attr,
+/* waits for the queued EC writes, fails if any of them failed */
+static ssize_t ec_write_flush_store(struct device *dev, struct device_attribute *attr,
 				    const char *buf, size_t count)
 {
-	int status;
-	bool value;
-
-	if (kstrtobool(buf, &value))
-		return -EINVAL;
+	int err = qc71_ec_write_flush();
 
-	status = ec_read_byte(STATUS_1_ADDR);
-	if (status < 0)
-		return status;
-
-	if (value != !!(status & STATUS_1_SUPER_KEY_LOCK)) {
-		status = ec_write_byte(TRIGGER_1_ADDR, TRIGGER_1_SUPER_KEY_LOCK);
-
-		if (status < 0)
-			return status;
-	}
+	if (err)
+		return err;
 
 	return count;
 }
 
 /* ========================================================================== */
 
+static DEVICE_ATTR_WO(ec_write_flush);
 static DEVICE_ATTR_RW(fn_lock);
 static DEVICE_ATTR_RW(fn_lock_switch);
 static DEVICE_ATTR_RW(fan_always_on);
 static DEVICE_ATTR_RW(fan_reduced_duty_cycle);
 static DEVICE_ATTR_RW(manual_control);
+static DEVICE_ATTR_RW(perf_mode);
 static DEVICE_ATTR_RW(super_key_lock);
 
 static struct attribute *qc71_laptop_attrs[] = {
+	&dev_attr_ec_write_flush.attr,
 	&dev_attr_fn_lock.attr,
 	&dev_attr_fn_lock_switch.attr,
 	&dev_attr_fan_always_on.attr,
 	&dev_attr_fan_reduced_duty_cycle.attr,
 	&dev_attr_manual_control.attr,
+	&dev_attr_perf_mode.attr,
 	&dev_attr_super_key_lock.attr,
 	NULL
 };
@@ -245,7 +202,8 @@ static umode_t qc71_laptop_attr_is_visible(struct kobject *kobj, struct attribut
 		ok = qc71_features.fn_lock;
 	else if (attr == &dev_attr_fan_always_on.attr || attr == &dev_attr_fan_reduced_duty_cycle.attr)
 		ok = qc71_features.fan_extras;
-	else if (attr == &dev_attr_manual_control.attr)
+	else if (attr == &dev_attr_manual_control.attr || attr == &dev_attr_ec_write_flush.attr ||
+		 attr == &dev_attr_perf_mode.attr)
 		ok = true;
 	else if (attr == &dev_attr_super_key_lock.attr)
 		ok = qc71_features.super_key_lock;
@@ -265,10 +223,36 @@ static const struct attribute_group *qc71_laptop_groups[] = {
 	NULL
 };
 
+/* event handlers */
+
+static void qc71_fn_lock_event(unsigned int code)
+{
+	int status = qc71_fn_lock_get_state(QC71_EC_PRIO_INTERACTIVE);
+
+	if (status >= 0) {
+		/* seemingly the returned status in the WMI event handler is not the current */
+		pr_info("setting Fn lock state from %d to %d\n", !status, status);
+		qc71_fn_lock_set_state(status, QC71_EC_PRIO_INTERACTIVE);
+	}
+
+	sysfs_notify(&qc71_platform_dev->dev.kobj, NULL, "fn_lock");
+}
+
+static void qc71_super_key_lock_event(unsigned int code)
+{
+	sysfs_notify(&qc71_platform_dev->dev.kobj, NULL, "super_key_lock");
+}
+
+static struct qc71_wmi_event_handler qc71_pdev_event_handlers[] = {
+	{ .code = QC71_EVENT_FN_LOCK,        .fn = qc71_fn_lock_event },
+	{ .code = QC71_EVENT_SUPER_KEY_LOCK, .fn = qc71_super_key_lock_event },
+};
+
 /* ========================================================================== */
 
 int __init qc71_pdev_setup(void)
 {
+	size_t i;
 	int err;
 
 	qc71_platform_dev = platform_device_alloc(KBUILD_MODNAME, PLATFORM_DEVID_NONE);
@@ -283,14 +267,23 @@ int __init qc71_pdev_setup(void)
 	if (err) {
 		platform_device_put(qc71_platform_dev);
 		qc71_platform_dev = NULL;
+		goto out;
 	}
 
+	for (i = 0; i < ARRAY_SIZE(qc71_pdev_event_handlers); i++)
+		(void) qc71_wmi_event_register(&qc71_pdev_event_handlers[i]);
+
 out:
 	return err;
 }
 
 void qc71_pdev_cleanup(void)
 {
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(qc71_pdev_event_handlers); i++)
+		qc71_wmi_event_unregister(&qc71_pdev_event_handlers[i]);
+
 	/* checks for IS_ERR_OR_NULL() */
 	platform_device_unregister(qc71_platform_dev);
 }
@@ -0,0 +1,337 @@
+// SPDX-License-Identifier: GPL-2.0
+#include "pr.h"
+
+#include <linux/atomic.h>
+#include <linux/bug.h>
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/moduleparam.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/sysfs.h>
+#include <linux/types.h>
+
+#include "ec.h"
+#include "events.h"
+#include "features.h"
+#include "pdev.h"
+#include "perf_mode.h"
+#include "platform_profile.h"
+
+/* ========================================================================== */
+
+const char * const qc71_perf_mode_names[QC71_PERF_MODE_COUNT] = {
+	[QC71_PERF_MODE_LOW_POWER]   = "low-power",
+	[QC71_PERF_MODE_QUIET]       = "quiet",
+	[QC71_PERF_MODE_BALANCED]    = "balanced",
+	[QC71_PERF_MODE_PERFORMANCE] = "performance",
+};
+
+/*
+ * the turbo level selects the mode, the rest of the bits are only
+ * touched if the EC reports supporting them
+ */
+static const struct {
+	uint8_t turbo_level;
+	uint8_t ctrl_3;
+	uint8_t ctrl_4;
+} qc71_perf_mode_regs[QC71_PERF_MODE_COUNT] = {
+	[QC71_PERF_MODE_LOW_POWER]   = { CTRL_2_TURBO_LEVEL_0, CTRL_3_FAN_QUIET, 0 },
+	[QC71_PERF_MODE_QUIET]       = { CTRL_2_TURBO_LEVEL_1, CTRL_3_FAN_QUIET, 0 },
+	[QC71_PERF_MODE_BALANCED]    = { CTRL_2_TURBO_LEVEL_2, 0, 0 },
+	[QC71_PERF_MODE_PERFORMANCE] = { CTRL_2_TURBO_LEVEL_3,
+					 CTRL_3_OVERBOOST | CTRL_3_HIGH_PWR,
+					 CTRL_4_OVERBOOST_DYN_TEMP_OFF },
+};
+
+static DEFINE_MUTEX(qc71_perf_mode_lock);
+
+/* incremented whenever a mode is selected */
+static atomic_t qc71_perf_mode_selections = ATOMIC_INIT(0);
+
+/* protects the following variables */
+static DEFINE_MUTEX(qc71_perf_mode_cycle_lock);
+static uint8_t qc71_perf_mode_cycle[QC71_PERF_MODE_COUNT] = {
+	QC71_PERF_MODE_QUIET,
+	QC71_PERF_MODE_BALANCED,
+	QC71_PERF_MODE_PERFORMANCE,
+};
+static size_t qc71_perf_mode_cycle_len = 3;
+
+/* ========================================================================== */
+
+int qc71_perf_mode_parse(const char *buf)
+{
+	int mode = sysfs_match_string(qc71_perf_mode_names, buf);
+
+	if (mode < 0)
+		return -EINVAL;
+
+	return mode;
+}
+
+/* module parameter: comma separated list of the modes the button cycles through */
+
+static int qc71_perf_mode_cycle_param_set(const char *val, const struct kernel_param *kp)
+{
+	uint8_t cycle[QC71_PERF_MODE_COUNT];
+	char *buf, *p, *tok;
+	size_t len = 0;
+	int err = 0;
+
+	buf = kstrdup(val, GFP_KERNEL);
+	if (!buf)
+		return -ENOMEM;
+
+	p = strim(buf);
+
+	while ((tok = strsep(&p, ",")) != NULL) {
+		int mode;
+
+		tok = strim(tok);
+		if (!*tok)
+			continue;
+
+		mode = match_string(qc71_perf_mode_names, QC71_PERF_MODE_COUNT, tok);
+		if (mode < 0 || len == ARRAY_SIZE(cycle)) {
+			err = -EINVAL;
+			goto out;
+		}
+
+		cycle[len++] = mode;
+	}
+
+	mutex_lock(&qc71_perf_mode_cycle_lock);
+	memcpy(qc71_perf_mode_cycle, cycle, len);
+	qc71_perf_mode_cycle_len = len;
+	mutex_unlock(&qc71_perf_mode_cycle_lock);
+
+out:
+	kfree(buf);
+	return err;
+}
+
+static int qc71_perf_mode_cycle_param_get(char *buffer, const struct kernel_param *kp)
+{
+	size_t i;
+	int n = 0;
+
+	mutex_lock(&qc71_perf_mode_cycle_lock);
+	for (i = 0; i < qc71_perf_mode_cycle_len; i++)
+		n += scnprintf(buffer + n, PAGE_SIZE - n, "%s%s", i ? "," : "",
+			       qc71_perf_mode_names[qc71_perf_mode_cycle[i]]);
+	mutex_unlock(&qc71_perf_mode_cycle_lock);
+
+	n += scnprintf(buffer + n, PAGE_SIZE - n, "\n");
+
+	return n;
+}
+
+static const struct kernel_param_ops qc71_perf_mode_cycle_param_ops = {
+	.set = qc71_perf_mode_cycle_param_set,
+	.get = qc71_perf_mode_cycle_param_get,
+};
+
+module_param_cb(perf_mode_cycle, &qc71_perf_mode_cycle_param_ops, NULL, 0644);
+MODULE_PARM_DESC(perf_mode_cycle, "modes the performance mode button cycles through, empty disables it (default=quiet,balanced,performance)");
+
+/* ========================================================================== */
+
+bool qc71_perf_mode_supported(enum qc71_perf_mode mode)
+{
+	switch (mode) {
+	case QC71_PERF_MODE_QUIET:
+		return qc71_features.silent_mode;
+	case QC71_PERF_MODE_LOW_POWER:
+	case QC71_PERF_MODE_BALANCED:
+	case QC71_PERF_MODE_PERFORMANCE:
+		return true;
+	default:
+		return false;
+	}
+}
+
+/* the modes are ordered by power, on a tie the one using less power is chosen */
+static enum qc71_perf_mode qc71_perf_mode_nearest_supported(enum qc71_perf_mode mode)
+{
+	int d;
+
+	for (d = 0; d < QC71_PERF_MODE_COUNT; d++) {
+		if ((int) mode - d >= 0 && qc71_perf_mode_supported(mode - d))
+			return mode - d;
+
+		if (mode + d < QC71_PERF_MODE_COUNT && qc71_perf_mode_supported(mode + d))
+			return mode + d;
+	}
+
+	return mode;
+}
+
+/*
+ * the EC might be in a mode the driver would not select (e.g. set by the
+ * firmware), it is reported as the nearest one that can be selected
+ */
+int qc71_perf_mode_get(void)
+{
+	int status = ec_read_byte(CTRL_2_ADDR);
+	enum qc71_perf_mode mode;
+
+	if (status < 0)
+		return status;
+
+	switch (status & CTRL_2_TURBO_LEVEL_MASK) {
+	case CTRL_2_TURBO_LEVEL_0:
+		mode = QC71_PERF_MODE_LOW_POWER;
+		break;
+	case CTRL_2_TURBO_LEVEL_1:
+		mode = QC71_PERF_MODE_QUIET;
+		break;
+	case CTRL_2_TURBO_LEVEL_2:
+		mode = QC71_PERF_MODE_BALANCED;
+		break;
+	default:
+		mode = QC71_PERF_MODE_PERFORMANCE;
+		break;
+	}
+
+	return qc71_perf_mode_nearest_supported(mode);
+}
+
+/* fills 'ops' (at most QC71_PERF_MODE_MAX_OPS) with the updates selecting 'mode', returns their number */
+int qc71_perf_mode_ops(enum qc71_perf_mode mode, struct qc71_ec_txn_op *ops)
+{
+	uint8_t ctrl_3_mask = 0;
+	int n = 0;
+
+	if (mode >= QC71_PERF_MODE_COUNT || !qc71_perf_mode_supported(mode))
+		return -EOPNOTSUPP;
+
+	if (qc71_features.silent_mode)
+		ctrl_3_mask |= CTRL_3_FAN_QUIET;
+
+	if (qc71_features.overclock)
+		ctrl_3_mask |= CTRL_3_OVERBOOST | CTRL_3_HIGH_PWR;
+
+	ops[n++] = QC71_EC_TXN_UPDATE_OP(CTRL_2_ADDR, CTRL_2_TURBO_LEVEL_MASK,
+					 qc71_perf_mode_regs[mode].turbo_level);
+
+	if (ctrl_3_mask)
+		ops[n++] = QC71_EC_TXN_UPDATE_OP(CTRL_3_ADDR, ctrl_3_mask,
+						 qc71_perf_mode_regs[mode].ctrl_3 & ctrl_3_mask);
+
+	if (qc71_features.overclock)
+		ops[n++] = QC71_EC_TXN_UPDATE_OP(CTRL_4_ADDR, CTRL_4_OVERBOOST_DYN_TEMP_OFF,
+						 qc71_perf_mode_regs[mode].ctrl_4);
+
+	return n;
+}
+
+/* the registers are updated in a single transaction, no half-applied modes */
+int qc71_perf_mode_set(enum qc71_perf_mode mode)
+{
+	struct qc71_ec_txn_op ops[QC71_PERF_MODE_MAX_OPS];
+	int n = qc71_perf_mode_ops(mode, ops), err;
+
+	if (n < 0)
+		return n;
+
+	mutex_lock(&qc71_perf_mode_lock);
+	err = qc71_ec_txn_execute(ops, n);
+	mutex_unlock(&qc71_perf_mode_lock);
+
+	if (!err)
+		qc71_perf_mode_selected();
+
+	return err;
+}
+
+/* for the modes selected without qc71_perf_mode_set() */
+void qc71_perf_mode_selected(void)
+{
+	atomic_inc(&qc71_perf_mode_selections);
+}
+
+/* changes whenever a mode is selected, so temporary changes can tell if they were overridden */
+unsigned int qc71_perf_mode_selection(void)
+{
+	return atomic_read(&qc71_perf_mode_selections);
+}
+
+/* announces a change not made via the platform_profile interface */
+void qc71_perf_mode_notify(void)
+{
+	qc71_platform_profile_notify();
+
+	if (qc71_platform_dev)
+		sysfs_notify(&qc71_platform_dev->dev.kobj, NULL, "perf_mode");
+}
+
+/* returns the supported mode following 'current' in the cycle, or a negative errno */
+static int qc71_perf_mode_next(int current_mode)
+{
+	size_t i, start = 0;
+	int next = -ENOENT;
+
+	mutex_lock(&qc71_perf_mode_cycle_lock);
+
+	for (i = 0; i < qc71_perf_mode_cycle_len; i++) {
+		if (qc71_perf_mode_cycle[i] == current_mode) {
+			start = i + 1;
+			break;
+		}
+	}
+
+	for (i = 0; i < qc71_perf_mode_cycle_len; i++) {
+		uint8_t mode = qc71_perf_mode_cycle[(start + i) % qc71_perf_mode_cycle_len];
+
+		if (mode != current_mode && qc71_perf_mode_supported(mode)) {
+			next = mode;
+			break;
+		}
+	}
+
+	mutex_unlock(&qc71_perf_mode_cycle_lock);
+
+	return next;
+}
+
+/* event handlers */
+
+/* the registers have already been invalidated by the event code */
+static void qc71_perf_mode_event(unsigned int code)
+{
+	int mode = qc71_perf_mode_get();
+
+	if (mode >= 0)
+		mode = qc71_perf_mode_next(mode);
+
+	if (mode >= 0) {
+		int err = qc71_perf_mode_set(mode);
+
+		if (err)
+			pr_warn("failed to switch to the %s mode: %d\n",
+				qc71_perf_mode_names[mode], err);
+		else
+			pr_debug("switched to the %s mode\n", qc71_perf_mode_names[mode]);
+	}
+
+	qc71_perf_mode_notify();
+}
+
+static struct qc71_wmi_event_handler qc71_perf_mode_event_handler = {
+	.code = QC71_EVENT_PERF_MODE,
+	.fn = qc71_perf_mode_event,
+};
+
+/* ========================================================================== */
+
+int __init qc71_perf_mode_setup(void)
+{
+	return qc71_wmi_event_register(&qc71_perf_mode_event_handler);
+}
+
+void qc71_perf_mode_cleanup(void)
+{
+	qc71_wmi_event_unregister(&qc71_perf_mode_event_handler);
+}
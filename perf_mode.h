@@ -0,0 +1,38 @@
+// SPDX-License-Identifier: GPL-2.0
+#ifndef QC71_PERF_MODE_H
+#define QC71_PERF_MODE_H
+
+#include <linux/init.h>
+#include <linux/types.h>
+
+/* ========================================================================== */
+
+enum qc71_perf_mode {
+	QC71_PERF_MODE_LOW_POWER,
+	QC71_PERF_MODE_QUIET,
+	QC71_PERF_MODE_BALANCED,
+	QC71_PERF_MODE_PERFORMANCE,
+	QC71_PERF_MODE_COUNT,
+};
+
+#define QC71_PERF_MODE_MAX_OPS 3
+
+extern const char * const qc71_perf_mode_names[QC71_PERF_MODE_COUNT];
+
+struct qc71_ec_txn_op;
+
+/* ========================================================================== */
+
+int  __init qc71_perf_mode_setup(void);
+void        qc71_perf_mode_cleanup(void);
+
+bool qc71_perf_mode_supported(enum qc71_perf_mode mode);
+int qc71_perf_mode_parse(const char *buf);
+int qc71_perf_mode_ops(enum qc71_perf_mode mode, struct qc71_ec_txn_op *ops);
+int qc71_perf_mode_get(void);
+int qc71_perf_mode_set(enum qc71_perf_mode mode);
+void qc71_perf_mode_notify(void);
+void qc71_perf_mode_selected(void);
+unsigned int qc71_perf_mode_selection(void);
+
+#endif /* QC71_PERF_MODE_H */
@@ -0,0 +1,187 @@
+// SPDX-License-Identifier: GPL-2.0
+#include "pr.h"
+
+#include <linux/bitmap.h>
+#include <linux/bug.h>
+#include <linux/device.h>
+#include <linux/err.h>
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/platform_profile.h>
+#include <linux/sysfs.h>
+#include <linux/types.h>
+#include <linux/version.h>
+
+#include "pdev.h"
+#include "perf_mode.h"
+#include "platform_profile.h"
+
+/* ========================================================================== */
+
+static const enum platform_profile_option qc71_profile_options[QC71_PERF_MODE_COUNT] = {
+	[QC71_PERF_MODE_LOW_POWER]   = PLATFORM_PROFILE_LOW_POWER,
+	[QC71_PERF_MODE_QUIET]       = PLATFORM_PROFILE_QUIET,
+	[QC71_PERF_MODE_BALANCED]    = PLATFORM_PROFILE_BALANCED,
+	[QC71_PERF_MODE_PERFORMANCE] = PLATFORM_PROFILE_PERFORMANCE,
+};
+
+static bool qc71_platform_profile_registered;
+
+/* ========================================================================== */
+
+static int qc71_profile_get(enum platform_profile_option *profile)
+{
+	int mode = qc71_perf_mode_get();
+
+	if (mode < 0)
+		return mode;
+
+	*profile = qc71_profile_options[mode];
+
+	return 0;
+}
+
+static int qc71_profile_set(enum platform_profile_option profile)
+{
+	enum qc71_perf_mode mode;
+
+	for (mode = 0; mode < QC71_PERF_MODE_COUNT; mode++) {
+		int err;
+
+		if (qc71_profile_options[mode] != profile)
+			continue;
+
+		err = qc71_perf_mode_set(mode);
+		if (!err)
+			sysfs_notify(&qc71_platform_dev->dev.kobj, NULL, "perf_mode");
+
+		return err;
+	}
+
+	return -EOPNOTSUPP;
+}
+
+static void qc71_profile_choices(unsigned long *choices)
+{
+	enum qc71_perf_mode mode;
+
+	for (mode = 0; mode < QC71_PERF_MODE_COUNT; mode++)
+		if (qc71_perf_mode_supported(mode))
+			set_bit(qc71_profile_options[mode], choices);
+}
+
+/* ========================================================================== */
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 14, 0)
+
+static struct device *qc71_platform_profile_dev;
+
+static int qc71_platform_profile_probe(void *drvdata, unsigned long *choices)
+{
+	qc71_profile_choices(choices);
+	return 0;
+}
+
+static int qc71_platform_profile_get(struct device *dev, enum platform_profile_option *profile)
+{
+	return qc71_profile_get(profile);
+}
+
+static int qc71_platform_profile_set(struct device *dev, enum platform_profile_option profile)
+{
+	return qc71_profile_set(profile);
+}
+
+static const struct platform_profile_ops qc71_platform_profile_ops = {
+	.probe = qc71_platform_profile_probe,
+	.profile_get = qc71_platform_profile_get,
+	.profile_set = qc71_platform_profile_set,
+};
+
+static int qc71_platform_profile_register(void)
+{
+	struct device *dev = platform_profile_register(&qc71_platform_dev->dev, KBUILD_MODNAME,
+						       NULL, &qc71_platform_profile_ops);
+
+	if (IS_ERR(dev))
+		return PTR_ERR(dev);
+
+	qc71_platform_profile_dev = dev;
+
+	return 0;
+}
+
+static void qc71_platform_profile_remove(void)
+{
+	platform_profile_remove(qc71_platform_profile_dev);
+}
+
+static void qc71_platform_profile_do_notify(void)
+{
+	platform_profile_notify(qc71_platform_profile_dev);
+}
+
+#else
+
+static int qc71_platform_profile_get(struct platform_profile_handler *pprof,
+				     enum platform_profile_option *profile)
+{
+	return qc71_profile_get(profile);
+}
+
+static int qc71_platform_profile_set(struct platform_profile_handler *pprof,
+				     enum platform_profile_option profile)
+{
+	return qc71_profile_set(profile);
+}
+
+static struct platform_profile_handler qc71_platform_profile_handler = {
+	.profile_get = qc71_platform_profile_get,
+	.profile_set = qc71_platform_profile_set,
+};
+
+static int qc71_platform_profile_register(void)
+{
+	qc71_profile_choices(qc71_platform_profile_handler.choices);
+
+	return platform_profile_register(&qc71_platform_profile_handler);
+}
+
+static void qc71_platform_profile_remove(void)
+{
+	platform_profile_remove();
+}
+
+static void qc71_platform_profile_do_notify(void)
+{
+	platform_profile_notify();
+}
+
+#endif
+
+/* ========================================================================== */
+
+/* must not be called from the profile_set() callback */
+void qc71_platform_profile_notify(void)
+{
+	if (qc71_platform_profile_registered)
+		qc71_platform_profile_do_notify();
+}
+
+int __init qc71_platform_profile_setup(void)
+{
+	int err = qc71_platform_profile_register();
+
+	if (err)
+		return err;
+
+	qc71_platform_profile_registered = true;
+
+	return 0;
+}
+
+void qc71_platform_profile_cleanup(void)
+{
+	qc71_platform_profile_registered = false;
+	qc71_platform_profile_remove();
+}
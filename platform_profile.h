@@ -0,0 +1,33 @@
+// SPDX-License-Identifier: GPL-2.0
+#ifndef QC71_PLATFORM_PROFILE_H
+#define QC71_PLATFORM_PROFILE_H
+
+#if IS_ENABLED(CONFIG_ACPI_PLATFORM_PROFILE)
+
+#include <linux/init.h>
+
+int  __init qc71_platform_profile_setup(void);
+void        qc71_platform_profile_cleanup(void);
+
+void qc71_platform_profile_notify(void);
+
+#else
+
+static inline int qc71_platform_profile_setup(void)
+{
+	return 0;
+}
+
+static inline void qc71_platform_profile_cleanup(void)
+{
+
+}
+
+static inline void qc71_platform_profile_notify(void)
+{
+
+}
+
+#endif
+
+#endif /* QC71_PLATFORM_PROFILE_H */
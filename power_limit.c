@@ -0,0 +1,175 @@
+// SPDX-License-Identifier: GPL-2.0
+#include "pr.h"
+
+#include <linux/bug.h>
+#include <linux/errno.h>
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/moduleparam.h>
+#include <linux/mutex.h>
+#include <linux/types.h>
+
+#include "ec.h"
+#include "power_limit.h"
+
+/* ========================================================================== */
+
+static const uint16_t qc71_power_limit_addrs[QC71_POWER_LIMIT_COUNT] = {
+	[QC71_POWER_LIMIT_PL1] = PL1_ADDR,
+	[QC71_POWER_LIMIT_PL2] = PL2_ADDR,
+	[QC71_POWER_LIMIT_PL4] = PL4_ADDR,
+};
+
+static unsigned int power_limit_max_w;
+module_param(power_limit_max_w, uint, 0444);
+MODULE_PARM_DESC(power_limit_max_w, "highest power limit in watts, the power limits cannot be changed without it (default=0)");
+
+/* nothing is allowed above it */
+static unsigned int qc71_power_limit_max_w;
+
+/* serializes the check of the ordering of the limits with their update */
+DEFINE_MUTEX(qc71_power_limit_lock);
+
+/* ========================================================================== */
+
+unsigned int qc71_power_limit_max(void)
+{
+	return qc71_power_limit_max_w;
+}
+
+/* returns the limit in watts */
+int qc71_power_limit_get(enum qc71_power_limit pl)
+{
+	if (pl >= QC71_POWER_LIMIT_COUNT)
+		return -EINVAL;
+
+	return ec_read_byte(qc71_power_limit_addrs[pl]);
+}
+
+/*
+ * negative values leave the given limit unchanged, the resulting limits must
+ * satisfy PL1 <= PL2 <= PL4; fills 'ops' (at most QC71_POWER_LIMIT_COUNT)
+ * with the updates, and returns their number; 'qc71_power_limit_lock' must
+ * be held until they are executed
+ */
+int qc71_power_limit_ops(const int watts[QC71_POWER_LIMIT_COUNT], struct qc71_ec_txn_op *ops)
+{
+	int limits[QC71_POWER_LIMIT_COUNT];
+	int i, n = 0;
+
+	if (!qc71_power_limit_max_w)
+		return -ENODEV;
+
+	for (i = 0; i < QC71_POWER_LIMIT_COUNT; i++) {
+		if (watts[i] < 0) {
+			limits[i] = qc71_power_limit_get(i);
+			if (limits[i] < 0)
+				return limits[i];
+		} else if (watts[i] < QC71_POWER_LIMIT_MIN_W || watts[i] > qc71_power_limit_max_w) {
+			return -ERANGE;
+		} else {
+			limits[i] = watts[i];
+			ops[n++] = QC71_EC_TXN_UPDATE_OP(qc71_power_limit_addrs[i], 0xFF, watts[i]);
+		}
+	}
+
+	if (limits[QC71_POWER_LIMIT_PL1] > limits[QC71_POWER_LIMIT_PL2] ||
+	    limits[QC71_POWER_LIMIT_PL2] > limits[QC71_POWER_LIMIT_PL4])
+		return -EINVAL;
+
+	return n;
+}
+
+/*
+ * the limits are written in a single transaction; if 'expected' is not NULL,
+ * nothing is written and -EAGAIN is returned unless its non-negative entries
+ * match the current limits
+ */
+static int __qc71_power_limit_update(const int expected[QC71_POWER_LIMIT_COUNT],
+				     const int watts[QC71_POWER_LIMIT_COUNT])
+{
+	struct qc71_ec_txn_op ops[QC71_POWER_LIMIT_COUNT];
+	int i, n, err = 0;
+
+	mutex_lock(&qc71_power_limit_lock);
+
+	for (i = 0; expected && i < QC71_POWER_LIMIT_COUNT; i++) {
+		if (expected[i] < 0)
+			continue;
+
+		err = qc71_power_limit_get(i);
+		if (err < 0)
+			goto out;
+
+		if (err != expected[i]) {
+			err = -EAGAIN;
+			goto out;
+		}
+
+		err = 0;
+	}
+
+	n = qc71_power_limit_ops(watts, ops);
+	if (n < 0)
+		err = n;
+	else if (n)
+		err = qc71_ec_txn_execute(ops, n);
+
+out:
+	mutex_unlock(&qc71_power_limit_lock);
+
+	return err;
+}
+
+int qc71_power_limit_update(const int watts[QC71_POWER_LIMIT_COUNT])
+{
+	return __qc71_power_limit_update(NULL, watts);
+}
+
+/* for the writers that must not overwrite the limits set by someone else */
+int qc71_power_limit_replace(const int expected[QC71_POWER_LIMIT_COUNT],
+			     const int watts[QC71_POWER_LIMIT_COUNT])
+{
+	return __qc71_power_limit_update(expected, watts);
+}
+
+int qc71_power_limit_set(enum qc71_power_limit pl, unsigned int watts)
+{
+	int limits[QC71_POWER_LIMIT_COUNT] = { -1, -1, -1 };
+
+	if (pl >= QC71_POWER_LIMIT_COUNT)
+		return -EINVAL;
+
+	limits[pl] = min_t(unsigned int, watts, INT_MAX);
+
+	return qc71_power_limit_update(limits);
+}
+
+/* ========================================================================== */
+
+int __init qc71_power_limit_setup(void)
+{
+	/*
+	 * the factory peak limits of the models are not known, and the PL4
+	 * register cannot be trusted: anything written to it before the
+	 * module was loaded would become the new maximum
+	 */
+	if (!power_limit_max_w)
+		return -ENODEV;
+
+	if (power_limit_max_w < QC71_POWER_LIMIT_MIN_W || power_limit_max_w > U8_MAX) {
+		pr_warn("invalid peak power limit: %u W\n", power_limit_max_w);
+		return -EINVAL;
+	}
+
+	qc71_power_limit_max_w = power_limit_max_w;
+
+	pr_info("peak power limit: %u W\n", qc71_power_limit_max_w);
+
+	return 0;
+}
+
+void qc71_power_limit_cleanup(void)
+{
+	qc71_power_limit_max_w = 0;
+}
@@ -0,0 +1,38 @@
+// SPDX-License-Identifier: GPL-2.0
+#ifndef QC71_POWER_LIMIT_H
+#define QC71_POWER_LIMIT_H
+
+#include <linux/init.h>
+#include <linux/mutex.h>
+#include <linux/types.h>
+
+/* ========================================================================== */
+
+enum qc71_power_limit {
+	QC71_POWER_LIMIT_PL1, /* long term */
+	QC71_POWER_LIMIT_PL2, /* short term */
+	QC71_POWER_LIMIT_PL4, /* peak */
+	QC71_POWER_LIMIT_COUNT,
+};
+
+#define QC71_POWER_LIMIT_MIN_W 5
+
+struct qc71_ec_txn_op;
+
+extern struct mutex qc71_power_limit_lock;
+
+/* ========================================================================== */
+
+int  __init qc71_power_limit_setup(void);
+void        qc71_power_limit_cleanup(void);
+
+unsigned int qc71_power_limit_max(void);
+
+int qc71_power_limit_get(enum qc71_power_limit pl);
+int qc71_power_limit_set(enum qc71_power_limit pl, unsigned int watts);
+int qc71_power_limit_ops(const int watts[QC71_POWER_LIMIT_COUNT], struct qc71_ec_txn_op *ops);
+int qc71_power_limit_update(const int watts[QC71_POWER_LIMIT_COUNT]);
+int qc71_power_limit_replace(const int expected[QC71_POWER_LIMIT_COUNT],
+			     const int watts[QC71_POWER_LIMIT_COUNT]);
+
+#endif /* QC71_POWER_LIMIT_H */
@@ -0,0 +1,153 @@
+// SPDX-License-Identifier: GPL-2.0
+#include "pr.h"
+
+#include <linux/err.h>
+#include <linux/errno.h>
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/math64.h>
+#include <linux/powercap.h>
+#include <linux/types.h>
+
+#include "power_limit.h"
+#include "powercap.h"
+
+/* ========================================================================== */
+
+#define UW_PER_W 1000000ULL
+
+static const char * const qc71_powercap_constraint_names[QC71_POWER_LIMIT_COUNT] = {
+	[QC71_POWER_LIMIT_PL1] = "long_term",
+	[QC71_POWER_LIMIT_PL2] = "short_term",
+	[QC71_POWER_LIMIT_PL4] = "peak_power",
+};
+
+static struct powercap_control_type *qc71_powercap_control_type;
+static struct powercap_zone qc71_powercap_zone;
+static bool qc71_powercap_zone_registered;
+
+/* ========================================================================== */
+
+static int qc71_powercap_get_max_power_range_uw(struct powercap_zone *zone, u64 *value)
+{
+	*value = qc71_power_limit_max() * UW_PER_W;
+	return 0;
+}
+
+static const struct powercap_zone_ops qc71_powercap_zone_ops = {
+	.get_max_power_range_uw = qc71_powercap_get_max_power_range_uw,
+};
+
+/* ========================================================================== */
+
+static int qc71_powercap_set_power_limit_uw(struct powercap_zone *zone, int id, u64 value)
+{
+	u64 watts = div_u64(value, UW_PER_W);
+
+	if (watts > qc71_power_limit_max())
+		return -ERANGE;
+
+	return qc71_power_limit_set(id, watts);
+}
+
+static int qc71_powercap_get_power_limit_uw(struct powercap_zone *zone, int id, u64 *value)
+{
+	int status = qc71_power_limit_get(id);
+
+	if (status < 0)
+		return status;
+
+	*value = status * UW_PER_W;
+
+	return 0;
+}
+
+/* the time windows are managed by the firmware */
+static int qc71_powercap_set_time_window_us(struct powercap_zone *zone, int id, u64 value)
+{
+	return -EOPNOTSUPP;
+}
+
+static int qc71_powercap_get_time_window_us(struct powercap_zone *zone, int id, u64 *value)
+{
+	return -EOPNOTSUPP;
+}
+
+static int qc71_powercap_get_max_power_uw(struct powercap_zone *zone, int id, u64 *value)
+{
+	*value = qc71_power_limit_max() * UW_PER_W;
+	return 0;
+}
+
+static int qc71_powercap_get_min_power_uw(struct powercap_zone *zone, int id, u64 *value)
+{
+	*value = QC71_POWER_LIMIT_MIN_W * UW_PER_W;
+	return 0;
+}
+
+static const char *qc71_powercap_get_name(struct powercap_zone *zone, int id)
+{
+	if (id < 0 || id >= QC71_POWER_LIMIT_COUNT)
+		return NULL;
+
+	return qc71_powercap_constraint_names[id];
+}
+
+static const struct powercap_zone_constraint_ops qc71_powercap_constraint_ops = {
+	.set_power_limit_uw = qc71_powercap_set_power_limit_uw,
+	.get_power_limit_uw = qc71_powercap_get_power_limit_uw,
+	.set_time_window_us = qc71_powercap_set_time_window_us,
+	.get_time_window_us = qc71_powercap_get_time_window_us,
+	.get_max_power_uw = qc71_powercap_get_max_power_uw,
+	.get_min_power_uw = qc71_powercap_get_min_power_uw,
+	.get_name = qc71_powercap_get_name,
+};
+
+/* ========================================================================== */
+
+int __init qc71_powercap_setup(void)
+{
+	struct powercap_zone *zone;
+	int err;
+
+	/* the power_limit submodule failed to initialize */
+	if (!qc71_power_limit_max())
+		return -ENODEV;
+
+	qc71_powercap_control_type = powercap_register_control_type(NULL, KBUILD_MODNAME, NULL);
+	if (IS_ERR(qc71_powercap_control_type)) {
+		err = PTR_ERR(qc71_powercap_control_type);
+		qc71_powercap_control_type = NULL;
+		goto out;
+	}
+
+	zone = powercap_register_zone(&qc71_powercap_zone, qc71_powercap_control_type,
+				      "package-0", NULL, &qc71_powercap_zone_ops,
+				      QC71_POWER_LIMIT_COUNT, &qc71_powercap_constraint_ops);
+	if (IS_ERR(zone)) {
+		err = PTR_ERR(zone);
+		goto out;
+	}
+
+	qc71_powercap_zone_registered = true;
+	err = 0;
+
+out:
+	if (err)
+		qc71_powercap_cleanup();
+
+	return err;
+}
+
+void qc71_powercap_cleanup(void)
+{
+	if (qc71_powercap_zone_registered) {
+		powercap_unregister_zone(qc71_powercap_control_type, &qc71_powercap_zone);
+		qc71_powercap_zone_registered = false;
+	}
+
+	if (qc71_powercap_control_type) {
+		powercap_unregister_control_type(qc71_powercap_control_type);
+		qc71_powercap_control_type = NULL;
+	}
+}
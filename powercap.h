@@ -0,0 +1,26 @@
+// SPDX-License-Identifier: GPL-2.0
+#ifndef QC71_POWERCAP_H
+#define QC71_POWERCAP_H
+
+#if IS_ENABLED(CONFIG_POWERCAP)
+
+#include <linux/init.h>
+
+int  __init qc71_powercap_setup(void);
+void        qc71_powercap_cleanup(void);
+
+#else
+
+static inline int qc71_powercap_setup(void)
+{
+	return 0;
+}
+
+static inline void qc71_powercap_cleanup(void)
+{
+
+}
+
+#endif
+
+#endif /* QC71_POWERCAP_H */
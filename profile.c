@@ -0,0 +1,648 @@
+// SPDX-License-Identifier: GPL-2.0
+#include "pr.h"
+
+#include <linux/configfs.h>
+#include <linux/err.h>
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/mutex.h>
+#include <linux/notifier.h>
+#include <linux/power_supply.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/types.h>
+#include <linux/workqueue.h>
+
+#include "codec.h"
+#include "ec.h"
+#include "events.h"
+#include "features.h"
+#include "led_lightbar.h"
+#include "perf_mode.h"
+#include "power_limit.h"
+#include "profile.h"
+
+/* ========================================================================== */
+
+enum qc71_profile_field {
+	QC71_PROFILE_FAN_ALWAYS_ON,
+	QC71_PROFILE_FAN_REDUCED_DUTY_CYCLE,
+	QC71_PROFILE_CHARGE_LIMIT,
+	QC71_PROFILE_LIGHTBAR,
+	QC71_PROFILE_LIGHTBAR_POWER_SAVE,
+	QC71_PROFILE_LIGHTBAR_COLOR,
+	QC71_PROFILE_PERF_MODE,
+	QC71_PROFILE_PL1,
+	QC71_PROFILE_PL2,
+	QC71_PROFILE_PL4,
+	QC71_PROFILE_FIELD_COUNT,
+};
+
+/* the accepted range of the fields, the perf mode is stored as 'enum qc71_perf_mode' */
+static const struct {
+	int min, max;
+} qc71_profile_field_ranges[QC71_PROFILE_FIELD_COUNT] = {
+	[QC71_PROFILE_FAN_ALWAYS_ON]          = { 0, 1 },
+	[QC71_PROFILE_FAN_REDUCED_DUTY_CYCLE] = { 0, 1 },
+	[QC71_PROFILE_CHARGE_LIMIT]           = { 1, 100 },
+	[QC71_PROFILE_LIGHTBAR]               = { 0, 1 },
+	[QC71_PROFILE_LIGHTBAR_POWER_SAVE]    = { 0, 1 },
+	[QC71_PROFILE_LIGHTBAR_COLOR]         = { 0, 999 },
+	[QC71_PROFILE_PERF_MODE]              = { 0, QC71_PERF_MODE_COUNT - 1 },
+	[QC71_PROFILE_PL1]                    = { QC71_POWER_LIMIT_MIN_W, 255 },
+	[QC71_PROFILE_PL2]                    = { QC71_POWER_LIMIT_MIN_W, 255 },
+	[QC71_PROFILE_PL4]                    = { QC71_POWER_LIMIT_MIN_W, 255 },
+};
+
+struct qc71_profile {
+	struct config_item item;
+	int fields[QC71_PROFILE_FIELD_COUNT]; /* negative if not set */
+};
+
+/* ========================================================================== */
+
+/* protects the fields of the profiles, and serializes their application */
+static DEFINE_MUTEX(qc71_profile_lock);
+static char *qc71_profile_active; /* the name of the last applied profile */
+static char *qc71_profile_on_ac, *qc71_profile_on_battery;
+static int qc71_profile_supplied = -1; /* the power source the profile was last chosen for */
+
+static struct configfs_subsystem qc71_profile_subsys;
+static struct config_group qc71_profiles_group;
+
+/* ========================================================================== */
+
+static inline struct qc71_profile *to_qc71_profile(struct config_item *item)
+{
+	return container_of(item, struct qc71_profile, item);
+}
+
+static bool qc71_profile_changes_turbo(const struct qc71_ec_txn_op *ops, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		if (ops[i].addr == CTRL_2_ADDR && (ops[i].mask & CTRL_2_TURBO_LEVEL_MASK))
+			return true;
+	}
+
+	return false;
+}
+
+/* 'qc71_profile_lock' must be held */
+static int qc71_profile_apply(const int fields[QC71_PROFILE_FIELD_COUNT])
+{
+	struct qc71_ec_txn_op ops[QC71_EC_TXN_MAX_OPS];
+	int limits[QC71_POWER_LIMIT_COUNT];
+	uint8_t mask = 0, value = 0;
+	int err, n = 0, pl_start, pl_n = 0;
+
+	/* fan extras */
+	if (fields[QC71_PROFILE_FAN_ALWAYS_ON] >= 0) {
+		mask |= BIOS_CTRL_3_FAN_ALWAYS_ON;
+		if (fields[QC71_PROFILE_FAN_ALWAYS_ON])
+			value |= BIOS_CTRL_3_FAN_ALWAYS_ON;
+	}
+
+	if (fields[QC71_PROFILE_FAN_REDUCED_DUTY_CYCLE] >= 0) {
+		mask |= BIOS_CTRL_3_FAN_REDUCED_DUTY_CYCLE;
+		if (fields[QC71_PROFILE_FAN_REDUCED_DUTY_CYCLE])
+			value |= BIOS_CTRL_3_FAN_REDUCED_DUTY_CYCLE;
+	}
+
+	if (mask) {
+		if (!qc71_features.fan_extras)
+			return -EOPNOTSUPP;
+
+		ops[n++] = QC71_EC_TXN_UPDATE_OP(BIOS_CTRL_3_ADDR, mask, value);
+	}
+
+	/* battery */
+	if (fields[QC71_PROFILE_CHARGE_LIMIT] >= 0) {
+		if (!qc71_features.batt_charge_limit)
+			return -EOPNOTSUPP;
+
+		ops[n++] = QC71_EC_TXN_UPDATE_OP(BATT_CHARGE_CTRL_ADDR, BATT_CHARGE_CTRL_VALUE_MASK,
+						 qc71_charge_limit_to_ec(fields[QC71_PROFILE_CHARGE_LIMIT]));
+	}
+
+	/* lightbar */
+	mask = 0;
+	value = 0;
+
+	if (fields[QC71_PROFILE_LIGHTBAR] >= 0) {
+		mask |= LIGHTBAR_CTRL_S0_OFF;
+		if (!fields[QC71_PROFILE_LIGHTBAR])
+			value |= LIGHTBAR_CTRL_S0_OFF;
+	}
+
+	if (fields[QC71_PROFILE_LIGHTBAR_POWER_SAVE] >= 0) {
+		mask |= LIGHTBAR_CTRL_POWER_SAVE;
+		if (fields[QC71_PROFILE_LIGHTBAR_POWER_SAVE])
+			value |= LIGHTBAR_CTRL_POWER_SAVE;
+	}
+
+	if (mask || fields[QC71_PROFILE_LIGHTBAR_COLOR] >= 0) {
+		if (!qc71_features.lightbar)
+			return -EOPNOTSUPP;
+	}
+
+	if (mask)
+		ops[n++] = QC71_EC_TXN_UPDATE_OP(LIGHTBAR_CTRL_ADDR, mask, value);
+
+	if (fields[QC71_PROFILE_LIGHTBAR_COLOR] >= 0) {
+		err = qc71_lightbar_color_ops(fields[QC71_PROFILE_LIGHTBAR_COLOR], &ops[n]);
+		if (err)
+			return err;
+
+		n += LIGHTBAR_COLOR_OPS;
+	}
+
+	/* the turbo level might change the power limits, so it goes first */
+	if (fields[QC71_PROFILE_PERF_MODE] >= 0) {
+		err = qc71_perf_mode_ops(fields[QC71_PROFILE_PERF_MODE], &ops[n]);
+		if (err < 0)
+			return err;
+
+		n += err;
+	}
+
+	limits[QC71_POWER_LIMIT_PL1] = fields[QC71_PROFILE_PL1];
+	limits[QC71_POWER_LIMIT_PL2] = fields[QC71_PROFILE_PL2];
+	limits[QC71_POWER_LIMIT_PL4] = fields[QC71_PROFILE_PL4];
+
+	BUILD_BUG_ON(3 + LIGHTBAR_COLOR_OPS + QC71_PERF_MODE_MAX_OPS +
+		     QC71_POWER_LIMIT_COUNT > QC71_EC_TXN_MAX_OPS);
+
+	/* the next frame would overwrite the color of the profile */
+	if (fields[QC71_PROFILE_LIGHTBAR_COLOR] >= 0)
+		qc71_lightbar_effect_stop();
+
+	/* the limits must not change between the checks and the writes */
+	mutex_lock(&qc71_power_limit_lock);
+
+	pl_start = n;
+
+	if (limits[0] >= 0 || limits[1] >= 0 || limits[2] >= 0) {
+		pl_n = qc71_power_limit_ops(limits, &ops[pl_start]);
+		if (pl_n < 0) {
+			err = pl_n;
+			goto out;
+		}
+	}
+
+	/* only the fields that differ from the current state are written */
+	n = qc71_ec_txn_prune(ops, pl_start);
+
+	/*
+	 * the firmware might change the power limits when the turbo level
+	 * changes, so then all of them are written, even if they are the
+	 * same as before
+	 */
+	if (!qc71_profile_changes_turbo(ops, n))
+		pl_n = qc71_ec_txn_prune(&ops[pl_start], pl_n);
+
+	memmove(&ops[n], &ops[pl_start], pl_n * sizeof(*ops));
+	n += pl_n;
+
+	err = 0;
+	if (!n)
+		goto out;
+
+	/* a profile is applied entirely or not at all */
+	err = qc71_ec_txn_execute_flags(ops, n, QC71_EC_TXN_ROLLBACK);
+
+	/* even a failed transaction might have changed it */
+	if (fields[QC71_PROFILE_LIGHTBAR_COLOR] >= 0)
+		qc71_lightbar_color_changed();
+
+	/* an effect is paused while the lightbar is off */
+	if (fields[QC71_PROFILE_LIGHTBAR] >= 0)
+		qc71_lightbar_effect_resume();
+
+out:
+	mutex_unlock(&qc71_power_limit_lock);
+
+	return err;
+}
+
+int qc71_profile_apply_by_name(const char *name)
+{
+	int fields[QC71_PROFILE_FIELD_COUNT];
+	struct config_item *item;
+	char *active;
+	int err;
+
+	active = kstrdup(name, GFP_KERNEL);
+	if (!active)
+		return -ENOMEM;
+
+	mutex_lock(&qc71_profile_subsys.su_mutex);
+	item = config_group_find_item(&qc71_profiles_group, name);
+	mutex_unlock(&qc71_profile_subsys.su_mutex);
+
+	if (!item) {
+		kfree(active);
+		return -ENOENT;
+	}
+
+	mutex_lock(&qc71_profile_lock);
+
+	memcpy(fields, to_qc71_profile(item)->fields, sizeof(fields));
+	config_item_put(item);
+
+	err = qc71_profile_apply(fields);
+	if (!err) {
+		swap(active, qc71_profile_active);
+
+		if (fields[QC71_PROFILE_PERF_MODE] >= 0)
+			qc71_perf_mode_selected();
+
+		qc71_perf_mode_notify();
+	}
+
+	mutex_unlock(&qc71_profile_lock);
+
+	kfree(active);
+
+	return err;
+}
+
+/* ========================================================================== */
+/* profile attributes */
+
+static ssize_t qc71_profile_field_show(struct config_item *item, enum qc71_profile_field field,
+				       char *page)
+{
+	int value;
+
+	mutex_lock(&qc71_profile_lock);
+	value = to_qc71_profile(item)->fields[field];
+	mutex_unlock(&qc71_profile_lock);
+
+	if (value < 0)
+		return sprintf(page, "\n");
+
+	if (field == QC71_PROFILE_PERF_MODE)
+		return sprintf(page, "%s\n", qc71_perf_mode_names[value]);
+
+	return sprintf(page, "%d\n", value);
+}
+
+/* an empty string clears the field */
+static ssize_t qc71_profile_field_store(struct config_item *item, enum qc71_profile_field field,
+					const char *page, size_t count)
+{
+	int value;
+
+	if (sysfs_streq(page, "")) {
+		value = -1;
+	} else if (field == QC71_PROFILE_PERF_MODE) {
+		value = qc71_perf_mode_parse(page);
+		if (value < 0)
+			return value;
+	} else if (qc71_profile_field_ranges[field].max == 1) {
+		bool b;
+
+		if (kstrtobool(page, &b))
+			return -EINVAL;
+
+		value = b;
+	} else if (kstrtoint(page, 10, &value) ||
+		   value < qc71_profile_field_ranges[field].min ||
+		   value > qc71_profile_field_ranges[field].max) {
+		return -EINVAL;
+	}
+
+	mutex_lock(&qc71_profile_lock);
+	to_qc71_profile(item)->fields[field] = value;
+	mutex_unlock(&qc71_profile_lock);
+
+	return count;
+}
+
+#define QC71_PROFILE_ATTR(_name, _field)							\
+static ssize_t qc71_profile_##_name##_show(struct config_item *item, char *page)		\
+{												\
+	return qc71_profile_field_show(item, _field, page);					\
+}												\
+static ssize_t qc71_profile_##_name##_store(struct config_item *item,				\
+					     const char *page, size_t count)			\
+{												\
+	return qc71_profile_field_store(item, _field, page, count);				\
+}												\
+CONFIGFS_ATTR(qc71_profile_, _name)
+
+QC71_PROFILE_ATTR(fan_always_on,          QC71_PROFILE_FAN_ALWAYS_ON);
+QC71_PROFILE_ATTR(fan_reduced_duty_cycle, QC71_PROFILE_FAN_REDUCED_DUTY_CYCLE);
+QC71_PROFILE_ATTR(charge_limit,           QC71_PROFILE_CHARGE_LIMIT);
+QC71_PROFILE_ATTR(lightbar,               QC71_PROFILE_LIGHTBAR);
+QC71_PROFILE_ATTR(lightbar_power_save,    QC71_PROFILE_LIGHTBAR_POWER_SAVE);
+QC71_PROFILE_ATTR(lightbar_color,         QC71_PROFILE_LIGHTBAR_COLOR);
+QC71_PROFILE_ATTR(perf_mode,              QC71_PROFILE_PERF_MODE);
+QC71_PROFILE_ATTR(pl1,                    QC71_PROFILE_PL1);
+QC71_PROFILE_ATTR(pl2,                    QC71_PROFILE_PL2);
+QC71_PROFILE_ATTR(pl4,                    QC71_PROFILE_PL4);
+
+#undef QC71_PROFILE_ATTR
+
+static struct configfs_attribute *qc71_profile_attrs[] = {
+	&qc71_profile_attr_fan_always_on,
+	&qc71_profile_attr_fan_reduced_duty_cycle,
+	&qc71_profile_attr_charge_limit,
+	&qc71_profile_attr_lightbar,
+	&qc71_profile_attr_lightbar_power_save,
+	&qc71_profile_attr_lightbar_color,
+	&qc71_profile_attr_perf_mode,
+	&qc71_profile_attr_pl1,
+	&qc71_profile_attr_pl2,
+	&qc71_profile_attr_pl4,
+	NULL
+};
+
+static void qc71_profile_release(struct config_item *item)
+{
+	kfree(to_qc71_profile(item));
+}
+
+static struct configfs_item_operations qc71_profile_item_ops = {
+	.release = qc71_profile_release,
+};
+
+static const struct config_item_type qc71_profile_type = {
+	.ct_item_ops = &qc71_profile_item_ops,
+	.ct_attrs = qc71_profile_attrs,
+	.ct_owner = THIS_MODULE,
+};
+
+/* ========================================================================== */
+/* profiles group */
+
+static struct config_item *qc71_profiles_make_item(struct config_group *group, const char *name)
+{
+	struct qc71_profile *profile = kzalloc(sizeof(*profile), GFP_KERNEL);
+	size_t i;
+
+	if (!profile)
+		return ERR_PTR(-ENOMEM);
+
+	for (i = 0; i < ARRAY_SIZE(profile->fields); i++)
+		profile->fields[i] = -1;
+
+	config_item_init_type_name(&profile->item, name, &qc71_profile_type);
+
+	return &profile->item;
+}
+
+static struct configfs_group_operations qc71_profiles_group_ops = {
+	.make_item = qc71_profiles_make_item,
+};
+
+static const struct config_item_type qc71_profiles_type = {
+	.ct_group_ops = &qc71_profiles_group_ops,
+	.ct_owner = THIS_MODULE,
+};
+
+/* ========================================================================== */
+/* root attributes */
+
+static ssize_t qc71_profile_root_active_show(struct config_item *item, char *page)
+{
+	ssize_t ret;
+
+	mutex_lock(&qc71_profile_lock);
+	ret = sprintf(page, "%s\n", qc71_profile_active ?: "");
+	mutex_unlock(&qc71_profile_lock);
+
+	return ret;
+}
+
+static ssize_t qc71_profile_root_active_store(struct config_item *item,
+					      const char *page, size_t count)
+{
+	char *name = kstrndup(page, count, GFP_KERNEL);
+	int err;
+
+	if (!name)
+		return -ENOMEM;
+
+	err = qc71_profile_apply_by_name(strim(name));
+
+	kfree(name);
+
+	return err ?: count;
+}
+
+static void qc71_profile_power_work_fn(struct work_struct *work);
+
+static DECLARE_WORK(qc71_profile_power_work, qc71_profile_power_work_fn);
+
+static ssize_t qc71_profile_name_show(char **name, char *page)
+{
+	ssize_t ret;
+
+	mutex_lock(&qc71_profile_lock);
+	ret = sprintf(page, "%s\n", *name ?: "");
+	mutex_unlock(&qc71_profile_lock);
+
+	return ret;
+}
+
+/* the profile is applied right away if the machine is on the given power source */
+static ssize_t qc71_profile_name_store(char **name, const char *page, size_t count)
+{
+	char *buf = kstrndup(page, count, GFP_KERNEL), *s;
+
+	if (!buf)
+		return -ENOMEM;
+
+	s = strim(buf);
+	if (*s)
+		s = kstrdup(s, GFP_KERNEL);
+	else
+		s = NULL;
+
+	kfree(buf);
+
+	mutex_lock(&qc71_profile_lock);
+	swap(*name, s);
+	qc71_profile_supplied = -1;
+	mutex_unlock(&qc71_profile_lock);
+
+	kfree(s);
+
+	schedule_work(&qc71_profile_power_work);
+
+	return count;
+}
+
+static ssize_t qc71_profile_root_on_ac_show(struct config_item *item, char *page)
+{
+	return qc71_profile_name_show(&qc71_profile_on_ac, page);
+}
+
+static ssize_t qc71_profile_root_on_ac_store(struct config_item *item,
+					     const char *page, size_t count)
+{
+	return qc71_profile_name_store(&qc71_profile_on_ac, page, count);
+}
+
+static ssize_t qc71_profile_root_on_battery_show(struct config_item *item, char *page)
+{
+	return qc71_profile_name_show(&qc71_profile_on_battery, page);
+}
+
+static ssize_t qc71_profile_root_on_battery_store(struct config_item *item,
+						  const char *page, size_t count)
+{
+	return qc71_profile_name_store(&qc71_profile_on_battery, page, count);
+}
+
+CONFIGFS_ATTR(qc71_profile_root_, active);
+CONFIGFS_ATTR(qc71_profile_root_, on_ac);
+CONFIGFS_ATTR(qc71_profile_root_, on_battery);
+
+static struct configfs_attribute *qc71_profile_root_attrs[] = {
+	&qc71_profile_root_attr_active,
+	&qc71_profile_root_attr_on_ac,
+	&qc71_profile_root_attr_on_battery,
+	NULL
+};
+
+static const struct config_item_type qc71_profile_root_type = {
+	.ct_attrs = qc71_profile_root_attrs,
+	.ct_owner = THIS_MODULE,
+};
+
+static struct configfs_subsystem qc71_profile_subsys = {
+	.su_group = {
+		.cg_item = {
+			.ci_namebuf = KBUILD_MODNAME,
+			.ci_type = &qc71_profile_root_type,
+		},
+	},
+};
+
+/* ========================================================================== */
+/* power source changes */
+
+/* applies the profile of the current power source if it changed since the last time */
+static void qc71_profile_power_work_fn(struct work_struct *work)
+{
+	int supplied = power_supply_is_system_supplied();
+	char *name = NULL;
+	int err;
+
+	if (supplied < 0)
+		return;
+
+	supplied = !!supplied;
+
+	mutex_lock(&qc71_profile_lock);
+	if (supplied != qc71_profile_supplied) {
+		const char *s = supplied ? qc71_profile_on_ac : qc71_profile_on_battery;
+
+		qc71_profile_supplied = supplied;
+
+		if (s)
+			name = kstrdup(s, GFP_KERNEL);
+	}
+	mutex_unlock(&qc71_profile_lock);
+
+	if (!name)
+		return;
+
+	err = qc71_profile_apply_by_name(name);
+	if (err)
+		pr_warn("failed to apply profile '%s': %d\n", name, err);
+	else
+		pr_debug("applied profile '%s' (%s)\n", name, supplied ? "AC" : "battery");
+
+	kfree(name);
+}
+
+/* the event might arrive before the power supply drivers notice the change, so both are watched */
+static void qc71_profile_ac_event(unsigned int code)
+{
+	schedule_work(&qc71_profile_power_work);
+}
+
+static struct qc71_wmi_event_handler qc71_profile_ac_event_handler = {
+	.code = QC71_EVENT_AC,
+	.fn = qc71_profile_ac_event,
+};
+
+#if IS_ENABLED(CONFIG_POWER_SUPPLY)
+
+/* called in atomic context */
+static int qc71_profile_psy_notify(struct notifier_block *nb, unsigned long event, void *data)
+{
+	const struct power_supply *psy = data;
+
+	if (event == PSY_EVENT_PROP_CHANGED && psy->desc->type != POWER_SUPPLY_TYPE_BATTERY)
+		schedule_work(&qc71_profile_power_work);
+
+	return NOTIFY_DONE;
+}
+
+static struct notifier_block qc71_profile_psy_nb = {
+	.notifier_call = qc71_profile_psy_notify,
+};
+
+static bool qc71_profile_psy_nb_registered;
+
+#endif
+
+/* ========================================================================== */
+
+int __init qc71_profile_setup(void)
+{
+	int err;
+
+	config_group_init(&qc71_profile_subsys.su_group);
+	mutex_init(&qc71_profile_subsys.su_mutex);
+
+	config_group_init_type_name(&qc71_profiles_group, "profiles", &qc71_profiles_type);
+	configfs_add_default_group(&qc71_profiles_group, &qc71_profile_subsys.su_group);
+
+	err = configfs_register_subsystem(&qc71_profile_subsys);
+	if (err)
+		return err;
+
+	(void) qc71_wmi_event_register(&qc71_profile_ac_event_handler);
+
+#if IS_ENABLED(CONFIG_POWER_SUPPLY)
+	err = power_supply_reg_notifier(&qc71_profile_psy_nb);
+	if (err)
+		pr_warn("failed to register power supply notifier: %d\n", err);
+	else
+		qc71_profile_psy_nb_registered = true;
+#endif
+
+	return 0;
+}
+
+void qc71_profile_cleanup(void)
+{
+#if IS_ENABLED(CONFIG_POWER_SUPPLY)
+	if (qc71_profile_psy_nb_registered) {
+		power_supply_unreg_notifier(&qc71_profile_psy_nb);
+		qc71_profile_psy_nb_registered = false;
+	}
+#endif
+
+	qc71_wmi_event_unregister(&qc71_profile_ac_event_handler);
+	cancel_work_sync(&qc71_profile_power_work);
+
+	configfs_unregister_subsystem(&qc71_profile_subsys);
+
+	/* the work might have been queued by a write to 'on_ac' or 'on_battery' */
+	cancel_work_sync(&qc71_profile_power_work);
+
+	kfree(qc71_profile_active);
+	kfree(qc71_profile_on_ac);
+	kfree(qc71_profile_on_battery);
+	qc71_profile_active = NULL;
+	qc71_profile_on_ac = NULL;
+	qc71_profile_on_battery = NULL;
+}
@@ -0,0 +1,35 @@
+// SPDX-License-Identifier: GPL-2.0
+#ifndef QC71_PROFILE_H
+#define QC71_PROFILE_H
+
+#if IS_ENABLED(CONFIG_CONFIGFS_FS)
+
+#include <linux/init.h>
+
+int  __init qc71_profile_setup(void);
+void        qc71_profile_cleanup(void);
+
+int qc71_profile_apply_by_name(const char *name);
+
+#else
+
+#include <linux/errno.h>
+
+static inline int qc71_profile_setup(void)
+{
+	return 0;
+}
+
+static inline void qc71_profile_cleanup(void)
+{
+
+}
+
+static inline int qc71_profile_apply_by_name(const char *name)
+{
+	return -ENODEV;
+}
+
+#endif
+
+#endif /* QC71_PROFILE_H */
@@ -0,0 +1,733 @@
+// SPDX-License-Identifier: GPL-2.0
+#include "pr.h"
+
+#include <linux/bitmap.h>
+#include <linux/debugfs.h>
+#include <linux/fs.h>
+#include <linux/hrtimer.h>
+#include <linux/init.h>
+#include <linux/kthread.h>
+#include <linux/lockdep.h>
+#include <linux/log2.h>
+#include <linux/math64.h>
+#include <linux/moduleparam.h>
+#include <linux/mutex.h>
+#include <linux/overflow.h>
+#include <linux/sched.h>
+#include <linux/spinlock.h>
+#include <linux/string.h>
+#include <linux/types.h>
+#include <linux/uaccess.h>
+#include <linux/vmalloc.h>
+
+#include "ec.h"
+#include "events.h"
+#include "record.h"
+
+#if IS_ENABLED(CONFIG_DEBUG_FS)
+
+/* ========================================================================== */
+
+#define REPLAY_MAX_TRACE_SIZE (64 * 1024 * 1024)
+
+/* the result of a read at the last address extends 3 bytes past the end */
+#define REPLAY_IMAGE_SIZE (U16_MAX + 1 + 3)
+
+/* ========================================================================== */
+
+static unsigned int record_entries = 65536;
+module_param(record_entries, uint, 0644);
+MODULE_PARM_DESC(record_entries, "capacity of the EC/WMI trace recording buffer (default=65536)");
+
+/* ========================================================================== */
+
+static struct dentry *qc71_record_dir,
+		     *qc71_replay_dir;
+
+/* serializes starting, stopping, and reading out the recording */
+static DEFINE_MUTEX(record_lock);
+
+/* protects the following variables */
+static DEFINE_SPINLOCK(record_buf_lock);
+static struct qc71_trace_entry *record_buf;
+static unsigned int record_capacity, record_count, record_dropped;
+static ktime_t record_start;
+static bool record_enabled;
+
+/* protects everything related to replaying, except for 'replay_image' */
+static DEFINE_MUTEX(replay_lock);
+static void *replay_trace;
+static size_t replay_trace_size, replay_trace_alloc;
+static struct task_struct *replay_thread;
+static const struct qc71_ec_backend *replay_prev_backend;
+static u32 replay_speed = 100; /* percent, 0 means no delays */
+
+static DEFINE_SPINLOCK(replay_image_lock);
+static uint8_t *replay_image;
+
+/* ========================================================================== */
+/* recording */
+
+/* the entries are appended together, or not at all */
+static void record_append(const struct qc71_trace_entry *entries, unsigned int n)
+{
+	spin_lock(&record_buf_lock);
+
+	if (record_enabled) {
+		if (record_capacity - record_count >= n) {
+			memcpy(&record_buf[record_count], entries, n * sizeof(*entries));
+			record_count += n;
+		} else {
+			record_dropped += n;
+		}
+	}
+
+	spin_unlock(&record_buf_lock);
+}
+
+static void record_fill_times(struct qc71_trace_entry *entry, ktime_t start)
+{
+	ktime_t now = ktime_get();
+
+	entry->time_ns     = max_t(s64, 0, ktime_to_ns(ktime_sub(start, READ_ONCE(record_start))));
+	entry->duration_ns = min_t(s64, U32_MAX, ktime_to_ns(ktime_sub(now, start)));
+}
+
+void qc71_record_ec_transaction(uint16_t addr, uint16_t data,
+				const union qc71_ec_result *result, bool read,
+				int err, ktime_t start)
+{
+	struct qc71_trace_entry entry = {
+		.addr = addr,
+		.data = data,
+		.err  = err,
+		.type = read ? QC71_TRACE_EC_READ : QC71_TRACE_EC_WRITE,
+	};
+
+	if (!READ_ONCE(record_enabled))
+		return;
+
+	if (result && !err)
+		entry.result = result->dword;
+
+	record_fill_times(&entry, start);
+	record_append(&entry, 1);
+}
+
+#define RECORD_MAX_DATA_ENTRIES DIV_ROUND_UP(QC71_TRACE_MAX_DATA_SIZE, QC71_TRACE_DATA_SIZE)
+
+void qc71_record_wmi_event(u32 value, const union acpi_object *obj, ktime_t start)
+{
+	struct qc71_trace_entry entries[1 + RECORD_MAX_DATA_ENTRIES] = {
+		{
+			.addr = value,
+			.data = obj ? obj->type : ACPI_TYPE_ANY,
+			.type = QC71_TRACE_WMI_EVENT,
+		},
+	};
+	const void *data = NULL;
+	unsigned int i, n = 1;
+	size_t len = 0;
+
+	BUILD_BUG_ON(sizeof(struct qc71_trace_data) != sizeof(struct qc71_trace_entry));
+	BUILD_BUG_ON(offsetof(struct qc71_trace_data, type) != offsetof(struct qc71_trace_entry, type));
+
+	if (!READ_ONCE(record_enabled))
+		return;
+
+	if (obj && obj->type == ACPI_TYPE_INTEGER) {
+		entries[0].result = obj->integer.value;
+	} else if (obj && obj->type == ACPI_TYPE_BUFFER) {
+		data = obj->buffer.pointer;
+		len = obj->buffer.length;
+	} else if (obj && obj->type == ACPI_TYPE_STRING) {
+		data = obj->string.pointer;
+		len = obj->string.length;
+	}
+
+	len = min_t(size_t, len, QC71_TRACE_MAX_DATA_SIZE);
+	if (data)
+		entries[0].result = len;
+
+	for (i = 0; i < len; i += QC71_TRACE_DATA_SIZE, n++) {
+		struct qc71_trace_data *d = (struct qc71_trace_data *) &entries[n];
+
+		d->type = QC71_TRACE_WMI_DATA;
+		memcpy(d->bytes, data + i, min_t(size_t, len - i, QC71_TRACE_DATA_SIZE));
+	}
+
+	record_fill_times(&entries[0], start);
+	record_append(entries, n);
+}
+
+static int record_enabled_get(void *data, u64 *value)
+{
+	*value = READ_ONCE(record_enabled);
+
+	return 0;
+}
+
+/* enabling discards the previous recording */
+static int record_enabled_set(void *data, u64 value)
+{
+	struct qc71_trace_entry *buf = NULL, *old = NULL;
+	unsigned int capacity = READ_ONCE(record_entries);
+	int err;
+
+	err = mutex_lock_interruptible(&record_lock);
+	if (err)
+		return err;
+
+	if (value && !record_enabled) {
+		if (!capacity) {
+			err = -EINVAL;
+			goto out;
+		}
+
+		buf = vmalloc(array_size(capacity, sizeof(*buf)));
+		if (!buf) {
+			err = -ENOMEM;
+			goto out;
+		}
+
+		spin_lock(&record_buf_lock);
+
+		old = record_buf;
+		record_buf = buf;
+		record_capacity = capacity;
+		record_count = 0;
+		record_dropped = 0;
+		WRITE_ONCE(record_start, ktime_get());
+		WRITE_ONCE(record_enabled, true);
+
+		spin_unlock(&record_buf_lock);
+
+		vfree(old);
+	} else if (!value && record_enabled) {
+		spin_lock(&record_buf_lock);
+		WRITE_ONCE(record_enabled, false);
+		spin_unlock(&record_buf_lock);
+	}
+
+out:
+	mutex_unlock(&record_lock);
+
+	return err;
+}
+
+DEFINE_DEBUGFS_ATTRIBUTE(record_enabled_fops, record_enabled_get, record_enabled_set, "%llu\n");
+
+/* the header followed by the entries, only available once the recording has been stopped */
+static ssize_t record_trace_read(struct file *f, char __user *buf, size_t count, loff_t *offset)
+{
+	struct qc71_trace_header header = {
+		.magic      = QC71_TRACE_MAGIC,
+		.version    = QC71_TRACE_VERSION,
+		.entry_size = sizeof(struct qc71_trace_entry),
+	};
+	ssize_t ret = 0, n;
+	loff_t pos;
+
+	n = mutex_lock_interruptible(&record_lock);
+	if (n)
+		return n;
+
+	if (record_enabled) {
+		ret = -EBUSY;
+		goto out;
+	}
+
+	header.entry_count = record_count;
+	header.dropped     = record_dropped;
+
+	if (*offset < sizeof(header)) {
+		ret = simple_read_from_buffer(buf, count, offset, &header, sizeof(header));
+		if (ret < 0)
+			goto out;
+
+		buf   += ret;
+		count -= ret;
+	}
+
+	if (count && record_buf) {
+		pos = *offset - sizeof(header);
+
+		n = simple_read_from_buffer(buf, count, &pos, record_buf,
+					    record_count * sizeof(*record_buf));
+		if (n < 0) {
+			if (!ret)
+				ret = n;
+
+			goto out;
+		}
+
+		*offset = pos + sizeof(header);
+		ret += n;
+	}
+
+out:
+	mutex_unlock(&record_lock);
+
+	return ret;
+}
+
+static const struct file_operations record_trace_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.read = record_trace_read,
+	.llseek = default_llseek,
+};
+
+/* ========================================================================== */
+/* replaying */
+
+static int qc71_ec_replay_transaction(uint16_t addr, uint16_t data,
+				      union qc71_ec_result *result, bool read)
+{
+	spin_lock(&replay_image_lock);
+
+	if (read) {
+		if (result) {
+			result->bytes.b1 = replay_image[addr];
+			result->bytes.b2 = replay_image[addr + 1];
+			result->bytes.b3 = replay_image[addr + 2];
+			result->bytes.b4 = replay_image[addr + 3];
+		}
+	} else {
+		replay_image[addr] = data & 0xFF;
+	}
+
+	spin_unlock(&replay_image_lock);
+
+	return 0;
+}
+
+static const struct qc71_ec_backend qc71_ec_replay_backend = {
+	.name        = "replay",
+	.transaction = qc71_ec_replay_transaction,
+};
+
+/* returns the number of entries, or a negative errno if the trace is malformed */
+static ssize_t replay_check_trace(void)
+{
+	const struct qc71_trace_header *header = replay_trace;
+
+	lockdep_assert_held(&replay_lock);
+
+	if (replay_trace_size < sizeof(*header))
+		return -ENODATA;
+
+	if (header->magic != QC71_TRACE_MAGIC || header->version != QC71_TRACE_VERSION ||
+	    header->entry_size != sizeof(struct qc71_trace_entry))
+		return -EINVAL;
+
+	if ((replay_trace_size - sizeof(*header)) / sizeof(struct qc71_trace_entry) < header->entry_count)
+		return -EINVAL;
+
+	return header->entry_count;
+}
+
+static const struct qc71_trace_entry *replay_entries(void)
+{
+	return replay_trace + sizeof(struct qc71_trace_header);
+}
+
+/* the data of the WMI event at entries[i] is reassembled into 'buf' */
+static size_t replay_event_data(const struct qc71_trace_entry *entries, size_t i, size_t count, u8 *buf)
+{
+	size_t len = min_t(size_t, entries[i].result, QC71_TRACE_MAX_DATA_SIZE), pos = 0;
+
+	for (i++; i < count && pos < len && entries[i].type == QC71_TRACE_WMI_DATA; i++) {
+		const struct qc71_trace_data *d = (const struct qc71_trace_data *) &entries[i];
+		size_t n = min_t(size_t, len - pos, QC71_TRACE_DATA_SIZE);
+
+		memcpy(buf + pos, d->bytes, n);
+		pos += n;
+	}
+
+	return pos;
+}
+
+static void replay_apply(const struct qc71_trace_entry *entries, size_t i, size_t count)
+{
+	const struct qc71_trace_entry *entry = &entries[i];
+	union qc71_ec_result result = { .dword = entry->result };
+	u8 data[QC71_TRACE_MAX_DATA_SIZE];
+	union acpi_object obj;
+
+	switch (entry->type) {
+	case QC71_TRACE_EC_READ:
+		if (entry->err)
+			break;
+
+		spin_lock(&replay_image_lock);
+		replay_image[entry->addr]     = result.bytes.b1;
+		replay_image[entry->addr + 1] = result.bytes.b2;
+		spin_unlock(&replay_image_lock);
+
+		/* the EC changed the values on its own */
+		qc71_ec_cache_invalidate(entry->addr);
+		qc71_ec_cache_invalidate(entry->addr + 1);
+		break;
+	case QC71_TRACE_EC_WRITE:
+		if (entry->err)
+			break;
+
+		spin_lock(&replay_image_lock);
+		replay_image[entry->addr] = entry->data & 0xFF;
+		spin_unlock(&replay_image_lock);
+
+		qc71_ec_cache_invalidate(entry->addr);
+		break;
+	case QC71_TRACE_WMI_EVENT:
+		switch (entry->data) {
+		case ACPI_TYPE_INTEGER:
+			obj.integer.type  = ACPI_TYPE_INTEGER;
+			obj.integer.value = entry->result;
+
+			qc71_wmi_events_inject(entry->addr, &obj);
+			break;
+		case ACPI_TYPE_BUFFER:
+			obj.buffer.type    = ACPI_TYPE_BUFFER;
+			obj.buffer.length  = replay_event_data(entries, i, count, data);
+			obj.buffer.pointer = data;
+
+			qc71_wmi_events_inject(entry->addr, &obj);
+			break;
+		case ACPI_TYPE_STRING:
+			obj.string.type    = ACPI_TYPE_STRING;
+			obj.string.length  = replay_event_data(entries, i, count, data);
+			obj.string.pointer = (char *) data;
+
+			qc71_wmi_events_inject(entry->addr, &obj);
+			break;
+		default:
+			qc71_wmi_events_inject(entry->addr, NULL);
+			break;
+		}
+		break;
+	case QC71_TRACE_WMI_DATA:
+		/* consumed together with the preceding event */
+		break;
+	}
+}
+
+static int replay_thread_fn(void *arg)
+{
+	const struct qc71_trace_entry *entries = replay_entries();
+	size_t i, count = (size_t) arg;
+	ktime_t start = ktime_get();
+
+	for (i = 0; i < count && !kthread_should_stop(); i++) {
+		u32 speed = READ_ONCE(replay_speed);
+
+		/* has no timestamp */
+		if (entries[i].type == QC71_TRACE_WMI_DATA)
+			continue;
+
+		if (speed) {
+			ktime_t due = ktime_add_ns(start, div_u64(entries[i].time_ns * 100, speed));
+
+			while (ktime_before(ktime_get(), due) && !kthread_should_stop()) {
+				set_current_state(TASK_INTERRUPTIBLE);
+				if (!kthread_should_stop())
+					schedule_hrtimeout(&due, HRTIMER_MODE_ABS);
+				__set_current_state(TASK_RUNNING);
+			}
+
+			if (kthread_should_stop())
+				break;
+		}
+
+		replay_apply(entries, i, count);
+	}
+
+	pr_info("replayed %zu/%zu entries\n", i, count);
+
+	/* the EC image stays in place until the replay is stopped */
+	while (!kthread_should_stop()) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (!kthread_should_stop())
+			schedule();
+		__set_current_state(TASK_RUNNING);
+	}
+
+	return 0;
+}
+
+static int replay_start(void)
+{
+	const struct qc71_trace_entry *entries;
+	unsigned long *seeded;
+	struct task_struct *thread;
+	uint8_t *image;
+	ssize_t count, i;
+	int err = 0;
+
+	lockdep_assert_held(&replay_lock);
+
+	count = replay_check_trace();
+	if (count < 0)
+		return count;
+
+	entries = replay_entries();
+
+	image = vzalloc(REPLAY_IMAGE_SIZE);
+	if (!image)
+		return -ENOMEM;
+
+	seeded = bitmap_zalloc(U16_MAX + 1, GFP_KERNEL);
+	if (!seeded) {
+		err = -ENOMEM;
+		goto out_free_image;
+	}
+
+	/* start from the first value read from each address */
+	for (i = 0; i < count; i++) {
+		const struct qc71_trace_entry *entry = &entries[i];
+		union qc71_ec_result result = { .dword = entry->result };
+
+		if (entry->type != QC71_TRACE_EC_READ || entry->err)
+			continue;
+
+		if (!test_and_set_bit(entry->addr, seeded))
+			image[entry->addr] = result.bytes.b1;
+
+		if (entry->addr < U16_MAX && !test_and_set_bit(entry->addr + 1, seeded))
+			image[entry->addr + 1] = result.bytes.b2;
+	}
+
+	bitmap_free(seeded);
+
+	spin_lock(&replay_image_lock);
+	replay_image = image;
+	spin_unlock(&replay_image_lock);
+
+	replay_prev_backend = qc71_ec_set_backend(&qc71_ec_replay_backend);
+
+	thread = kthread_run(replay_thread_fn, (void *) count, "qc71_replay");
+	if (IS_ERR(thread)) {
+		err = PTR_ERR(thread);
+		goto out_restore_backend;
+	}
+
+	replay_thread = thread;
+
+	return 0;
+
+out_restore_backend:
+	qc71_ec_set_backend(replay_prev_backend);
+
+	spin_lock(&replay_image_lock);
+	replay_image = NULL;
+	spin_unlock(&replay_image_lock);
+
+out_free_image:
+	vfree(image);
+
+	return err;
+}
+
+static void replay_stop(void)
+{
+	uint8_t *image;
+
+	lockdep_assert_held(&replay_lock);
+
+	if (!replay_thread)
+		return;
+
+	kthread_stop(replay_thread);
+	replay_thread = NULL;
+
+	qc71_ec_set_backend(replay_prev_backend);
+
+	spin_lock(&replay_image_lock);
+	image = replay_image;
+	replay_image = NULL;
+	spin_unlock(&replay_image_lock);
+
+	vfree(image);
+}
+
+static int replay_enabled_get(void *data, u64 *value)
+{
+	*value = !!READ_ONCE(replay_thread);
+
+	return 0;
+}
+
+static int replay_enabled_set(void *data, u64 value)
+{
+	int err;
+
+	err = mutex_lock_interruptible(&replay_lock);
+	if (err)
+		return err;
+
+	if (value && !replay_thread)
+		err = replay_start();
+	else if (!value)
+		replay_stop();
+
+	mutex_unlock(&replay_lock);
+
+	return err;
+}
+
+DEFINE_DEBUGFS_ATTRIBUTE(replay_enabled_fops, replay_enabled_get, replay_enabled_set, "%llu\n");
+
+static int replay_trace_open(struct inode *inode, struct file *f)
+{
+	int err;
+
+	if ((f->f_mode & FMODE_WRITE) && (f->f_flags & O_TRUNC)) {
+		err = mutex_lock_interruptible(&replay_lock);
+		if (err)
+			return err;
+
+		if (replay_thread)
+			err = -EBUSY;
+		else
+			replay_trace_size = 0;
+
+		mutex_unlock(&replay_lock);
+
+		if (err)
+			return err;
+	}
+
+	return simple_open(inode, f);
+}
+
+static ssize_t replay_trace_write(struct file *f, const char __user *buf, size_t count, loff_t *offset)
+{
+	size_t end;
+	int err;
+
+	if (*offset < 0 || *offset > REPLAY_MAX_TRACE_SIZE ||
+	    count > REPLAY_MAX_TRACE_SIZE - *offset)
+		return -EFBIG;
+
+	end = *offset + count;
+
+	err = mutex_lock_interruptible(&replay_lock);
+	if (err)
+		return err;
+
+	if (replay_thread) {
+		err = -EBUSY;
+		goto out;
+	}
+
+	if (end > replay_trace_alloc) {
+		size_t alloc = max_t(size_t, roundup_pow_of_two(end), PAGE_SIZE);
+		void *trace = vmalloc(alloc);
+
+		if (!trace) {
+			err = -ENOMEM;
+			goto out;
+		}
+
+		if (replay_trace)
+			memcpy(trace, replay_trace, replay_trace_size);
+
+		vfree(replay_trace);
+		replay_trace = trace;
+		replay_trace_alloc = alloc;
+	}
+
+	if (copy_from_user(replay_trace + *offset, buf, count)) {
+		err = -EFAULT;
+		goto out;
+	}
+
+	/* a hole is zero filled */
+	if (*offset > replay_trace_size)
+		memset(replay_trace + replay_trace_size, 0, *offset - replay_trace_size);
+
+	*offset = end;
+	replay_trace_size = max(replay_trace_size, end);
+
+out:
+	mutex_unlock(&replay_lock);
+
+	return err ? err : count;
+}
+
+static const struct file_operations replay_trace_fops = {
+	.owner = THIS_MODULE,
+	.open = replay_trace_open,
+	.write = replay_trace_write,
+	.llseek = default_llseek,
+};
+
+/* ========================================================================== */
+
+int __init qc71_record_setup(struct dentry *parent)
+{
+	struct dentry *d;
+	int err = 0;
+
+	qc71_record_dir = debugfs_create_dir("record", parent);
+	if (IS_ERR(qc71_record_dir)) {
+		err = PTR_ERR(qc71_record_dir);
+		goto out;
+	}
+
+	d = debugfs_create_file("enabled", 0600, qc71_record_dir, NULL, &record_enabled_fops);
+	if (IS_ERR(d)) {
+		err = PTR_ERR(d);
+		goto out;
+	}
+
+	d = debugfs_create_file("trace", 0400, qc71_record_dir, NULL, &record_trace_fops);
+	if (IS_ERR(d)) {
+		err = PTR_ERR(d);
+		goto out;
+	}
+
+	qc71_replay_dir = debugfs_create_dir("replay", parent);
+	if (IS_ERR(qc71_replay_dir)) {
+		err = PTR_ERR(qc71_replay_dir);
+		goto out;
+	}
+
+	d = debugfs_create_file("enabled", 0600, qc71_replay_dir, NULL, &replay_enabled_fops);
+	if (IS_ERR(d)) {
+		err = PTR_ERR(d);
+		goto out;
+	}
+
+	d = debugfs_create_file("trace", 0200, qc71_replay_dir, NULL, &replay_trace_fops);
+	if (IS_ERR(d)) {
+		err = PTR_ERR(d);
+		goto out;
+	}
+
+	debugfs_create_u32("speed", 0600, qc71_replay_dir, &replay_speed);
+
+out:
+	return err;
+}
+
+/* the debugfs files are removed together with their parent */
+void qc71_record_cleanup(void)
+{
+	mutex_lock(&replay_lock);
+	replay_stop();
+	vfree(replay_trace);
+	replay_trace = NULL;
+	replay_trace_size = replay_trace_alloc = 0;
+	mutex_unlock(&replay_lock);
+
+	mutex_lock(&record_lock);
+	spin_lock(&record_buf_lock);
+	WRITE_ONCE(record_enabled, false);
+	spin_unlock(&record_buf_lock);
+	vfree(record_buf);
+	record_buf = NULL;
+	mutex_unlock(&record_lock);
+}
+
+#endif
@@ -0,0 +1,84 @@
+// SPDX-License-Identifier: GPL-2.0
+#ifndef QC71_RECORD_H
+#define QC71_RECORD_H
+
+#include <linux/acpi.h>
+#include <linux/ktime.h>
+#include <linux/types.h>
+
+#include "ec.h"
+
+/* ========================================================================== */
+/* binary trace format, as read from and written to debugfs */
+
+#define QC71_TRACE_MAGIC   0x54313751 /* "Q71T" */
+#define QC71_TRACE_VERSION 2
+
+enum qc71_trace_entry_type {
+	QC71_TRACE_EC_READ   = 0,
+	QC71_TRACE_EC_WRITE  = 1,
+	QC71_TRACE_WMI_EVENT = 2,
+	QC71_TRACE_WMI_DATA  = 3,
+};
+
+struct qc71_trace_header {
+	__u32 magic;
+	__u16 version;
+	__u16 entry_size;
+	__u32 entry_count;
+	__u32 dropped;
+} __packed;
+
+struct qc71_trace_entry {
+	__u64 time_ns;     /* since the start of the recording */
+	__u32 duration_ns;
+	__u32 result;      /* EC read: result dword, WMI event: integer event data or buffer length */
+	__u16 addr;        /* EC address, or the WMI notify value */
+	__u16 data;        /* EC write: data, WMI event: ACPI object type */
+	__s16 err;
+	__u8  type;        /* enum qc71_trace_entry_type */
+	__u8  reserved;
+} __packed;
+
+/* the contents of a buffer or string WMI event follow the event in entries of this type */
+#define QC71_TRACE_DATA_SIZE     22
+#define QC71_TRACE_MAX_DATA_SIZE 256 /* longer event data is truncated */
+
+struct qc71_trace_data {
+	__u8 bytes[QC71_TRACE_DATA_SIZE];
+	__u8 type;         /* QC71_TRACE_WMI_DATA, at the same offset as in 'qc71_trace_entry' */
+	__u8 reserved;
+} __packed;
+
+/* ========================================================================== */
+
+#if IS_ENABLED(CONFIG_DEBUG_FS)
+
+#include <linux/debugfs.h>
+#include <linux/init.h>
+
+void qc71_record_ec_transaction(uint16_t addr, uint16_t data,
+				const union qc71_ec_result *result, bool read,
+				int err, ktime_t start);
+void qc71_record_wmi_event(u32 value, const union acpi_object *obj, ktime_t start);
+
+int  __init qc71_record_setup(struct dentry *parent);
+void        qc71_record_cleanup(void);
+
+#else
+
+static inline void qc71_record_ec_transaction(uint16_t addr, uint16_t data,
+					      const union qc71_ec_result *result, bool read,
+					      int err, ktime_t start)
+{
+
+}
+
+static inline void qc71_record_wmi_event(u32 value, const union acpi_object *obj, ktime_t start)
+{
+
+}
+
+#endif
+
+#endif /* QC71_RECORD_H */
@@ -0,0 +1,379 @@
+// SPDX-License-Identifier: GPL-2.0
+#include <kunit/test.h>
+#include <linux/kernel.h>
+#include <linux/types.h>
+
+#include "codec.h"
+#include "ec.h"
+#include "ec_emu.h"
+
+/* ========================================================================== */
+
+/* writes to this address fail, 0 means none */
+static uint16_t emu_fail_addr;
+static unsigned int emu_reads;
+
+static int emu_read(uint16_t addr, union qc71_ec_result *result)
+{
+	emu_reads += 1;
+
+	return qc71_ec_emu_backend.transaction(addr, 0, result, true);
+}
+
+static int emu_write(uint16_t addr, uint8_t value)
+{
+	if (emu_fail_addr && addr == emu_fail_addr)
+		return -EIO;
+
+	return qc71_ec_emu_backend.transaction(addr, value, NULL, false);
+}
+
+static const struct qc71_ec_txn_io emu_io = {
+	.read  = emu_read,
+	.write = emu_write,
+};
+
+static uint8_t emu_get(uint16_t addr)
+{
+	union qc71_ec_result result = {};
+
+	(void) emu_read(addr, &result);
+
+	return result.bytes.b1;
+}
+
+static void emu_set(uint16_t addr, uint8_t value)
+{
+	(void) emu_write(addr, value);
+}
+
+/* every test starts with the initial register values of the emulated EC */
+static int emu_test_init(struct kunit *test)
+{
+	emu_fail_addr = 0;
+	emu_reads = 0;
+
+	return qc71_ec_emu_setup();
+}
+
+static void emu_test_exit(struct kunit *test)
+{
+	qc71_ec_emu_cleanup();
+}
+
+/* ========================================================================== */
+/* transactions */
+
+static void txn_update_skips_matching_bits(struct kunit *test)
+{
+	struct qc71_ec_txn_op ops[] = {
+		QC71_EC_TXN_UPDATE_OP(BIOS_CTRL_3_ADDR, BIOS_CTRL_3_FAN_ALWAYS_ON, BIOS_CTRL_3_FAN_ALWAYS_ON),
+		QC71_EC_TXN_UPDATE_OP(BIOS_CTRL_3_ADDR, BIOS_CTRL_3_FAN_ALWAYS_ON, BIOS_CTRL_3_FAN_ALWAYS_ON),
+	};
+
+	emu_set(BIOS_CTRL_3_ADDR, 0x01);
+
+	KUNIT_ASSERT_EQ(test, qc71_ec_txn_apply(ops, ARRAY_SIZE(ops), 0, &emu_io), 0);
+
+	KUNIT_EXPECT_TRUE(test, ops[0].written);
+	KUNIT_EXPECT_FALSE(test, ops[1].written); /* already set by the first one */
+	KUNIT_EXPECT_EQ(test, emu_get(BIOS_CTRL_3_ADDR), 0x01 | BIOS_CTRL_3_FAN_ALWAYS_ON);
+}
+
+static void txn_read_sees_earlier_writes(struct kunit *test)
+{
+	struct qc71_ec_txn_op ops[] = {
+		QC71_EC_TXN_READ_OP(PL1_ADDR),
+		QC71_EC_TXN_WRITE_OP(PL1_ADDR, 30),
+		QC71_EC_TXN_READ_OP(PL1_ADDR),
+		QC71_EC_TXN_RESTORE_OP(PL1_ADDR),
+	};
+
+	emu_set(PL1_ADDR, 45);
+
+	KUNIT_ASSERT_EQ(test, qc71_ec_txn_apply(ops, ARRAY_SIZE(ops), 0, &emu_io), 0);
+
+	KUNIT_EXPECT_EQ(test, ops[0].value, 45);
+	KUNIT_EXPECT_EQ(test, ops[2].value, 30);
+	KUNIT_EXPECT_EQ(test, emu_get(PL1_ADDR), 45);
+}
+
+static void txn_rollback_on_failure(struct kunit *test)
+{
+	struct qc71_ec_txn_op ops[] = {
+		QC71_EC_TXN_WRITE_OP(PL1_ADDR, 30),
+		QC71_EC_TXN_WRITE_OP(PL2_ADDR, 60),
+		QC71_EC_TXN_WRITE_OP(PL4_ADDR, 90),
+	};
+
+	emu_set(PL1_ADDR, 45);
+	emu_set(PL2_ADDR, 90);
+	emu_set(PL4_ADDR, 120);
+	emu_fail_addr = PL4_ADDR;
+
+	KUNIT_EXPECT_EQ(test, qc71_ec_txn_apply(ops, ARRAY_SIZE(ops), QC71_EC_TXN_ROLLBACK, &emu_io), -EIO);
+
+	KUNIT_EXPECT_EQ(test, emu_get(PL1_ADDR), 45);
+	KUNIT_EXPECT_EQ(test, emu_get(PL2_ADDR), 90);
+	KUNIT_EXPECT_EQ(test, emu_get(PL4_ADDR), 120);
+}
+
+static void txn_writes_without_rollback(struct kunit *test)
+{
+	struct qc71_ec_txn_op ops[] = {
+		QC71_EC_TXN_WRITE_OP(PL1_ADDR, 30),
+		QC71_EC_TXN_WRITE_OP(PL2_ADDR, 60),
+		QC71_EC_TXN_WRITE_OP(PL4_ADDR, 90),
+	};
+
+	emu_set(PL1_ADDR, 45);
+	emu_set(PL2_ADDR, 90);
+	emu_fail_addr = PL4_ADDR;
+	emu_reads = 0;
+
+	/* the old values are neither read nor restored */
+	KUNIT_EXPECT_EQ(test, qc71_ec_txn_apply(ops, ARRAY_SIZE(ops), 0, &emu_io), -EIO);
+	KUNIT_EXPECT_EQ(test, emu_reads, 0);
+
+	KUNIT_EXPECT_EQ(test, emu_get(PL1_ADDR), 30);
+	KUNIT_EXPECT_EQ(test, emu_get(PL2_ADDR), 60);
+}
+
+static void txn_reads_each_address_once(struct kunit *test)
+{
+	struct qc71_ec_txn_op lightbar[] = {
+		QC71_EC_TXN_UPDATE_OP(LIGHTBAR_BLUE_ADDR, 0xFF, 1),
+		QC71_EC_TXN_UPDATE_OP(LIGHTBAR_CTRL_ADDR, LIGHTBAR_CTRL_S0_OFF, 0),
+		QC71_EC_TXN_WRITE_OP(LIGHTBAR_RED_ADDR, 2),
+		QC71_EC_TXN_UPDATE_OP(LIGHTBAR_GREEN_ADDR, 0xFF, 3),
+		QC71_EC_TXN_RESTORE_OP(LIGHTBAR_BLUE_ADDR),
+	};
+	struct qc71_ec_txn_op fan[] = {
+		QC71_EC_TXN_WRITE_OP(FAN_CTRL_ADDR, FAN_CTRL_FAN_BOOST),
+		QC71_EC_TXN_RESTORE_OP(FAN_PWM_1_ADDR),
+	};
+
+	emu_set(LIGHTBAR_RED_ADDR, 7);
+	emu_reads = 0;
+
+	/* the reads of LIGHTBAR_CTRL and LIGHTBAR_GREEN return the next register as well */
+	KUNIT_ASSERT_EQ(test, qc71_ec_txn_apply(lightbar, ARRAY_SIZE(lightbar),
+						QC71_EC_TXN_ROLLBACK, &emu_io), 0);
+	KUNIT_EXPECT_EQ(test, emu_reads, 2);
+	KUNIT_EXPECT_EQ(test, lightbar[2].old, 7);
+	KUNIT_EXPECT_EQ(test, emu_get(LIGHTBAR_BLUE_ADDR), 36);
+	KUNIT_EXPECT_EQ(test, emu_get(LIGHTBAR_GREEN_ADDR), 3);
+
+	/* the registers are too far apart */
+	emu_reads = 0;
+	KUNIT_ASSERT_EQ(test, qc71_ec_txn_apply(fan, ARRAY_SIZE(fan), QC71_EC_TXN_ROLLBACK, &emu_io), 0);
+	KUNIT_EXPECT_EQ(test, emu_reads, 2);
+
+	emu_reads = 0;
+	KUNIT_ASSERT_EQ(test, qc71_ec_txn_apply(fan, ARRAY_SIZE(fan), 0, &emu_io), 0);
+	KUNIT_EXPECT_EQ(test, emu_reads, 1);
+}
+
+/* ========================================================================== */
+/* fans */
+
+static void fan_pwm_conversion(struct kunit *test)
+{
+	KUNIT_EXPECT_EQ(test, qc71_fan_pwm_to_ec(0), 0);
+	KUNIT_EXPECT_EQ(test, qc71_fan_pwm_to_ec(U8_MAX), FAN_MAX_PWM);
+	KUNIT_EXPECT_EQ(test, qc71_fan_pwm_from_ec(0), 0);
+	KUNIT_EXPECT_EQ(test, qc71_fan_pwm_from_ec(FAN_MAX_PWM), U8_MAX);
+
+	/* out of range values from the EC do not wrap around */
+	KUNIT_EXPECT_EQ(test, qc71_fan_pwm_from_ec(U8_MAX), U8_MAX);
+}
+
+static int fan_set_mode(unsigned int mode)
+{
+	struct qc71_ec_txn_op ops[QC71_FAN_MODE_MAX_OPS];
+	int n = qc71_fan_mode_ops(mode, ops);
+
+	if (n < 0)
+		return n;
+
+	return qc71_ec_txn_apply(ops, n, QC71_EC_TXN_ROLLBACK, &emu_io);
+}
+
+static void fan_mode_transitions(struct kunit *test)
+{
+	struct qc71_ec_txn_op op = qc71_ec_flag_op(QC71_FLAG_MANUAL_CONTROL, true);
+
+	/* the EC ignores the fan control register in automatic mode */
+	KUNIT_EXPECT_EQ(test, qc71_fan_mode_read(&emu_io), QC71_FAN_MODE_AUTO);
+	KUNIT_ASSERT_EQ(test, fan_set_mode(QC71_FAN_MODE_DISENGAGED), 0);
+	KUNIT_EXPECT_EQ(test, qc71_fan_mode_read(&emu_io), QC71_FAN_MODE_AUTO);
+
+	KUNIT_ASSERT_EQ(test, qc71_ec_txn_apply(&op, 1, 0, &emu_io), 0);
+	KUNIT_EXPECT_EQ(test, qc71_fan_mode_read(&emu_io), QC71_FAN_MODE_DISENGAGED);
+	KUNIT_EXPECT_EQ(test, emu_get(FAN_PWM_1_ADDR), FAN_MAX_PWM);
+
+	KUNIT_ASSERT_EQ(test, fan_set_mode(QC71_FAN_MODE_AUTO), 0);
+	KUNIT_EXPECT_EQ(test, qc71_fan_mode_read(&emu_io), QC71_FAN_MODE_AUTO);
+
+	/* keeps the pwm */
+	emu_set(FAN_PWM_1_ADDR, 100);
+	KUNIT_ASSERT_EQ(test, fan_set_mode(QC71_FAN_MODE_MANUAL), 0);
+	KUNIT_EXPECT_EQ(test, qc71_fan_mode_read(&emu_io), QC71_FAN_MODE_MANUAL);
+	KUNIT_EXPECT_EQ(test, emu_get(FAN_PWM_1_ADDR), 100);
+	KUNIT_EXPECT_EQ(test, emu_get(FAN_CTRL_ADDR), FAN_CTRL_FAN_BOOST);
+
+	KUNIT_EXPECT_EQ(test, fan_set_mode(QC71_FAN_MODE_COUNT), -EINVAL);
+	KUNIT_EXPECT_EQ(test, qc71_fan_mode_read(&emu_io), QC71_FAN_MODE_MANUAL);
+}
+
+static void fan_mode_rollback(struct kunit *test)
+{
+	uint8_t fan_ctrl = emu_get(FAN_CTRL_ADDR);
+
+	emu_fail_addr = FAN_PWM_1_ADDR;
+
+	/* the fan control register is not left in fan boost mode */
+	KUNIT_EXPECT_EQ(test, fan_set_mode(QC71_FAN_MODE_DISENGAGED), -EIO);
+	KUNIT_EXPECT_EQ(test, emu_get(FAN_CTRL_ADDR), fan_ctrl);
+}
+
+/* ========================================================================== */
+/* lightbar */
+
+static void lightbar_color_encoding(struct kunit *test)
+{
+	uint8_t rgb[LIGHTBAR_COLOR_COUNT];
+	unsigned int color;
+
+	KUNIT_ASSERT_EQ(test, qc71_lightbar_color_to_rgb(591, rgb), 0);
+	KUNIT_EXPECT_EQ(test, rgb[LIGHTBAR_RED], 20);
+	KUNIT_EXPECT_EQ(test, rgb[LIGHTBAR_GREEN], 36);
+	KUNIT_EXPECT_EQ(test, rgb[LIGHTBAR_BLUE], 4);
+
+	KUNIT_EXPECT_EQ(test, qc71_lightbar_color_to_rgb(1000, rgb), -EINVAL);
+
+	for (color = 0; color <= 999; color++) {
+		KUNIT_ASSERT_EQ(test, qc71_lightbar_color_to_rgb(color, rgb), 0);
+		KUNIT_EXPECT_LE(test, rgb[LIGHTBAR_RED], LIGHTBAR_MAX_LEVEL);
+		KUNIT_EXPECT_EQ(test, qc71_lightbar_rgb_to_color(rgb), color);
+	}
+}
+
+static void lightbar_color_rounding(struct kunit *test)
+{
+	const uint8_t rgb[LIGHTBAR_COLOR_COUNT] = { 35, 3, LIGHTBAR_MAX_LEVEL };
+
+	/* between levels, rounded down, and the last level covers the maximum */
+	KUNIT_EXPECT_EQ(test, qc71_lightbar_rgb_to_color(rgb), 809);
+}
+
+/* ========================================================================== */
+/* battery */
+
+static void charge_limit_mapping(struct kunit *test)
+{
+	KUNIT_EXPECT_EQ(test, qc71_charge_limit_to_ec(100), 0);
+	KUNIT_EXPECT_EQ(test, qc71_charge_limit_to_ec(80), 80);
+	KUNIT_EXPECT_EQ(test, qc71_charge_limit_to_ec(1), 1);
+	KUNIT_EXPECT_EQ(test, qc71_charge_limit_to_ec(0), -EINVAL);
+	KUNIT_EXPECT_EQ(test, qc71_charge_limit_to_ec(101), -EINVAL);
+
+	KUNIT_EXPECT_EQ(test, qc71_charge_limit_from_ec(0), 100);
+	KUNIT_EXPECT_EQ(test, qc71_charge_limit_from_ec(80), 80);
+
+	/* the EC sets the 'reached' bit on its own */
+	KUNIT_EXPECT_EQ(test, qc71_charge_limit_from_ec(BATT_CHARGE_CTRL_REACHED | 80), 80);
+	KUNIT_EXPECT_EQ(test, qc71_charge_limit_from_ec(BATT_CHARGE_CTRL_REACHED), 100);
+}
+
+static void charge_limit_store(struct kunit *test)
+{
+	struct qc71_ec_txn_op op =
+		QC71_EC_TXN_UPDATE_OP(BATT_CHARGE_CTRL_ADDR, BATT_CHARGE_CTRL_VALUE_MASK,
+				      qc71_charge_limit_to_ec(60));
+
+	emu_set(BATT_CHARGE_CTRL_ADDR, BATT_CHARGE_CTRL_REACHED);
+
+	KUNIT_ASSERT_EQ(test, qc71_ec_txn_apply(&op, 1, 0, &emu_io), 0);
+	KUNIT_EXPECT_EQ(test, emu_get(BATT_CHARGE_CTRL_ADDR), BATT_CHARGE_CTRL_REACHED | 60);
+	KUNIT_EXPECT_EQ(test, qc71_charge_limit_from_ec(emu_get(BATT_CHARGE_CTRL_ADDR)), 60);
+}
+
+/* ========================================================================== */
+/* platform device attributes */
+
+static void pdev_flag_stores(struct kunit *test)
+{
+	enum qc71_ec_flag flag;
+
+	for (flag = 0; flag < QC71_FLAG_COUNT; flag++) {
+		uint16_t addr = qc71_ec_flag_addr(flag);
+		struct qc71_ec_txn_op op;
+
+		/* the other bits of the register are kept */
+		emu_set(addr, 0xA5);
+
+		op = qc71_ec_flag_op(flag, true);
+		KUNIT_ASSERT_EQ(test, qc71_ec_txn_apply(&op, 1, 0, &emu_io), 0);
+		KUNIT_EXPECT_TRUE(test, qc71_ec_flag_get(flag, emu_get(addr)));
+		KUNIT_EXPECT_EQ(test, emu_get(addr) & ~op.mask, 0xA5 & ~op.mask);
+
+		op = qc71_ec_flag_op(flag, false);
+		KUNIT_ASSERT_EQ(test, qc71_ec_txn_apply(&op, 1, 0, &emu_io), 0);
+		KUNIT_EXPECT_FALSE(test, qc71_ec_flag_get(flag, emu_get(addr)));
+		KUNIT_EXPECT_EQ(test, emu_get(addr) & ~op.mask, 0xA5 & ~op.mask);
+	}
+}
+
+static void pdev_super_key_lock_store(struct kunit *test)
+{
+	struct qc71_ec_txn_op op;
+	size_t n;
+
+	KUNIT_ASSERT_FALSE(test, emu_get(STATUS_1_ADDR) & STATUS_1_SUPER_KEY_LOCK);
+
+	/* the trigger toggles the state */
+	n = qc71_super_key_lock_ops(emu_get(STATUS_1_ADDR), true, &op);
+	KUNIT_ASSERT_EQ(test, n, 1);
+	KUNIT_ASSERT_EQ(test, qc71_ec_txn_apply(&op, n, 0, &emu_io), 0);
+	KUNIT_EXPECT_TRUE(test, emu_get(STATUS_1_ADDR) & STATUS_1_SUPER_KEY_LOCK);
+	KUNIT_EXPECT_EQ(test, emu_get(TRIGGER_1_ADDR), 0);
+
+	/* already on */
+	n = qc71_super_key_lock_ops(emu_get(STATUS_1_ADDR), true, &op);
+	KUNIT_EXPECT_EQ(test, n, 0);
+
+	n = qc71_super_key_lock_ops(emu_get(STATUS_1_ADDR), false, &op);
+	KUNIT_ASSERT_EQ(test, n, 1);
+	KUNIT_ASSERT_EQ(test, qc71_ec_txn_apply(&op, n, 0, &emu_io), 0);
+	KUNIT_EXPECT_FALSE(test, emu_get(STATUS_1_ADDR) & STATUS_1_SUPER_KEY_LOCK);
+}
+
+/* ========================================================================== */
+
+static struct kunit_case qc71_codec_test_cases[] = {
+	KUNIT_CASE(txn_update_skips_matching_bits),
+	KUNIT_CASE(txn_read_sees_earlier_writes),
+	KUNIT_CASE(txn_rollback_on_failure),
+	KUNIT_CASE(txn_writes_without_rollback),
+	KUNIT_CASE(txn_reads_each_address_once),
+	KUNIT_CASE(fan_pwm_conversion),
+	KUNIT_CASE(fan_mode_transitions),
+	KUNIT_CASE(fan_mode_rollback),
+	KUNIT_CASE(lightbar_color_encoding),
+	KUNIT_CASE(lightbar_color_rounding),
+	KUNIT_CASE(charge_limit_mapping),
+	KUNIT_CASE(charge_limit_store),
+	KUNIT_CASE(pdev_flag_stores),
+	KUNIT_CASE(pdev_super_key_lock_store),
+	{}
+};
+
+static struct kunit_suite qc71_codec_test_suite = {
+	.name       = "qc71_laptop_codec",
+	.init       = emu_test_init,
+	.exit       = emu_test_exit,
+	.test_cases = qc71_codec_test_cases,
+};
+
+kunit_test_suite(qc71_codec_test_suite);
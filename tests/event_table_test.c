@@ -0,0 +1,150 @@
+// SPDX-License-Identifier: GPL-2.0
+#include <kunit/test.h>
+#include <linux/kernel.h>
+#include <linux/types.h>
+
+#include "ec.h"
+#include "event_table.h"
+#include "events.h"
+
+/* ========================================================================== */
+
+/* stands in for the register cache of the driver */
+static uint16_t invalidated[8];
+static unsigned int invalidated_count;
+
+void qc71_ec_cache_invalidate(uint16_t addr)
+{
+	if (invalidated_count < ARRAY_SIZE(invalidated))
+		invalidated[invalidated_count] = addr;
+
+	invalidated_count += 1;
+}
+
+static unsigned int handler_calls[2], handler_last_code;
+
+static void handler_0(unsigned int code)
+{
+	handler_calls[0] += 1;
+	handler_last_code = code;
+}
+
+static void handler_1(unsigned int code)
+{
+	handler_calls[1] += 1;
+}
+
+static int event_test_init(struct kunit *test)
+{
+	invalidated_count = 0;
+	handler_calls[0] = handler_calls[1] = 0;
+	handler_last_code = 0;
+
+	return 0;
+}
+
+/* ========================================================================== */
+
+static void dispatch_runs_handlers(struct kunit *test)
+{
+	struct qc71_wmi_event_handler h0 = { .code = QC71_EVENT_FN_LOCK, .fn = handler_0 },
+				      h1 = { .code = QC71_EVENT_FN_LOCK, .fn = handler_1 };
+
+	KUNIT_ASSERT_EQ(test, qc71_wmi_event_register(&h0), 0);
+	KUNIT_ASSERT_EQ(test, qc71_wmi_event_register(&h1), 0);
+
+	KUNIT_EXPECT_EQ(test, qc71_wmi_event_dispatch_code(QC71_EVENT_FN_LOCK), QC71_EVENT_FN_LOCK);
+	KUNIT_EXPECT_EQ(test, handler_calls[0], 1);
+	KUNIT_EXPECT_EQ(test, handler_calls[1], 1);
+	KUNIT_EXPECT_EQ(test, handler_last_code, QC71_EVENT_FN_LOCK);
+
+	/* other codes do not reach them */
+	KUNIT_EXPECT_EQ(test, qc71_wmi_event_dispatch_code(QC71_EVENT_AC), QC71_EVENT_AC);
+	KUNIT_EXPECT_EQ(test, handler_calls[0], 1);
+
+	qc71_wmi_event_unregister(&h0);
+
+	qc71_wmi_event_dispatch_code(QC71_EVENT_FN_LOCK);
+	KUNIT_EXPECT_EQ(test, handler_calls[0], 1);
+	KUNIT_EXPECT_EQ(test, handler_calls[1], 2);
+
+	qc71_wmi_event_unregister(&h1);
+}
+
+static void dispatch_rejects_bad_codes(struct kunit *test)
+{
+	struct qc71_wmi_event_handler h = { .code = 0, .fn = handler_0 };
+
+	KUNIT_ASSERT_EQ(test, qc71_wmi_event_register(&h), 0);
+
+	KUNIT_EXPECT_EQ(test, qc71_wmi_event_dispatch_code(QC71_WMI_EVENT_CODE_COUNT), -ERANGE);
+	KUNIT_EXPECT_EQ(test, qc71_wmi_event_dispatch_code(U64_MAX), -ERANGE);
+	KUNIT_EXPECT_EQ(test, handler_calls[0], 0);
+	KUNIT_EXPECT_EQ(test, invalidated_count, 0);
+
+	qc71_wmi_event_unregister(&h);
+
+	/* needs a function */
+	h.fn = NULL;
+	KUNIT_EXPECT_EQ(test, qc71_wmi_event_register(&h), -EINVAL);
+}
+
+static void dispatch_invalidates_registers(struct kunit *test)
+{
+	KUNIT_ASSERT_GE(test, qc71_wmi_event_dispatch_code(QC71_EVENT_PERF_MODE), 0);
+	KUNIT_ASSERT_EQ(test, invalidated_count, 3);
+	KUNIT_EXPECT_EQ(test, invalidated[0], CTRL_2_ADDR);
+	KUNIT_EXPECT_EQ(test, invalidated[1], CTRL_3_ADDR);
+	KUNIT_EXPECT_EQ(test, invalidated[2], CTRL_4_ADDR);
+
+	invalidated_count = 0;
+	KUNIT_ASSERT_GE(test, qc71_wmi_event_dispatch_code(QC71_EVENT_AC), 0);
+	KUNIT_ASSERT_EQ(test, invalidated_count, 6);
+	KUNIT_EXPECT_EQ(test, invalidated[3], PL1_ADDR);
+	KUNIT_EXPECT_EQ(test, invalidated[4], PL2_ADDR);
+	KUNIT_EXPECT_EQ(test, invalidated[5], PL4_ADDR);
+
+	/* keys do not change registers */
+	invalidated_count = 0;
+	KUNIT_ASSERT_GE(test, qc71_wmi_event_dispatch_code(QC71_EVENT_KBD_BACKLIGHT_UP), 0);
+	KUNIT_EXPECT_EQ(test, invalidated_count, 0);
+}
+
+static void event_descs(struct kunit *test)
+{
+	size_t code;
+
+	/* only state change events can be coalesced */
+	KUNIT_EXPECT_TRUE(test, qc71_wmi_event_descs[QC71_EVENT_KBD_BACKLIGHT].flags & QC71_WMI_EVENT_COALESCE);
+	KUNIT_EXPECT_TRUE(test, qc71_wmi_event_descs[QC71_EVENT_AC].flags & QC71_WMI_EVENT_COALESCE);
+	KUNIT_EXPECT_FALSE(test, qc71_wmi_event_descs[QC71_EVENT_PERF_MODE].flags & QC71_WMI_EVENT_COALESCE);
+	KUNIT_EXPECT_FALSE(test, qc71_wmi_event_descs[QC71_EVENT_KBD_BACKLIGHT_UP].flags & QC71_WMI_EVENT_COALESCE);
+
+	for (code = 0; code < QC71_WMI_EVENT_CODE_COUNT; code++) {
+		const struct qc71_wmi_event_desc *desc = &qc71_wmi_event_descs[code];
+
+		/* unknown codes have neither flags nor registers */
+		if (!desc->name) {
+			KUNIT_EXPECT_EQ(test, desc->flags, 0);
+			KUNIT_EXPECT_EQ(test, desc->regs[0], 0);
+		}
+	}
+}
+
+/* ========================================================================== */
+
+static struct kunit_case qc71_event_table_test_cases[] = {
+	KUNIT_CASE(dispatch_runs_handlers),
+	KUNIT_CASE(dispatch_rejects_bad_codes),
+	KUNIT_CASE(dispatch_invalidates_registers),
+	KUNIT_CASE(event_descs),
+	{}
+};
+
+static struct kunit_suite qc71_event_table_test_suite = {
+	.name       = "qc71_laptop_event_table",
+	.init       = event_test_init,
+	.test_cases = qc71_event_table_test_cases,
+};
+
+kunit_test_suite(qc71_event_table_test_suite);
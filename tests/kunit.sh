@@ -0,0 +1,32 @@
+#!/bin/sh
+# SPDX-License-Identifier: GPL-2.0
+#
+# runs the KUnit suite on UML:
+#   tests/kunit.sh <kernel source tree> [kunit.py run arguments]
+#
+# the repository is linked into drivers/misc of the kernel tree,
+# only the tests/ directory is built from it
+
+set -e
+
+if [ $# -lt 1 ]; then
+	echo "usage: $0 <kernel source tree> [kunit.py run arguments]" >&2
+	exit 1
+fi
+
+KDIR=$(realpath "$1")
+shift
+
+REPO=$(realpath "$(dirname "$0")/..")
+LINK=drivers/misc/qc71_laptop
+
+ln -sfn "$REPO" "$KDIR/$LINK"
+
+grep -q "$LINK/tests/Kconfig" "$KDIR/drivers/misc/Kconfig" ||
+	echo "source \"$LINK/tests/Kconfig\"" >> "$KDIR/drivers/misc/Kconfig"
+
+grep -q "qc71_laptop/tests/" "$KDIR/drivers/misc/Makefile" ||
+	echo 'obj-$(CONFIG_QC71_LAPTOP_KUNIT_TEST) += qc71_laptop/tests/' >> "$KDIR/drivers/misc/Makefile"
+
+cd "$KDIR"
+exec ./tools/testing/kunit/kunit.py run --kunitconfig="$LINK/tests" "$@"
@@ -0,0 +1,13 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * the sources under test, none of them depends on WMI/ACPI; they are
+ * built into the test module instead of being linked from the driver
+ */
+#include "../codec.c"
+#include "../ec_emu.c"
+#include "../event_table.c"
+
+#include <linux/module.h>
+
+MODULE_DESCRIPTION("KUnit tests for the QC71 laptop driver");
+MODULE_LICENSE("GPL");
@@ -0,0 +1,455 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Measures the latency of reading (and optionally writing back) the sysfs
+ * attributes of the qc71_laptop driver from 1 to N concurrent threads.
+ *
+ * The results are printed as JSON, one object per line, for every
+ * attribute, operation and thread count. If /proc/lock_stat is available,
+ * the contention of 'ec_lock' and 'fan_lock' is reported as well.
+ *
+ * usage: qc71-sysfs-bench [-n iterations] [-t max threads] [-w] [-a attribute]...
+ */
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_ATTRS 64
+#define LOCK_STAT_PATH "/proc/lock_stat"
+
+static const char * const platform_dir = "/sys/devices/platform/qc71_laptop";
+static const char * const led_dir      = "/sys/class/leds/qc71_laptop::lightbar";
+
+static const char * const platform_attrs[] = {
+	"fan_always_on", "fan_reduced_duty_cycle", "fn_lock", "fn_lock_switch",
+	"manual_control", "super_key_lock",
+};
+
+static const char * const led_attrs[] = {
+	"brightness", "brightness_s3", "color", "rainbow_mode",
+};
+
+static const char * const hwmon_attrs[] = {
+	"fan1_input", "fan2_input", "temp1_input", "temp2_input",
+	"pwm1", "pwm2", "pwm1_enable",
+};
+
+static const char * const tracked_locks[] = {
+	"ec_lock", "fan_lock",
+};
+
+struct attr {
+	char path[512];
+	bool writable;
+};
+
+struct worker {
+	pthread_t thread;
+	const struct attr *attr;
+	bool write;
+	char value[64];
+	size_t value_len;
+	unsigned int iterations;
+	uint64_t *samples;
+	unsigned int errors;
+};
+
+struct lock_stat {
+	unsigned long long contentions;
+	unsigned long long acquisitions;
+	double wait_total_us;
+};
+
+static struct attr attrs[MAX_ATTRS];
+static size_t attr_count;
+
+/* the workers wait until 'start_state' is set, -1 means they should exit */
+static pthread_mutex_t start_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t start_cond = PTHREAD_COND_INITIALIZER;
+static unsigned int start_ready;
+static int start_state;
+
+/* ========================================================================== */
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void add_attr(const char *path)
+{
+	if (attr_count >= MAX_ATTRS || access(path, R_OK) != 0)
+		return;
+
+	snprintf(attrs[attr_count].path, sizeof(attrs[attr_count].path), "%s", path);
+	attrs[attr_count].writable = access(path, W_OK) == 0;
+	attr_count++;
+}
+
+static void add_attrs_in(const char *dir, const char * const *names, size_t count)
+{
+	char path[512];
+	size_t i;
+
+	for (i = 0; i < count; i++) {
+		snprintf(path, sizeof(path), "%s/%s", dir, names[i]);
+		add_attr(path);
+	}
+}
+
+/* the hwmon devices of the driver are named "qc71_laptop.hwmon.*" */
+static void find_hwmon_attrs(void)
+{
+	struct dirent *ent;
+	char path[512], name[128];
+	DIR *dir = opendir("/sys/class/hwmon");
+
+	if (!dir)
+		return;
+
+	while ((ent = readdir(dir))) {
+		FILE *f;
+
+		if (ent->d_name[0] == '.')
+			continue;
+
+		snprintf(path, sizeof(path), "/sys/class/hwmon/%s/name", ent->d_name);
+
+		f = fopen(path, "r");
+		if (!f)
+			continue;
+
+		if (fgets(name, sizeof(name), f) && strncmp(name, "qc71_laptop", 11) == 0) {
+			snprintf(path, sizeof(path), "/sys/class/hwmon/%s", ent->d_name);
+			add_attrs_in(path, hwmon_attrs, sizeof(hwmon_attrs) / sizeof(hwmon_attrs[0]));
+		}
+
+		fclose(f);
+	}
+
+	closedir(dir);
+}
+
+/* ========================================================================== */
+
+static void *worker_fn(void *arg)
+{
+	struct worker *w = arg;
+	char buf[256];
+	unsigned int i;
+	int fd, state;
+
+	fd = open(w->attr->path, w->write ? O_RDWR : O_RDONLY);
+
+	pthread_mutex_lock(&start_lock);
+
+	start_ready++;
+	pthread_cond_broadcast(&start_cond);
+
+	while (!start_state)
+		pthread_cond_wait(&start_cond, &start_lock);
+
+	state = start_state;
+
+	pthread_mutex_unlock(&start_lock);
+
+	if (state < 0) {
+		if (fd >= 0)
+			close(fd);
+		return NULL;
+	}
+
+	if (fd < 0) {
+		w->errors = w->iterations;
+		return NULL;
+	}
+
+	for (i = 0; i < w->iterations; i++) {
+		uint64_t start = now_ns();
+		ssize_t ret;
+
+		/* sysfs regenerates the contents when reading from offset 0 */
+		if (w->write)
+			ret = pwrite(fd, w->value, w->value_len, 0);
+		else
+			ret = pread(fd, buf, sizeof(buf), 0);
+
+		w->samples[i] = now_ns() - start;
+
+		if (ret < 0)
+			w->errors++;
+	}
+
+	close(fd);
+
+	return NULL;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+
+	return (x > y) - (x < y);
+}
+
+/* ========================================================================== */
+
+static bool lock_stat_reset(void)
+{
+	int fd = open(LOCK_STAT_PATH, O_WRONLY);
+	bool ok;
+
+	if (fd < 0)
+		return false;
+
+	ok = write(fd, "0", 1) == 1;
+	close(fd);
+
+	return ok;
+}
+
+/* rwsems acquired both ways have a line for each, e.g. "ec_lock-R" and "ec_lock-W" */
+static bool lock_name_matches(const char *name, const char *lock)
+{
+	size_t len = strlen(lock);
+
+	return strncmp(name, lock, len) == 0 &&
+	       (!name[len] || !strcmp(name + len, "-R") || !strcmp(name + len, "-W"));
+}
+
+/*
+ * class name  con-bounces  contentions  waittime-min  waittime-max  waittime-total  ...
+ *   acq-bounces  acquisitions  ...
+ */
+static void lock_stat_read(struct lock_stat *stats)
+{
+	char line[1024];
+	FILE *f = fopen(LOCK_STAT_PATH, "r");
+
+	memset(stats, 0, sizeof(*stats) * (sizeof(tracked_locks) / sizeof(tracked_locks[0])));
+
+	if (!f)
+		return;
+
+	while (fgets(line, sizeof(line), f)) {
+		unsigned long long con_bounces, contentions, acq_bounces, acquisitions;
+		double wait_min, wait_max, wait_total, wait_avg;
+		char name[256];
+		size_t i;
+
+		if (sscanf(line, " %255[^:]: %llu %llu %lf %lf %lf %lf %llu %llu",
+			   name, &con_bounces, &contentions, &wait_min, &wait_max,
+			   &wait_total, &wait_avg, &acq_bounces, &acquisitions) != 9)
+			continue;
+
+		for (i = 0; i < sizeof(tracked_locks) / sizeof(tracked_locks[0]); i++) {
+			if (lock_name_matches(name, tracked_locks[i])) {
+				stats[i].contentions   += contentions;
+				stats[i].acquisitions  += acquisitions;
+				stats[i].wait_total_us += wait_total;
+			}
+		}
+	}
+
+	fclose(f);
+}
+
+/* ========================================================================== */
+
+static int run(const struct attr *attr, bool write, unsigned int threads, unsigned int iterations)
+{
+	struct lock_stat locks[sizeof(tracked_locks) / sizeof(tracked_locks[0])];
+	struct worker *workers = calloc(threads, sizeof(*workers));
+	uint64_t *samples = calloc((size_t) threads * iterations, sizeof(*samples));
+	size_t n = (size_t) threads * iterations, i, created;
+	unsigned int errors = 0;
+	int err = 0;
+	bool have_lock_stat;
+	uint64_t start, elapsed;
+	char value[64] = "";
+	ssize_t len = 0;
+	int fd;
+
+	if (!workers || !samples) {
+		free(workers);
+		free(samples);
+		return -ENOMEM;
+	}
+
+	/* writing back the current value is harmless */
+	if (write) {
+		fd = open(attr->path, O_RDONLY);
+		if (fd >= 0) {
+			len = read(fd, value, sizeof(value) - 1);
+			close(fd);
+		}
+
+		if (len <= 0) {
+			free(workers);
+			free(samples);
+			return -EIO;
+		}
+	}
+
+	start_ready = 0;
+	start_state = 0;
+
+	for (i = 0; i < threads; i++) {
+		workers[i].attr       = attr;
+		workers[i].write      = write;
+		workers[i].iterations = iterations;
+		workers[i].samples    = samples + i * iterations;
+		workers[i].value_len  = len;
+		memcpy(workers[i].value, value, len);
+
+		err = pthread_create(&workers[i].thread, NULL, worker_fn, &workers[i]);
+		if (err)
+			break;
+	}
+
+	created = i;
+
+	pthread_mutex_lock(&start_lock);
+
+	while (start_ready < created)
+		pthread_cond_wait(&start_cond, &start_lock);
+
+	if (err) {
+		/* let the ones already started exit */
+		start_state = -1;
+		pthread_cond_broadcast(&start_cond);
+		pthread_mutex_unlock(&start_lock);
+
+		for (i = 0; i < created; i++)
+			pthread_join(workers[i].thread, NULL);
+
+		fprintf(stderr, "cannot create thread: %s\n", strerror(err));
+		free(workers);
+		free(samples);
+		return -err;
+	}
+
+	pthread_mutex_unlock(&start_lock);
+
+	have_lock_stat = lock_stat_reset();
+
+	/* the workers might finish before this thread is scheduled again */
+	start = now_ns();
+
+	pthread_mutex_lock(&start_lock);
+	start_state = 1;
+	pthread_cond_broadcast(&start_cond);
+	pthread_mutex_unlock(&start_lock);
+
+	for (i = 0; i < threads; i++) {
+		pthread_join(workers[i].thread, NULL);
+		errors += workers[i].errors;
+	}
+
+	elapsed = now_ns() - start;
+
+	qsort(samples, n, sizeof(*samples), cmp_u64);
+
+	printf("{\"attr\": \"%s\", \"op\": \"%s\", \"threads\": %u, \"iterations\": %u, "
+	       "\"errors\": %u, \"elapsed_ns\": %llu, \"ops_per_sec\": %.1f, "
+	       "\"min_ns\": %llu, \"p50_ns\": %llu, \"p99_ns\": %llu, \"p999_ns\": %llu, \"max_ns\": %llu",
+	       attr->path, write ? "write" : "read", threads, iterations, errors,
+	       (unsigned long long) elapsed, n * 1e9 / (elapsed ? elapsed : 1),
+	       (unsigned long long) samples[0],
+	       (unsigned long long) samples[n * 50 / 100],
+	       (unsigned long long) samples[n * 99 / 100],
+	       (unsigned long long) samples[n * 999 / 1000],
+	       (unsigned long long) samples[n - 1]);
+
+	if (have_lock_stat) {
+		lock_stat_read(locks);
+
+		for (i = 0; i < sizeof(tracked_locks) / sizeof(tracked_locks[0]); i++)
+			printf(", \"%s\": {\"contentions\": %llu, \"acquisitions\": %llu, \"wait_total_us\": %.2f}",
+			       tracked_locks[i], locks[i].contentions, locks[i].acquisitions,
+			       locks[i].wait_total_us);
+	}
+
+	printf("}\n");
+	fflush(stdout);
+
+	free(workers);
+	free(samples);
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int iterations = 1000, max_threads = 4, threads;
+	bool write = false;
+	size_t i;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:t:wa:h")) != -1) {
+		switch (opt) {
+		case 'n':
+			iterations = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			max_threads = strtoul(optarg, NULL, 0);
+			break;
+		case 'w':
+			write = true;
+			break;
+		case 'a':
+			add_attr(optarg);
+			break;
+		default:
+			fprintf(stderr,
+				"usage: %s [-n iterations] [-t max threads] [-w] [-a attribute]...\n"
+				"  -w  also write back the current value of every writable attribute\n"
+				"  -a  only benchmark the given attribute (can be repeated)\n",
+				argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	if (!iterations || !max_threads) {
+		fprintf(stderr, "the iteration and thread counts must be positive\n");
+		return 1;
+	}
+
+	if (!attr_count) {
+		add_attrs_in(platform_dir, platform_attrs, sizeof(platform_attrs) / sizeof(platform_attrs[0]));
+		add_attrs_in(led_dir, led_attrs, sizeof(led_attrs) / sizeof(led_attrs[0]));
+		find_hwmon_attrs();
+	}
+
+	if (!attr_count) {
+		fprintf(stderr, "no attributes found, is the qc71_laptop module loaded?\n");
+		return 1;
+	}
+
+	if (access(LOCK_STAT_PATH, R_OK | W_OK) != 0)
+		fprintf(stderr, "%s is not available, lock contention is not reported\n", LOCK_STAT_PATH);
+
+	for (i = 0; i < attr_count; i++) {
+		for (threads = 1; threads <= max_threads; threads *= 2) {
+			if (run(&attrs[i], false, threads, iterations))
+				fprintf(stderr, "cannot benchmark reading %s\n", attrs[i].path);
+
+			if (write && attrs[i].writable && run(&attrs[i], true, threads, iterations))
+				fprintf(stderr, "cannot benchmark writing %s\n", attrs[i].path);
+		}
+	}
+
+	return 0;
+}
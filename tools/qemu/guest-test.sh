@@ -0,0 +1,95 @@
+#!/bin/busybox sh
+# SPDX-License-Identifier: GPL-2.0
+#
+# the /init of the guest started by run.sh: loads the module on the WMI
+# interface of qc71-wmi.asl, checks the attributes and the event path,
+# then measures the latency of the attributes
+
+/bin/busybox --install -s /bin
+
+mount -t proc proc /proc
+mount -t sysfs sysfs /sys
+mount -t devtmpfs devtmpfs /dev
+mount -t debugfs debugfs /sys/kernel/debug
+
+PDEV=/sys/devices/platform/qc71_laptop
+LED=/sys/class/leds/qc71_laptop::lightbar
+DBG=/sys/kernel/debug/qc71_laptop
+
+failed=0
+
+# check <description> <expected> <actual>
+check()
+{
+	if [ "$2" = "$3" ]; then
+		echo "qc71-test: ok: $1"
+	else
+		echo "qc71-test: FAIL: $1: expected '$2', got '$3'"
+		failed=1
+	fi
+}
+
+finish()
+{
+	if [ $failed -eq 0 ]; then
+		echo "qc71-test: PASS"
+	else
+		echo "qc71-test: FAIL"
+	fi
+
+	poweroff -f
+}
+
+# ec_read <addr>
+ec_read()
+{
+	dd if=$DBG/ec bs=1 skip=$(($1)) count=1 2>/dev/null | od -An -tu1 | tr -d ' '
+}
+
+# ec_write <addr> <value>
+ec_write()
+{
+	printf "\\$(printf %o $2)" | dd of=$DBG/ec bs=1 seek=$(($1)) conv=notrunc 2>/dev/null
+}
+
+# event_count <code>
+event_count()
+{
+	awk -v c="code_$1:" '$1 == c { print $2 }' $DBG/events
+}
+
+# every access goes to the firmware
+insmod /qc71_laptop.ko debugregs=1 ec_cache=0 || { failed=1; finish; }
+
+check "backend" wmi "$(cat /sys/module/qc71_laptop/parameters/ec_backend)"
+check "project id" 5 "$(ec_read 0x740)"
+
+# ============================================================================
+
+echo 1 > $PDEV/fn_lock_switch
+check "fn_lock_switch" 1 "$(cat $PDEV/fn_lock_switch)"
+check "fn_lock_switch register" 8 "$(( $(ec_read 0x7A4) & 8 ))"
+
+echo 123 > $LED/color
+check "lightbar color" 123 "$(cat $LED/color)"
+check "lightbar red" 4 "$(ec_read 0x749)"
+check "lightbar green" 8 "$(ec_read 0x74A)"
+check "lightbar blue" 12 "$(ec_read 0x74B)"
+
+# ============================================================================
+
+# the firmware reports the toggle with event 165
+echo 1 > $PDEV/super_key_lock
+check "super_key_lock" 1 "$(cat $PDEV/super_key_lock)"
+sleep 1
+check "super key lock event" 1 "$(event_count 165)"
+
+ec_write 0xFFF0 184
+sleep 1
+check "fn lock event" 1 "$(event_count 184)"
+
+# ============================================================================
+
+/qc71-sysfs-bench -n 500 -t 4 | sed 's/^/qc71-bench: /'
+
+finish
@@ -0,0 +1,62 @@
+#!/bin/sh
+# SPDX-License-Identifier: GPL-2.0
+#
+# boots a QEMU guest whose firmware provides the WMI interface of a QC71
+# laptop (qc71-wmi.asl), and runs guest-test.sh in it:
+#   tools/qemu/run.sh <kernel build tree> [qemu arguments]
+#
+# the kernel must have ACPI_WMI, DEBUG_FS, DEVTMPFS, BLK_DEV_INITRD and
+# SERIAL_8250_CONSOLE built in; iasl, a static busybox, and
+# qemu-system-x86_64 are needed on the host
+#
+# exits with 0 if every check passed, the latency measurements are
+# printed as lines starting with 'qc71-bench: '
+
+set -e
+
+if [ $# -lt 1 ]; then
+	echo "usage: $0 <kernel build tree> [qemu arguments]" >&2
+	exit 1
+fi
+
+KDIR=$(realpath "$1")
+shift
+
+HERE=$(realpath "$(dirname "$0")")
+REPO=$(realpath "$HERE/../..")
+OUT=$(mktemp -d)
+trap 'rm -rf "$OUT"' EXIT
+
+iasl -p "$OUT/qc71-wmi" "$HERE/qc71-wmi.asl" >/dev/null
+make -C "$KDIR" M="$REPO" modules >/dev/null
+make -C "$REPO/tools" LDFLAGS=-static >/dev/null
+
+mkdir -p "$OUT/root/bin" "$OUT/root/dev" "$OUT/root/proc" "$OUT/root/sys"
+cp "$(command -v busybox)" "$OUT/root/bin/busybox"
+cp "$HERE/guest-test.sh" "$OUT/root/init"
+cp "$REPO/qc71_laptop.ko" "$REPO/tools/qc71-sysfs-bench" "$OUT/root/"
+(cd "$OUT/root" && find . | cpio -o -H newc --quiet) | gzip > "$OUT/initramfs.gz"
+
+# features.c checks the DMI board name, and reads OEM string 18 from BIOS 0114 on
+set -- -smbios "type=11,value= " "$@"
+i=17
+while [ $i -ge 0 ]; do
+	set -- -smbios "type=11,value=oem$i" "$@"
+	i=$((i - 1))
+done
+
+if [ -w /dev/kvm ]; then
+	set -- -enable-kvm -cpu host "$@"
+fi
+
+timeout 600 qemu-system-x86_64 \
+	-M q35 -m 512 -smp 4 -nographic -no-reboot \
+	-kernel "$KDIR/arch/x86/boot/bzImage" \
+	-initrd "$OUT/initramfs.gz" \
+	-append "console=ttyS0 panic=-1 quiet" \
+	-acpitable file="$OUT/qc71-wmi.aml" \
+	-smbios type=0,version=QCCFL357.0114.2020.0313.1530 \
+	-smbios type=2,product=LAPQC71 \
+	"$@" | tee "$OUT/console.log"
+
+grep -q '^qc71-test: PASS' "$OUT/console.log"
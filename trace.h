@@ -0,0 +1,79 @@
+// SPDX-License-Identifier: GPL-2.0
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM qc71_laptop
+
+#if !defined(QC71_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define QC71_TRACE_H
+
+#include <linux/acpi.h>
+#include <linux/tracepoint.h>
+#include <linux/types.h>
+
+/* ========================================================================== */
+
+TRACE_EVENT(qc71_wmi_event,
+	TP_PROTO(u32 value, const union acpi_object *obj),
+
+	TP_ARGS(value, obj),
+
+	TP_STRUCT__entry(
+		__field(u32, value)
+		__field(u32, type)
+		__field(u64, integer)
+		__dynamic_array(u8, buf, (obj && obj->type == ACPI_TYPE_BUFFER) ? obj->buffer.length : 0)
+	),
+
+	TP_fast_assign(
+		__entry->value   = value;
+		__entry->type    = obj ? obj->type : ACPI_TYPE_ANY;
+		__entry->integer = (obj && obj->type == ACPI_TYPE_INTEGER) ? obj->integer.value : 0;
+
+		if (obj && obj->type == ACPI_TYPE_BUFFER)
+			memcpy(__get_dynamic_array(buf), obj->buffer.pointer, obj->buffer.length);
+	),
+
+	TP_printk("value=%#04x type=%u int=%llu buf=%s",
+		  __entry->value, __entry->type, __entry->integer,
+		  __print_hex(__get_dynamic_array(buf), __get_dynamic_array_len(buf)))
+);
+
+TRACE_EVENT(qc71_governor,
+	TP_PROTO(int temp_fan, int temp_pkg, int rpm, int pl1, int pl2, int new_pl1, int new_pl2),
+
+	TP_ARGS(temp_fan, temp_pkg, rpm, pl1, pl2, new_pl1, new_pl2),
+
+	TP_STRUCT__entry(
+		__field(int, temp_fan)
+		__field(int, temp_pkg)
+		__field(int, rpm)
+		__field(int, pl1)
+		__field(int, pl2)
+		__field(int, new_pl1)
+		__field(int, new_pl2)
+	),
+
+	TP_fast_assign(
+		__entry->temp_fan = temp_fan;
+		__entry->temp_pkg = temp_pkg;
+		__entry->rpm      = rpm;
+		__entry->pl1      = pl1;
+		__entry->pl2      = pl2;
+		__entry->new_pl1  = new_pl1;
+		__entry->new_pl2  = new_pl2;
+	),
+
+	TP_printk("temp_fan=%d temp_pkg=%d rpm=%d pl1=%d->%d pl2=%d->%d",
+		  __entry->temp_fan, __entry->temp_pkg, __entry->rpm,
+		  __entry->pl1, __entry->new_pl1, __entry->pl2, __entry->new_pl2)
+);
+
+#endif /* QC71_TRACE_H */
+
+/* ========================================================================== */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE trace
+
+#include <trace/define_trace.h>